@@ -0,0 +1,361 @@
+// aligned_vector.h
+//
+// A dense gradient type with storage laid out for the vector kernels:
+//
+//   DifferentiationContext<double, AlignedVector<double> > context(n);
+//
+// Storage starts on a cache line and is padded to a whole number of cache
+// lines. That is a multiple of the SIMD width of every kernel in
+// vector_kernels.h, so the kernels can run over the padded length on
+// aligned data, with no scalar remainder loop. Because no two gradients
+// share a cache line, threads that update different gradients do not
+// invalidate each other's lines. The padding elements hold no meaningful
+// values and are never exposed.
+//
+// AlignedVector<T, N> also keeps up to N elements, rounded up to a cache
+// line, inside the object itself. Gradients of that size or smaller never
+// allocate, and a gradient that grows past N moves to the heap.
+//
+// AlignedVector takes part in the expression templates of vector.h in the
+// same way as Vector, so a*x + b*y is still evaluated in one pass. Only
+// arithmetic element types are supported.
+
+#ifndef ALIGNED_VECTOR_H_
+#define ALIGNED_VECTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+#include "stats.h"
+#include "vector.h"
+#include "vector_kernels.h"
+
+namespace simple_differentiation {
+
+template <class T, std::size_t kInlineSize = 0>
+class AlignedVector;
+
+// AlignedVectors are held by reference in expressions, like Vectors.
+template <class T, std::size_t kInlineSize>
+struct ExpressionOperand<AlignedVector<T, kInlineSize> > {
+  typedef const AlignedVector<T, kInlineSize>& type;
+};
+
+namespace internal {
+
+template <class T, std::size_t kInlineSize>
+struct HasRunTimeSize<AlignedVector<T, kInlineSize> > : std::true_type { };
+
+const std::size_t kCacheLineSize = 64;
+
+// n rounded up to a whole number of cache lines of T.
+template <class T>
+constexpr std::size_t PaddedSize(std::size_t n) {
+  return (n + kCacheLineSize / sizeof(T) - 1) / (kCacheLineSize / sizeof(T)) *
+         (kCacheLineSize / sizeof(T));
+}
+
+// Aligned operator new goes through the slow path of most allocators, which
+// costs more than the arithmetic on a small gradient, so align by hand
+// instead: over-allocate by a cache line and keep the pointer that plain
+// operator new returned just before the aligned block, in the gap that is
+// always left since operator new aligns to at least sizeof(void*).
+inline void* AllocateCacheAligned(std::size_t bytes) {
+  char* raw = static_cast<char*>(::operator new(bytes + kCacheLineSize));
+  char* aligned = raw + kCacheLineSize -
+                  reinterpret_cast<std::uintptr_t>(raw) % kCacheLineSize;
+  reinterpret_cast<void**>(aligned)[-1] = raw;
+  return aligned;
+}
+
+inline void FreeCacheAligned(void* p) {
+  ::operator delete(static_cast<void**>(p)[-1]);
+}
+
+template <class T, std::size_t N>
+class InlineStorage {
+ protected:
+  T* inline_data() { return data_; }
+
+ private:
+  alignas(kCacheLineSize) T data_[N];
+};
+
+template <class T>
+class InlineStorage<T, 0> {
+ protected:
+  T* inline_data() { return NULL; }
+};
+
+}  // namespace internal
+
+template <class T, std::size_t kInlineSize>
+class AlignedVector
+    : public VectorExpression<AlignedVector<T, kInlineSize> >,
+      private internal::InlineStorage<T,
+                                      internal::PaddedSize<T>(kInlineSize)> {
+ public:
+  static_assert(std::is_arithmetic<T>::value,
+                "AlignedVector only holds arithmetic types.");
+
+  typedef T value_type;
+  typedef std::size_t size_type;
+  // Expressions report the allocator of their leftmost operand. An
+  // AlignedVector manages its own storage, so this is only for them.
+  typedef std::allocator<T> allocator_type;
+
+  AlignedVector() { Initialize(); }
+
+  explicit AlignedVector(size_type n, const T& value = T()) {
+    Initialize();
+    Resize(n);
+    for (size_type i = 0; i < n; ++i) {
+      data_[i] = value;
+    }
+  }
+
+  AlignedVector(const AlignedVector& other) {
+    Initialize();
+    CopyFrom(other);
+  }
+
+  // Moves never allocate, so containers such as std::vector move
+  // AlignedVectors rather than copying them when they grow.
+  AlignedVector(AlignedVector&& other) noexcept {
+    Initialize();
+    MoveFrom(&other);
+  }
+
+  template <class E>
+  AlignedVector(const VectorExpression<E>& x) {
+    Initialize();
+    Resize(x.derived().size());
+    Assign(x.derived());
+    CountWrite();
+  }
+
+  ~AlignedVector() { Deallocate(); }
+
+  AlignedVector& operator=(const AlignedVector& rhs) {
+    if (this != &rhs) {
+      CopyFrom(rhs);
+    }
+    return *this;
+  }
+
+  AlignedVector& operator=(AlignedVector&& rhs) noexcept {
+    if (this != &rhs) {
+      MoveFrom(&rhs);
+    }
+    return *this;
+  }
+
+  template <class E>
+  AlignedVector& operator=(const VectorExpression<E>& rhs) {
+    Resize(rhs.derived().size());
+    Assign(rhs.derived());
+    CountWrite();
+    return *this;
+  }
+
+  size_type size() const { return size_; }
+  // The size rounded up to whole cache lines, which the kernels run over.
+  size_type padded_size() const { return internal::PaddedSize<T>(size_); }
+  bool empty() const { return size_ == 0; }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+  T& operator[](size_type i) { return data_[i]; }
+  const T& operator[](size_type i) const { return data_[i]; }
+
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+
+  allocator_type get_allocator() const { return allocator_type(); }
+
+  template <class E>
+  AlignedVector& operator+=(const VectorExpression<E>& rhs) {
+    AddAssign(rhs.derived());
+    CountWrite();
+    return *this;
+  }
+
+  template <class E>
+  AlignedVector& operator-=(const VectorExpression<E>& rhs) {
+    SubtractAssign(rhs.derived());
+    CountWrite();
+    return *this;
+  }
+
+  // Scalars of other arithmetic types are rounded to T once, as in Vector.
+  template <class U>
+  AlignedVector& operator*=(const U& rhs) {
+    kernels::Scale(data_, static_cast<T>(rhs), data_, padded_size());
+    CountWrite();
+    return *this;
+  }
+
+  template <class U>
+  AlignedVector& operator/=(const U& rhs) {
+    kernels::Divide(data_, static_cast<T>(rhs), data_, padded_size());
+    CountWrite();
+    return *this;
+  }
+
+ private:
+  typedef internal::InlineStorage<T, internal::PaddedSize<T>(kInlineSize)>
+      Storage;
+
+  static const size_type kInlineCapacity =
+      internal::PaddedSize<T>(kInlineSize);
+
+  void Initialize() {
+    data_ = Storage::inline_data();
+    size_ = 0;
+    capacity_ = kInlineCapacity;
+  }
+
+  bool is_inline() const { return capacity_ == kInlineCapacity; }
+
+  // Sets the size to n. The contents are kept only if no storage needs to
+  // be allocated.
+  void Resize(size_type n) {
+    if (n == size_) {
+      return;
+    }
+    if (internal::PaddedSize<T>(n) > capacity_) {
+      Deallocate();
+      capacity_ = internal::PaddedSize<T>(n);
+      data_ = static_cast<T*>(internal::AllocateCacheAligned(
+          capacity_ * sizeof(T)));
+      SIMPLE_DIFFERENTIATION_COUNT(allocations, 1);
+    }
+    size_ = n;
+    // The kernels read the padding, so keep it from holding arbitrary bits
+    // such as signaling NaNs or denormals.
+    for (size_type i = n; i < padded_size(); ++i) {
+      data_[i] = T();
+    }
+  }
+
+  void Deallocate() {
+    if (!is_inline()) {
+      internal::FreeCacheAligned(data_);
+      Initialize();
+    }
+  }
+
+  void CopyFrom(const AlignedVector& other) {
+    Resize(other.size_);
+    if (size_ > 0) {
+      std::memcpy(data_, other.data_, padded_size() * sizeof(T));
+    }
+    CountWrite();
+  }
+
+  // Never allocates: inline contents fit in any AlignedVector of the same
+  // type, since heap storage is always larger than the inline storage.
+  void MoveFrom(AlignedVector* other) {
+    if (other->is_inline()) {
+      CopyFrom(*other);
+      return;
+    }
+    Deallocate();
+    data_ = other->data_;
+    size_ = other->size_;
+    capacity_ = other->capacity_;
+    other->Initialize();
+  }
+
+  void CountWrite() const {
+    SIMPLE_DIFFERENTIATION_COUNT(bytes_written,
+                                 static_cast<long>(size_ * sizeof(T)));
+  }
+
+  // As in Vector, element i of the expression may read element i of *this,
+  // but no other element, so evaluating in place is safe.
+  template <class E>
+  void Assign(const E& expression) {
+    for (size_type i = 0; i < size_; ++i) {
+      data_[i] = expression[i];
+    }
+  }
+
+  // The common expression shapes run the kernels over the padded length.
+
+  void Assign(const VectorNegation<AlignedVector>& expression) {
+    kernels::Negate(expression.operand().data(), data_, padded_size());
+  }
+
+  void Assign(const VectorSum<AlignedVector, AlignedVector>& expression) {
+    kernels::Add(expression.lhs().data(), expression.rhs().data(), data_,
+                 padded_size());
+  }
+
+  void Assign(
+      const VectorDifference<AlignedVector, AlignedVector>& expression) {
+    kernels::Subtract(expression.lhs().data(), expression.rhs().data(),
+                      data_, padded_size());
+  }
+
+  template <class U>
+  void Assign(const VectorScale<AlignedVector, U>& expression) {
+    kernels::Scale(expression.operand().data(),
+                   static_cast<T>(expression.scalar()), data_, padded_size());
+  }
+
+  template <class U>
+  void Assign(const VectorQuotient<AlignedVector, U>& expression) {
+    kernels::Divide(expression.operand().data(),
+                    static_cast<T>(expression.scalar()), data_,
+                    padded_size());
+  }
+
+  template <class U0, class U1>
+  void Assign(const VectorSum<VectorScale<AlignedVector, U0>,
+                              VectorScale<AlignedVector, U1> >& expression) {
+    kernels::Axpby(expression.lhs().operand().data(),
+                   static_cast<T>(expression.lhs().scalar()),
+                   expression.rhs().operand().data(),
+                   static_cast<T>(expression.rhs().scalar()), data_,
+                   padded_size());
+  }
+
+  template <class E>
+  void AddAssign(const E& expression) {
+    for (size_type i = 0; i < size_; ++i) {
+      data_[i] += expression[i];
+    }
+  }
+
+  void AddAssign(const AlignedVector& x) {
+    kernels::Add(data_, x.data(), data_, padded_size());
+  }
+
+  template <class E>
+  void SubtractAssign(const E& expression) {
+    for (size_type i = 0; i < size_; ++i) {
+      data_[i] -= expression[i];
+    }
+  }
+
+  void SubtractAssign(const AlignedVector& x) {
+    kernels::Subtract(data_, x.data(), data_, padded_size());
+  }
+
+  T* data_;
+  size_type size_;
+  // Elements data_ has room for, padding included. Equal to
+  // kInlineCapacity exactly when data_ is the inline storage, since heap
+  // storage is only allocated when the inline storage is too small.
+  size_type capacity_;
+};
+
+}  // namespace simple_differentiation
+
+#endif  // ALIGNED_VECTOR_H_
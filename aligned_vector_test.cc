@@ -0,0 +1,162 @@
+#define SIMPLE_DIFFERENTIATION_STATS
+
+#include "aligned_vector.h"
+#include "differentiation.h"
+#include "stats.h"
+#include "vector.h"
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::AlignedVector;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::Stats;
+using simple_differentiation::StatsScope;
+using simple_differentiation::Vector;
+
+bool IsCacheAligned(const void* p) {
+  return reinterpret_cast<std::uintptr_t>(p) % 64 == 0;
+}
+
+TEST(AlignedVectorTest, StorageIsAlignedAndPadded) {
+  AlignedVector<double> empty;
+  EXPECT_EQ(0u, empty.size());
+  EXPECT_EQ(0u, empty.padded_size());
+
+  AlignedVector<double> x(13, 2.0);
+  EXPECT_EQ(13u, x.size());
+  EXPECT_EQ(16u, x.padded_size());
+  EXPECT_TRUE(IsCacheAligned(x.data()));
+  for (std::size_t i = 0; i < x.size(); ++i) {
+    EXPECT_EQ(2.0, x[i]);
+  }
+  for (std::size_t i = x.size(); i < x.padded_size(); ++i) {
+    EXPECT_EQ(0.0, x.data()[i]);
+  }
+
+  AlignedVector<float> y(17);
+  EXPECT_EQ(32u, y.padded_size());
+  EXPECT_TRUE(IsCacheAligned(y.data()));
+
+  std::vector<AlignedVector<double, 4> > small(3, AlignedVector<double, 4>(3));
+  for (std::size_t i = 0; i < small.size(); ++i) {
+    EXPECT_TRUE(IsCacheAligned(small[i].data()));
+  }
+}
+
+TEST(AlignedVectorTest, Arithmetic) {
+  AlignedVector<double> x(5);
+  AlignedVector<double> y(5);
+  for (int i = 0; i < 5; ++i) {
+    x[i] = i + 1.0;
+    y[i] = 2.0 * i;
+  }
+  AlignedVector<double> z = 2.0 * x - y / 4.0;
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_DOUBLE_EQ(2.0 * (i + 1.0) - 0.5 * i, z[i]);
+  }
+  z = -x;
+  z += y;
+  z *= 3.0f;
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_DOUBLE_EQ(3.0 * (i - 1.0), z[i]);
+  }
+  z = x * 0.5 + y * 2.0;
+  z -= x;
+  z /= 2;
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_DOUBLE_EQ((4.0 * i - 0.5 * (i + 1.0)) / 2.0, z[i]);
+  }
+
+  // Expressions mixing in Vectors take the element-by-element path.
+  Vector<double> v(5, 1.0);
+  z = x + v;
+  EXPECT_DOUBLE_EQ(6.0, z[4]);
+}
+
+TEST(AlignedVectorTest, InlineStorage) {
+  Stats stats;
+  StatsScope scope(&stats);
+
+  AlignedVector<double, 4> x(3, 1.5);
+  AlignedVector<double, 4> copy(x);
+  AlignedVector<double, 4> moved(std::move(copy));
+  x = moved * 2.0;
+  EXPECT_EQ(0, stats.allocations);
+  EXPECT_TRUE(IsCacheAligned(x.data()));
+  EXPECT_EQ(3.0, x[2]);
+  EXPECT_EQ(1.5, moved[0]);
+
+  // Sizes past the inline capacity, which is a whole cache line, move to
+  // the heap.
+  AlignedVector<double, 4> y(8, 1.0);
+  EXPECT_EQ(0, stats.allocations);
+  AlignedVector<double, 4> z(9, 1.0);
+  EXPECT_EQ(1, stats.allocations);
+  AlignedVector<double, 4> w(std::move(z));
+  EXPECT_EQ(1, stats.allocations);
+  EXPECT_EQ(9u, w.size());
+  EXPECT_EQ(0u, z.size());
+  w = y;
+  EXPECT_EQ(8u, w.size());
+  EXPECT_EQ(1.0, w[7]);
+
+  static_assert(
+      std::is_nothrow_move_constructible<AlignedVector<double> >::value &&
+          std::is_nothrow_move_assignable<AlignedVector<double, 4> >::value,
+      "Moving an AlignedVector must not throw.");
+}
+
+template <class V>
+DifferentiationVariable<double, V> Evaluate(
+    DifferentiationContext<double, V>* context) {
+  std::vector<DifferentiationVariable<double, V> > x;
+  for (int i = 0; i < context->size(); ++i) {
+    x.push_back(context->MakeVariable(i, 0.3 + 0.1 * i));
+  }
+  DifferentiationVariable<double, V> result = context->MakeConstant(1.0);
+  for (int i = 0; i + 1 < context->size(); ++i) {
+    result += sin(x[i]) * exp(x[i + 1]) / (1.0 + x[i] * x[i]);
+    result -= sqrt(x[i + 1]) * 2.0;
+  }
+  return result * log(x[0]);
+}
+
+TEST(AlignedVectorTest, Differentiation) {
+  const int kNumVars = 11;
+  DifferentiationContext<double> context(kNumVars);
+  DifferentiationVariable<double> expected = Evaluate(&context);
+
+  DifferentiationContext<double, AlignedVector<double> > aligned_context(
+      kNumVars);
+  DifferentiationVariable<double, AlignedVector<double> > aligned =
+      Evaluate(&aligned_context);
+
+  DifferentiationContext<double, AlignedVector<double, 16> > small_context(
+      kNumVars);
+  DifferentiationVariable<double, AlignedVector<double, 16> > small =
+      Evaluate(&small_context);
+
+  EXPECT_DOUBLE_EQ(expected.value(), aligned.value());
+  EXPECT_DOUBLE_EQ(expected.value(), small.value());
+  ASSERT_EQ(static_cast<std::size_t>(kNumVars), aligned.gradient().size());
+  ASSERT_EQ(static_cast<std::size_t>(kNumVars), small.gradient().size());
+  for (int i = 0; i < kNumVars; ++i) {
+    EXPECT_NEAR(expected.gradient()[i], aligned.gradient()[i], 1e-12);
+    EXPECT_NEAR(expected.gradient()[i], small.gradient()[i], 1e-12);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
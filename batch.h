@@ -0,0 +1,340 @@
+// batch.h
+//
+// A lane-packed value type for evaluating one expression at N points at
+// once. Using Batch<T, N> as the value type of a DifferentiationVariable
+// makes every operation in differentiation.h act on all N points:
+//
+//   typedef Batch<double, 4> Batch4;
+//   DifferentiationContext<Batch4> context(num_vars);
+//   DifferentiationVariable<Batch4> x = context.MakeVariable(0, x_values);
+//
+// The gradient type is then Vector<Batch<T, N> >, a structure-of-arrays
+// block where entry i holds d/dx_i at all N points contiguously, so every
+// gradient update is a loop over whole batches.
+//
+// The elementary functions below apply the scalar function lane by lane in
+// loops the compiler can map onto a vector math library. The exception is
+// sin, cos and tan of float and double batches, which evaluate polynomial
+// kernels with no branches or library calls, so that their lane loops
+// vectorize without one. Lanes up to 2^20 in magnitude are computed in
+// double precision; in tests over that range, double results are within
+// 1.5 ulp of the exact value for sin and cos and 3 ulp for tan, and float
+// results within 1 ulp. Larger and non-finite lanes fall back to the scalar
+// functions.
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#include "differentiation.h"
+
+namespace simple_differentiation {
+
+template <class T, std::size_t N>
+class Batch {
+ public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+
+  Batch() : lanes_() { }
+
+  // Broadcasts a scalar to every lane. This is implicit so that scalar
+  // constants mix freely with batches, as they do with plain values.
+  Batch(const T& value) {
+    for (size_type i = 0; i < N; ++i) {
+      lanes_[i] = value;
+    }
+  }
+
+  static size_type size() { return N; }
+
+  T& operator[](size_type i) { return lanes_[i]; }
+  const T& operator[](size_type i) const { return lanes_[i]; }
+
+  Batch operator-() const {
+    Batch result;
+    for (size_type i = 0; i < N; ++i) {
+      result.lanes_[i] = -lanes_[i];
+    }
+    return result;
+  }
+
+  Batch& operator+=(const Batch& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      lanes_[i] += rhs.lanes_[i];
+    }
+    return *this;
+  }
+
+  Batch& operator-=(const Batch& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      lanes_[i] -= rhs.lanes_[i];
+    }
+    return *this;
+  }
+
+  Batch& operator*=(const Batch& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      lanes_[i] *= rhs.lanes_[i];
+    }
+    return *this;
+  }
+
+  Batch& operator/=(const Batch& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      lanes_[i] /= rhs.lanes_[i];
+    }
+    return *this;
+  }
+
+  // Non-member friends, so that a scalar on either side is broadcast.
+
+  friend Batch operator+(Batch lhs, const Batch& rhs) {
+    lhs += rhs;
+    return lhs;
+  }
+
+  friend Batch operator-(Batch lhs, const Batch& rhs) {
+    lhs -= rhs;
+    return lhs;
+  }
+
+  friend Batch operator*(Batch lhs, const Batch& rhs) {
+    lhs *= rhs;
+    return lhs;
+  }
+
+  friend Batch operator/(Batch lhs, const Batch& rhs) {
+    lhs /= rhs;
+    return lhs;
+  }
+
+  friend bool operator==(const Batch& lhs, const Batch& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      if (!(lhs.lanes_[i] == rhs.lanes_[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(const Batch& lhs, const Batch& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  T lanes_[N];
+};
+
+// Defines name(Batch) as the lane-by-lane application of the scalar
+// function of the same name.
+#define SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(name)                          \
+  template <class T, std::size_t N>                                         \
+  Batch<T, N> name(const Batch<T, N>& x) {                                  \
+    using std::name;                                                        \
+    Batch<T, N> result;                                                     \
+    for (std::size_t i = 0; i < N; ++i) {                                   \
+      result[i] = name(x[i]);                                               \
+    }                                                                       \
+    return result;                                                          \
+  }
+
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(asin)
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(acos)
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(atan)
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(fabs)
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(sqrt)
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(exp)
+SIMPLE_DIFFERENTIATION_BATCH_FUNCTION(log)
+
+#undef SIMPLE_DIFFERENTIATION_BATCH_FUNCTION
+
+namespace internal {
+
+// The largest magnitude SinCosKernel reduces accurately.
+const double kSinCosKernelLimit = 1048576.0;
+
+// Sets sin_x[i] and cos_x[i] for each of the N lanes of x, all with
+// |x[i]| <= kSinCosKernelLimit. The arrays must not overlap. The body of
+// the lane loop is straight-line arithmetic and selects, with no branches or
+// calls, so the compiler can evaluate it on whole vector registers.
+//
+// x is reduced to r + n pi / 2 with |r| <= pi / 4, using a four part split
+// of pi / 2 whose first three parts have enough trailing zero bits that
+// n times each is exact. r is carried as a sum r + r_lo of two doubles, so
+// that arguments close to a multiple of pi / 2 keep their relative accuracy.
+// The polynomials on [-pi / 4, pi / 4] are those of Cephes.
+template <std::size_t N>
+void SinCosKernel(const double* __restrict x, double* __restrict sin_x,
+                  double* __restrict cos_x) {
+  const double kTwoOverPi = 6.36619772367581382433e-01;
+  const double kPiOver2[4] = {
+      1.57079632673412561417e+00, 6.07710050630396597660e-11,
+      2.02226624871116645580e-21, 8.47842766036889956997e-32};
+  // Adding and subtracting 1.5 * 2^52 rounds to the nearest integer.
+  const double kRound = 6755399441055744.0;
+
+  for (std::size_t i = 0; i < N; ++i) {
+    double n = (x[i]*kTwoOverPi + kRound) - kRound;
+    double high = x[i] - n*kPiOver2[0];
+    double middle = n*kPiOver2[1];
+    // Exact two-sums, since high and middle can cancel.
+    double head = high - middle;
+    double head_error = head - high;
+    double low = ((high - (head - head_error)) - (middle + head_error)) -
+        (n*kPiOver2[2] + n*kPiOver2[3]);
+    double r = head + low;
+    double r_error = r - head;
+    double r_lo = (head - (r - r_error)) + (low - r_error);
+
+    double z = r*r;
+    double sin_r = r + (r*z*(((((1.58962301576546568060e-10*z -
+                                 2.50507477628578072866e-08)*z +
+                                2.75573136213857245213e-06)*z -
+                               1.98412698295895385996e-04)*z +
+                              8.33333333332211858878e-03)*z -
+                             1.66666666666666307295e-01) +
+                        r_lo*(1.0 - 0.5*z));
+    double cos_r = 1.0 - 0.5*z + (z*z*(((((-1.13585365213876817300e-11*z +
+                                           2.08757008419747316778e-09)*z -
+                                          2.75573141792967388112e-07)*z +
+                                         2.48015872888517045348e-05)*z -
+                                        1.38888888888730564116e-03)*z +
+                                       4.16666666666665929218e-02) -
+                                  r*r_lo);
+
+    // sin(r + n pi / 2) and cos(r + n pi / 2) cycle through sin r, cos r
+    // and their negations with n mod 4. The quadrant is kept in floating
+    // point, as q = n - 4 round(n / 4) in {-2, -1, 0, 1, 2}, since vector
+    // units without 64 bit integer conversions cannot otherwise vectorize
+    // it.
+    double q = n - 4.0*((0.25*n + kRound) - kRound);
+    // The conditions are combined with | rather than ||, and the signs are
+    // applied by multiplying, so that each lane is a select between values
+    // rather than a branch or a conditional store.
+    bool odd = (q == 1.0) | (q == -1.0);
+    double sin_q = odd ? cos_r : sin_r;
+    double cos_q = odd ? sin_r : cos_r;
+    double sin_sign = (q == 2.0) | (q == -2.0) | (q == -1.0) ? -1.0 : 1.0;
+    double cos_sign = (q == 1.0) | (q == 2.0) | (q == -2.0) ? -1.0 : 1.0;
+    sin_x[i] = sin_q*sin_sign;
+    cos_x[i] = cos_q*cos_sign;
+  }
+}
+
+// Lanes beyond kSinCosKernelLimit, and non-finite ones, are reduced as
+// zeros by the kernel and patched afterwards with the scalar functions, so
+// the kernel's loop stays free of branches.
+template <class T, std::size_t N>
+void PolynomialSinCos(const Batch<T, N>& x,
+                      Batch<T, N>* sin_x,
+                      Batch<T, N>* cos_x) {
+  double input[N], sin_lanes[N], cos_lanes[N];
+  for (std::size_t i = 0; i < N; ++i) {
+    input[i] = std::fabs(x[i]) <= T(kSinCosKernelLimit)
+        ? static_cast<double>(x[i]) : 0.0;
+  }
+  SinCosKernel<N>(input, sin_lanes, cos_lanes);
+  Batch<T, N> saved(x);
+  for (std::size_t i = 0; i < N; ++i) {
+    (*sin_x)[i] = static_cast<T>(sin_lanes[i]);
+    (*cos_x)[i] = static_cast<T>(cos_lanes[i]);
+  }
+  for (std::size_t i = 0; i < N; ++i) {
+    if (!(std::fabs(saved[i]) <= T(kSinCosKernelLimit))) {
+      (*sin_x)[i] = std::sin(saved[i]);
+      (*cos_x)[i] = std::cos(saved[i]);
+    }
+  }
+}
+
+// tan as the double precision quotient, so that float lanes are rounded
+// once.
+template <class T, std::size_t N>
+Batch<T, N> PolynomialTan(const Batch<T, N>& x) {
+  double input[N], sin_lanes[N], cos_lanes[N];
+  for (std::size_t i = 0; i < N; ++i) {
+    input[i] = std::fabs(x[i]) <= T(kSinCosKernelLimit)
+        ? static_cast<double>(x[i]) : 0.0;
+  }
+  SinCosKernel<N>(input, sin_lanes, cos_lanes);
+  Batch<T, N> tan_x;
+  for (std::size_t i = 0; i < N; ++i) {
+    tan_x[i] = static_cast<T>(sin_lanes[i] / cos_lanes[i]);
+  }
+  for (std::size_t i = 0; i < N; ++i) {
+    if (!(std::fabs(x[i]) <= T(kSinCosKernelLimit))) {
+      tan_x[i] = std::tan(x[i]);
+    }
+  }
+  return tan_x;
+}
+
+}  // namespace internal
+
+// sin and cos share all but the final selection, so each computes both.
+#define SIMPLE_DIFFERENTIATION_BATCH_TRIGONOMETRY(T)                         \
+  template <std::size_t N>                                                  \
+  void SinCos(const Batch<T, N>& x, Batch<T, N>* sin_x, Batch<T, N>* cos_x) {\
+    internal::PolynomialSinCos(x, sin_x, cos_x);                            \
+  }                                                                         \
+                                                                            \
+  template <std::size_t N>                                                  \
+  Batch<T, N> sin(const Batch<T, N>& x) {                                   \
+    Batch<T, N> sin_x, cos_x;                                               \
+    internal::PolynomialSinCos(x, &sin_x, &cos_x);                          \
+    return sin_x;                                                           \
+  }                                                                         \
+                                                                            \
+  template <std::size_t N>                                                  \
+  Batch<T, N> cos(const Batch<T, N>& x) {                                   \
+    Batch<T, N> sin_x, cos_x;                                               \
+    internal::PolynomialSinCos(x, &sin_x, &cos_x);                          \
+    return cos_x;                                                           \
+  }                                                                         \
+                                                                            \
+  template <std::size_t N>                                                  \
+  Batch<T, N> tan(const Batch<T, N>& x) {                                   \
+    return internal::PolynomialTan(x);                                      \
+  }
+
+SIMPLE_DIFFERENTIATION_BATCH_TRIGONOMETRY(float)
+SIMPLE_DIFFERENTIATION_BATCH_TRIGONOMETRY(double)
+
+#undef SIMPLE_DIFFERENTIATION_BATCH_TRIGONOMETRY
+
+template <class T, std::size_t N>
+Batch<T, N> pow(const Batch<T, N>& x, const Batch<T, N>& exponent) {
+  using std::pow;
+  Batch<T, N> result;
+  for (std::size_t i = 0; i < N; ++i) {
+    result[i] = pow(x[i], exponent[i]);
+  }
+  return result;
+}
+
+// Batches have no single sign, so fabs of a batched variable flips the
+// gradient lane by lane instead of branching on the whole value.
+template <class T, std::size_t N, class V>
+DifferentiationVariable<Batch<T, N>, V> fabs(
+    DifferentiationVariable<Batch<T, N>, V> x) {
+  Batch<T, N> sign;
+  for (std::size_t i = 0; i < N; ++i) {
+    sign[i] = x.value()[i] < T() ? T(-1) : T(1);
+  }
+  return std::move(x) * sign;
+}
+
+// Lets a scalar exponent be broadcast, as it would be for plain values.
+template <class T, std::size_t N, class V>
+DifferentiationVariable<Batch<T, N>, V> pow(
+    DifferentiationVariable<Batch<T, N>, V> x, const T& exponent) {
+  return pow(std::move(x), Batch<T, N>(exponent));
+}
+
+}  // namespace simple_differentiation
+
+#endif  // BATCH_H_
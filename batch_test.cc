@@ -0,0 +1,181 @@
+
+#include "batch.h"
+#include "differentiation.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::Batch;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+
+typedef Batch<double, 4> Batch4;
+
+TEST(BatchTest, Arithmetic) {
+  Batch4 a;
+  Batch4 b(2.0);
+  for (int i = 0; i < 4; ++i) {
+    a[i] = i + 1.0;
+  }
+  EXPECT_EQ(0.0, Batch4()[3]);
+  EXPECT_EQ(2.0, b[3]);
+
+  Batch4 c = 1.0 - a * b / 4.0 + -a;
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(1.0 - (i + 1.0) / 2.0 - (i + 1.0), c[i]);
+  }
+  EXPECT_TRUE(a + a == a * 2.0);
+  EXPECT_TRUE(a != b);
+
+  Batch4 d = sqrt(a * a);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(i + 1.0, d[i]);
+  }
+}
+
+template <class T>
+T Objective(const T& x, const T& y) {
+  return atan(x * y) + exp(sin(x) / 2.0) * log(2.0 + cos(y)) -
+      sqrt(1.0 + fabs(x - y)) + pow(2.0 + x, 1.5) / y;
+}
+
+TEST(BatchTest, MatchesPointwiseEvaluation) {
+  const double xs[4] = {0.3, -1.2, 2.0, 0.7};
+  const double ys[4] = {1.5, 0.4, -0.8, 0.7};
+
+  Batch4 x_values;
+  Batch4 y_values;
+  for (int i = 0; i < 4; ++i) {
+    x_values[i] = xs[i];
+    y_values[i] = ys[i];
+  }
+  DifferentiationContext<Batch4> batch_context(2);
+  DifferentiationVariable<Batch4> batch_result =
+      Objective(batch_context.MakeVariable(0, x_values),
+                batch_context.MakeVariable(1, y_values));
+
+  for (int i = 0; i < 4; ++i) {
+    DifferentiationContext<double> context(2);
+    DifferentiationVariable<double> result =
+        Objective(context.MakeVariable(0, xs[i]),
+                  context.MakeVariable(1, ys[i]));
+    EXPECT_DOUBLE_EQ(result.value(), batch_result.value()[i]);
+    EXPECT_DOUBLE_EQ(result.gradient()[0], batch_result.gradient()[0][i]);
+    EXPECT_DOUBLE_EQ(result.gradient()[1], batch_result.gradient()[1][i]);
+  }
+}
+
+// The error of value in units in the last place of the exact result,
+// approximated by the long double result.
+template <class T>
+double UlpError(T value, long double exact) {
+  T rounded = static_cast<T>(exact);
+  T ulp = std::nextafter(std::fabs(rounded),
+                         std::numeric_limits<T>::infinity()) -
+      std::fabs(rounded);
+  return static_cast<double>(std::fabs(value - exact) / ulp);
+}
+
+// Returns the largest errors of the batched sin, cos and tan over random
+// arguments of magnitude at most range.
+template <class T>
+void MaxTrigonometryErrors(double range, double errors[3]) {
+  typedef Batch<T, 8> BatchT;
+  std::mt19937 generator(7);
+  std::uniform_real_distribution<double> distribution(-range, range);
+  errors[0] = errors[1] = errors[2] = 0.0;
+  for (int k = 0; k < 20000; ++k) {
+    BatchT x;
+    for (int i = 0; i < 8; ++i) {
+      x[i] = static_cast<T>(distribution(generator));
+    }
+    BatchT sin_x, cos_x;
+    SinCos(x, &sin_x, &cos_x);
+    BatchT sin_only = sin(x);
+    BatchT cos_only = cos(x);
+    BatchT tan_x = tan(x);
+    for (int i = 0; i < 8; ++i) {
+      long double x_i = x[i];
+      errors[0] = std::fmax(errors[0], UlpError(sin_x[i], std::sin(x_i)));
+      errors[0] = std::fmax(errors[0], UlpError(sin_only[i], std::sin(x_i)));
+      errors[1] = std::fmax(errors[1], UlpError(cos_x[i], std::cos(x_i)));
+      errors[1] = std::fmax(errors[1], UlpError(cos_only[i], std::cos(x_i)));
+      errors[2] = std::fmax(errors[2], UlpError(tan_x[i], std::tan(x_i)));
+    }
+  }
+}
+
+TEST(BatchTest, TrigonometryIsAccurate) {
+  const double kRanges[2] = {3.2, 1048576.0};
+  for (int r = 0; r < 2; ++r) {
+    double errors[3];
+    MaxTrigonometryErrors<double>(kRanges[r], errors);
+    EXPECT_LE(errors[0], 1.5);
+    EXPECT_LE(errors[1], 1.5);
+    EXPECT_LE(errors[2], 3.0);
+
+    MaxTrigonometryErrors<float>(kRanges[r], errors);
+    EXPECT_LE(errors[0], 1.0);
+    EXPECT_LE(errors[1], 1.0);
+    EXPECT_LE(errors[2], 1.0);
+  }
+}
+
+TEST(BatchTest, TrigonometryNearMultiplesOfHalfPi) {
+  const long double kHalfPi = 1.57079632679489661923132169163975144L;
+  Batch4 x;
+  for (int k = 1; k < 600000; k += 9973) {
+    for (int i = 0; i < 4; ++i) {
+      x[i] = static_cast<double>((k + i) * kHalfPi);
+    }
+    Batch4 sin_x = sin(x);
+    Batch4 cos_x = cos(x);
+    for (int i = 0; i < 4; ++i) {
+      long double x_i = x[i];
+      EXPECT_LE(UlpError(sin_x[i], std::sin(x_i)), 1.5) << x_i;
+      EXPECT_LE(UlpError(cos_x[i], std::cos(x_i)), 1.5) << x_i;
+    }
+  }
+}
+
+TEST(BatchTest, TrigonometryFallsBackOutsideKernelRange) {
+  Batch4 x;
+  x[0] = 0.5;
+  x[1] = 1.0e10;
+  x[2] = -std::numeric_limits<double>::infinity();
+  x[3] = std::numeric_limits<double>::quiet_NaN();
+  Batch4 sin_x = sin(x);
+  Batch4 cos_x = cos(x);
+  EXPECT_EQ(std::sin(1.0e10), sin_x[1]);
+  EXPECT_EQ(std::cos(1.0e10), cos_x[1]);
+  EXPECT_TRUE(std::isnan(sin_x[2]));
+  EXPECT_TRUE(std::isnan(cos_x[3]));
+  EXPECT_NEAR(std::sin(0.5), sin_x[0], 1.0e-16);
+}
+
+TEST(BatchTest, TangentDerivative) {
+  Batch4 x_values;
+  for (int i = 0; i < 4; ++i) {
+    x_values[i] = 0.4*i - 0.7;
+  }
+  DifferentiationContext<Batch4> context(1);
+  DifferentiationVariable<Batch4> result =
+      tan(context.MakeVariable(0, x_values));
+  for (int i = 0; i < 4; ++i) {
+    double cos_x = std::cos(x_values[i]);
+    EXPECT_DOUBLE_EQ(std::tan(x_values[i]), result.value()[i]);
+    EXPECT_DOUBLE_EQ(1.0 / (cos_x*cos_x), result.gradient()[0][i]);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
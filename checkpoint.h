@@ -0,0 +1,254 @@
+// checkpoint.h
+//
+// Reverse mode through long time-stepping loops. Recording every step of a
+// simulation on one tape takes memory proportional to the number of steps;
+// instead, CheckpointedGradient keeps at most num_checkpoints intermediate
+// states, tapes one step at a time during the backward sweep and recomputes
+// the states it did not keep from the nearest earlier one. Checkpoints are
+// placed by the binomial schedule of Griewank's Revolve, which makes the
+// number of recomputed steps as small as possible for the given budget:
+// it grows like num_steps * r, where r is the smallest number with
+// C(num_checkpoints + 1 + r, r) >= num_steps.
+//
+// The simulation is given as a step function and a loss on the final
+// state, both templates over the variable type since they are run both on
+// plain values and on taped variables:
+//
+//   struct Step {
+//     template <class Variable>
+//     void operator()(int step, std::vector<Variable>* state) const {
+//       (*state)[1] -= 0.01 * sin((*state)[0]);
+//       (*state)[0] += 0.01 * (*state)[1];
+//     }
+//   };
+//
+//   struct Loss {
+//     template <class Variable>
+//     Variable operator()(const std::vector<Variable>& state) const {
+//       return state[0] * state[0];
+//     }
+//   };
+//
+//   Vector<double> gradient;
+//   double loss = CheckpointedGradient(Step(), Loss(), initial_state,
+//                                      10000, 20, &gradient);
+//
+// Steps must not change the size of the state. Parameters to differentiate
+// with respect to can be carried in the state and left unchanged by every
+// step.
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "differentiation.h"
+#include "tape.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+// What a checkpointed gradient cost.
+struct CheckpointStats {
+  CheckpointStats()
+      : forward_steps(0), taped_steps(0), max_checkpoints(0) { }
+
+  // Steps run on plain values to reach or recompute states.
+  int forward_steps;
+  // Steps recorded and swept backward; always the number of steps.
+  int taped_steps;
+  // The most intermediate states held at once.
+  int max_checkpoints;
+};
+
+namespace internal {
+
+// C(snapshots + repetitions, snapshots), the most steps that can be
+// reversed while storing at most that many states, including the first,
+// and running no step forward more than repetitions times. Saturates
+// rather than overflowing.
+inline long MaxReversibleSteps(int snapshots, int repetitions) {
+  const long kLimit = 1L << 40;
+  long steps = 1;
+  for (int i = 1; i <= snapshots; ++i) {
+    steps = steps * (repetitions + i) / i;
+    if (steps > kLimit) {
+      return kLimit;
+    }
+  }
+  return steps;
+}
+
+template <class T, class Step, class Loss>
+class CheckpointReverser {
+ public:
+  CheckpointReverser(const Step& step,
+                     const Loss& loss,
+                     int state_size,
+                     int num_steps,
+                     CheckpointStats* stats)
+      : step_(step),
+        loss_(loss),
+        num_steps_(num_steps),
+        context_(state_size),
+        stats_(stats),
+        num_checkpoints_(0),
+        loss_value_() { }
+
+  // Sets *adjoint to the gradient of the loss with respect to the state
+  // before step begin, given that state and with the loss's gradient with
+  // respect to the state after step end - 1 in *adjoint (unless end is the
+  // last step, where the loss is taped along with it). At most checkpoints
+  // further states are kept.
+  void Reverse(int begin,
+               int end,
+               const std::vector<T>& state,
+               int checkpoints,
+               std::vector<T>* adjoint) {
+    int length = end - begin;
+    if (length == 1) {
+      AdjointStep(begin, state, adjoint);
+      return;
+    }
+    if (checkpoints == 0) {
+      for (int i = end - 1; i >= begin; --i) {
+        std::vector<T> current(state);
+        Advance(begin, i, &current);
+        AdjointStep(i, current, adjoint);
+      }
+      return;
+    }
+
+    // Split where Revolve does, which attains the least total number of
+    // forward steps: r * length - C(snapshots + r, snapshots + 1) for the
+    // smallest r with C(snapshots + r, snapshots) >= length.
+    int snapshots = checkpoints + 1;
+    int repetitions = 1;
+    while (MaxReversibleSteps(snapshots, repetitions) < length) {
+      ++repetitions;
+    }
+    long left = length - MaxReversibleSteps(snapshots - 1, repetitions - 1);
+    long most = MaxReversibleSteps(snapshots, repetitions - 1);
+    if (left > most) {
+      left = most;
+    }
+    int middle = begin + (left > 1 ? static_cast<int>(left) : 1);
+    {
+      std::vector<T> checkpoint(state);
+      Advance(begin, middle, &checkpoint);
+      ++num_checkpoints_;
+      if (num_checkpoints_ > stats_->max_checkpoints) {
+        stats_->max_checkpoints = num_checkpoints_;
+      }
+      Reverse(middle, end, checkpoint, checkpoints - 1, adjoint);
+      --num_checkpoints_;
+    }
+    Reverse(begin, middle, state, checkpoints, adjoint);
+  }
+
+  // Sets *adjoint to the gradient of the loss with respect to state.
+  void AdjointLoss(const std::vector<T>& state, std::vector<T>* adjoint) {
+    std::vector<Variable> variables;
+    MakeVariables(state, &variables);
+    Record(loss_(variables), adjoint);
+  }
+
+  const T& loss_value() const { return loss_value_; }
+
+ private:
+  typedef DifferentiationVariable<T, TapeGradient<T> > Variable;
+
+  void Advance(int begin, int end, std::vector<T>* state) {
+    for (int i = begin; i < end; ++i) {
+      step_(i, state);
+    }
+    stats_->forward_steps += end - begin;
+  }
+
+  // Replaces the adjoint of the state after step i with the adjoint of the
+  // state before it.
+  void AdjointStep(int i, const std::vector<T>& state,
+                   std::vector<T>* adjoint) {
+    std::vector<Variable> variables;
+    MakeVariables(state, &variables);
+    step_(i, &variables);
+    ++stats_->taped_steps;
+    if (i == num_steps_ - 1) {
+      Record(loss_(variables), adjoint);
+      return;
+    }
+    // The adjoint of the step is the gradient of the state after it,
+    // weighted by that state's adjoint.
+    Variable weighted = context_.MakeConstant(T());
+    for (std::size_t k = 0; k < variables.size(); ++k) {
+      if ((*adjoint)[k] != T()) {
+        weighted += variables[k] * (*adjoint)[k];
+      }
+    }
+    Vector<T> gradient = context_.Backward(weighted);
+    adjoint->assign(gradient.begin(), gradient.end());
+  }
+
+  void MakeVariables(const std::vector<T>& state,
+                     std::vector<Variable>* variables) {
+    context_.Clear();
+    variables->reserve(state.size());
+    for (std::size_t k = 0; k < state.size(); ++k) {
+      variables->push_back(
+          context_.MakeVariable(static_cast<int>(k), state[k]));
+    }
+  }
+
+  void Record(const Variable& loss, std::vector<T>* adjoint) {
+    loss_value_ = loss.value();
+    Vector<T> gradient = context_.Backward(loss);
+    adjoint->assign(gradient.begin(), gradient.end());
+  }
+
+  Step step_;
+  Loss loss_;
+  int num_steps_;
+  DifferentiationContext<T, TapeGradient<T> > context_;
+  CheckpointStats* stats_;
+  int num_checkpoints_;
+  T loss_value_;
+};
+
+}  // namespace internal
+
+// Returns loss(x_n), where x_0 is initial_state and step(i, &state) takes
+// x_i to x_{i+1}, and sets *gradient to its gradient with respect to
+// initial_state. At most num_checkpoints states besides initial_state are
+// kept at once: fewer checkpoints save memory at the cost of recomputing
+// more steps, and num_steps - 1 or more recomputes nothing. If stats is
+// not NULL, it receives the cost of the computation.
+template <class T, class Step, class Loss>
+T CheckpointedGradient(const Step& step,
+                       const Loss& loss,
+                       const std::vector<T>& initial_state,
+                       int num_steps,
+                       int num_checkpoints,
+                       Vector<T>* gradient,
+                       CheckpointStats* stats = NULL) {
+  CheckpointStats local_stats;
+  if (stats == NULL) {
+    stats = &local_stats;
+  }
+  *stats = CheckpointStats();
+  internal::CheckpointReverser<T, Step, Loss> reverser(
+      step, loss, static_cast<int>(initial_state.size()), num_steps, stats);
+
+  std::vector<T> adjoint;
+  if (num_steps == 0) {
+    reverser.AdjointLoss(initial_state, &adjoint);
+  } else {
+    reverser.Reverse(0, num_steps, initial_state, num_checkpoints, &adjoint);
+  }
+  gradient->assign(adjoint.begin(), adjoint.end());
+  return reverser.loss_value();
+}
+
+}  // namespace simple_differentiation
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,137 @@
+
+#include "checkpoint.h"
+#include "differentiation.h"
+#include "tape.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::CheckpointStats;
+using simple_differentiation::CheckpointedGradient;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::TapeGradient;
+using simple_differentiation::Vector;
+using simple_differentiation::internal::MaxReversibleSteps;
+
+// A pendulum with friction, integrated with symplectic Euler. The state is
+// (angle, velocity, length); the length is a parameter.
+struct PendulumStep {
+  template <class Variable>
+  void operator()(int step, std::vector<Variable>* state) const {
+    std::vector<Variable>& x = *state;
+    double dt = 0.01 * (1.0 + 0.1 * (step % 3));
+    x[1] = x[1] - dt * (9.81 / x[2] * sin(x[0]) + 0.1 * x[1]);
+    x[0] = x[0] + dt * x[1];
+  }
+};
+
+struct PendulumLoss {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    return x[0] * x[0] + 0.5 * x[1] * x[1];
+  }
+};
+
+// The gradient from a single tape of every step.
+double TapedGradient(const std::vector<double>& initial_state,
+                     int num_steps,
+                     Vector<double>* gradient) {
+  typedef DifferentiationVariable<double, TapeGradient<double> > Variable;
+  DifferentiationContext<double, TapeGradient<double> > context(3);
+  std::vector<Variable> state;
+  for (int k = 0; k < 3; ++k) {
+    state.push_back(context.MakeVariable(k, initial_state[k]));
+  }
+  for (int i = 0; i < num_steps; ++i) {
+    PendulumStep()(i, &state);
+  }
+  Variable loss = PendulumLoss()(state);
+  *gradient = context.Backward(loss);
+  return loss.value();
+}
+
+TEST(CheckpointTest, MaxReversibleSteps) {
+  EXPECT_EQ(1, MaxReversibleSteps(0, 7));
+  EXPECT_EQ(1, MaxReversibleSteps(5, 0));
+  EXPECT_EQ(6, MaxReversibleSteps(5, 1));
+  EXPECT_EQ(252, MaxReversibleSteps(5, 5));
+  EXPECT_EQ(1L << 40, MaxReversibleSteps(1000, 1000));
+}
+
+TEST(CheckpointTest, MatchesFullTape) {
+  const int kNumSteps = 150;
+  std::vector<double> initial_state = {0.8, -0.2, 1.5};
+  Vector<double> expected;
+  double expected_loss = TapedGradient(initial_state, kNumSteps, &expected);
+
+  int checkpoint_counts[] = {0, 1, 2, 5, 20, 149, 500};
+  int previous_forward_steps = kNumSteps * kNumSteps;
+  for (int c = 0; c < 7; ++c) {
+    int checkpoints = checkpoint_counts[c];
+    Vector<double> gradient;
+    CheckpointStats stats;
+    double loss = CheckpointedGradient(PendulumStep(), PendulumLoss(),
+                                       initial_state, kNumSteps, checkpoints,
+                                       &gradient, &stats);
+    EXPECT_NEAR(expected_loss, loss, 1e-14);
+    ASSERT_EQ(3, gradient.size());
+    for (int k = 0; k < 3; ++k) {
+      EXPECT_NEAR(expected[k], gradient[k], 1e-12 * (1.0 + fabs(expected[k])));
+    }
+
+    // More memory never costs more recomputation.
+    EXPECT_EQ(kNumSteps, stats.taped_steps);
+    EXPECT_LE(stats.max_checkpoints, checkpoints);
+    EXPECT_LE(stats.forward_steps, previous_forward_steps);
+    previous_forward_steps = stats.forward_steps;
+  }
+  // With enough checkpoints each state is computed once.
+  EXPECT_EQ(kNumSteps - 1, previous_forward_steps);
+}
+
+TEST(CheckpointTest, BinomialCost) {
+  // With s states stored, counting the first, l steps are reversed in
+  // r * l - C(s + 1 + r - 1, s + 1) forward steps at best, where r is the
+  // smallest number with C(s + r, s) >= l.
+  std::vector<double> initial_state = {0.3, 0.1, 1.0};
+  for (int checkpoints = 1; checkpoints <= 4; ++checkpoints) {
+    for (int steps = 2; steps <= 60; steps += 7) {
+      int snapshots = checkpoints + 1;
+      int r = 0;
+      while (MaxReversibleSteps(snapshots, r) < steps) {
+        ++r;
+      }
+      long expected = r * steps - MaxReversibleSteps(snapshots + 1, r - 1);
+      Vector<double> gradient;
+      CheckpointStats stats;
+      CheckpointedGradient(PendulumStep(), PendulumLoss(), initial_state,
+                           steps, checkpoints, &gradient, &stats);
+      EXPECT_EQ(expected, stats.forward_steps)
+          << checkpoints << " checkpoints, " << steps << " steps";
+    }
+  }
+}
+
+TEST(CheckpointTest, NoSteps) {
+  std::vector<double> initial_state = {0.5, 2.0, 1.0};
+  Vector<double> gradient;
+  double loss = CheckpointedGradient(PendulumStep(), PendulumLoss(),
+                                     initial_state, 0, 3, &gradient);
+  EXPECT_EQ(2.25, loss);
+  ASSERT_EQ(3, gradient.size());
+  EXPECT_EQ(1.0, gradient[0]);
+  EXPECT_EQ(2.0, gradient[1]);
+  EXPECT_EQ(0.0, gradient[2]);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,165 @@
+// codegen.h
+//
+// C++ source generation from traced programs, for objectives hot enough
+// that even replaying a Program costs too much. The generated function is
+// straight-line code with one local per instruction and no dependence on
+// this library:
+//
+//   Program<double> program = Optimize(TraceGradient(f, x0));
+//   GenerateGradientSource(program, "ObjectiveGradient", &std::cout);
+//
+// emits
+//
+//   inline double ObjectiveGradient(const double* x, double* gradient) {
+//     ...
+//   }
+//
+// which returns f(x) and stores its gradient. Like replay, the generated
+// code follows the control flow taken at trace time.
+
+#ifndef CODEGEN_H_
+#define CODEGEN_H_
+
+#include <cmath>
+#include <ios>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "program.h"
+
+namespace simple_differentiation {
+
+template <class T>
+struct SourceTypeName;
+
+template <>
+struct SourceTypeName<float> {
+  static const char* Get() { return "float"; }
+  static const char* LiteralSuffix() { return "f"; }
+};
+
+template <>
+struct SourceTypeName<double> {
+  static const char* Get() { return "double"; }
+  static const char* LiteralSuffix() { return ""; }
+};
+
+template <>
+struct SourceTypeName<long double> {
+  static const char* Get() { return "long double"; }
+  static const char* LiteralSuffix() { return "L"; }
+};
+
+namespace internal {
+
+// Returns a literal that reads back as exactly value.
+template <class T>
+std::string SourceLiteral(const T& value) {
+  const std::string type = SourceTypeName<T>::Get();
+  if (value != value) {
+    return "std::numeric_limits<" + type + ">::quiet_NaN()";
+  }
+  if (std::isinf(value)) {
+    return std::string(value < T() ? "-" : "") + "std::numeric_limits<" +
+        type + ">::infinity()";
+  }
+  // The suffix gives the literal type T, so that it is not first rounded
+  // to double.
+  std::ostringstream literal;
+  literal << std::hexfloat << value << SourceTypeName<T>::LiteralSuffix();
+  return literal.str();
+}
+
+inline const char* FunctionName(Opcode opcode) {
+  switch (opcode) {
+    case kSin: return "std::sin";
+    case kCos: return "std::cos";
+    case kTan: return "std::tan";
+    case kAsin: return "std::asin";
+    case kAcos: return "std::acos";
+    case kAtan: return "std::atan";
+    case kFabs: return "std::fabs";
+    case kSqrt: return "std::sqrt";
+    case kExp: return "std::exp";
+    case kLog: return "std::log";
+    case kPow: return "std::pow";
+    default: return NULL;
+  }
+}
+
+}  // namespace internal
+
+// Writes a C++ function that evaluates program, whose output 0 must be the
+// function value and whose output 1 + j must be the derivative with respect
+// to input j, as produced by TraceGradient.
+template <class T>
+void GenerateGradientSource(const Program<T>& program,
+                            const std::string& function_name,
+                            std::ostream* out) {
+  const std::string type = SourceTypeName<T>::Get();
+  *out << "// Generated by simple_differentiation. Do not edit.\n"
+       << "\n"
+       << "#include <cmath>\n"
+       << "#include <limits>\n"
+       << "\n"
+       << "// Returns the function value and stores the "
+       << program.num_outputs() - 1 << " partial derivatives in gradient.\n"
+       << "inline " << type << " " << function_name << "(const " << type
+       << "* x, " << type << "* gradient) {\n";
+
+  for (int i = 0; i < program.size(); ++i) {
+    const typename Program<T>::Instruction& instruction =
+        program.instruction(i);
+    const int a = instruction.operands[0];
+    const int b = instruction.operands[1];
+    *out << "  const " << type << " v" << i << " = ";
+    switch (instruction.opcode) {
+      case kInput:
+        *out << "x[" << a << "]";
+        break;
+      case kConstant:
+        *out << internal::SourceLiteral(program.constant(a));
+        break;
+      case kAdd:
+        *out << "v" << a << " + v" << b;
+        break;
+      case kSubtract:
+        *out << "v" << a << " - v" << b;
+        break;
+      case kMultiply:
+        *out << "v" << a << " * v" << b;
+        break;
+      case kDivide:
+        *out << "v" << a << " / v" << b;
+        break;
+      case kNegate:
+        *out << "-v" << a;
+        break;
+      case kSign:
+        // Casts rather than functional casts, which cannot name a type of
+        // two words such as long double.
+        *out << "v" << a << " < static_cast<" << type << ">(0) ? static_cast<"
+             << type << ">(-1) : static_cast<" << type << ">(1)";
+        break;
+      case kPow:
+        *out << internal::FunctionName(instruction.opcode) << "(v" << a
+             << ", v" << b << ")";
+        break;
+      default:
+        *out << internal::FunctionName(instruction.opcode) << "(v" << a
+             << ")";
+    }
+    *out << ";\n";
+  }
+
+  for (int k = 1; k < program.num_outputs(); ++k) {
+    *out << "  gradient[" << k - 1 << "] = v" << program.output(k) << ";\n";
+  }
+  *out << "  return v" << program.output(0) << ";\n"
+       << "}\n";
+}
+
+}  // namespace simple_differentiation
+
+#endif  // CODEGEN_H_
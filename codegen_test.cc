@@ -0,0 +1,143 @@
+
+#include "codegen.h"
+#include "codegen_test_kernel.h"
+#include "codegen_test_objective.h"
+#include "differentiation.h"
+#include "program.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::CodegenTestObjective;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::GenerateGradientSource;
+using simple_differentiation::Program;
+using simple_differentiation::kCodegenTestInputs;
+using simple_differentiation::kCos;
+using simple_differentiation::kMultiply;
+using simple_differentiation::kSign;
+using simple_differentiation::kSin;
+
+TEST(CodegenTest, Source) {
+  // f(x) = 0.1 * sin(x), with the derivative 0.1 * cos(x) written out.
+  Program<double> program;
+  int x = program.AddInput(0);
+  int scale = program.AddConstant(0.1);
+  program.AddOutput(program.AddInstruction(
+      kMultiply, scale, program.AddInstruction(kSin, x)));
+  program.AddOutput(program.AddInstruction(
+      kMultiply, scale,
+      program.AddInstruction(kCos, x)));
+
+  std::ostringstream source;
+  GenerateGradientSource(program, "Scaled", &source);
+  const std::string text = source.str();
+  EXPECT_NE(std::string::npos,
+            text.find("inline double Scaled(const double* x, "
+                      "double* gradient) {"));
+  EXPECT_NE(std::string::npos, text.find("const double v0 = x[0];"));
+  EXPECT_NE(std::string::npos, text.find("const double v2 = std::sin(v0);"));
+  EXPECT_NE(std::string::npos, text.find("gradient[0] = v5;"));
+  EXPECT_NE(std::string::npos, text.find("return v3;"));
+
+  // Constants are written in hexadecimal so that they read back exactly.
+  std::string::size_type begin = text.find("v1 = ") + 5;
+  std::string literal = text.substr(begin, text.find(';', begin) - begin);
+  EXPECT_EQ(0.1, std::strtod(literal.c_str(), NULL));
+}
+
+TEST(CodegenTest, LongDoubleSource) {
+  // sign(x) * 0.1L, whose constant is not a double.
+  Program<long double> program;
+  int x = program.AddInput(0);
+  program.AddOutput(program.AddInstruction(
+      kMultiply, program.AddInstruction(kSign, x),
+      program.AddConstant(0.1L)));
+
+  std::ostringstream source;
+  GenerateGradientSource(program, "Long", &source);
+  const std::string text = source.str();
+  EXPECT_NE(std::string::npos,
+            text.find("inline long double Long(const long double* x, "
+                      "long double* gradient) {"));
+  EXPECT_NE(std::string::npos,
+            text.find("static_cast<long double>(-1)"));
+
+  std::string::size_type begin = text.find("0x");
+  ASSERT_NE(std::string::npos, begin);
+  std::string literal = text.substr(begin, text.find(';', begin) - begin);
+  ASSERT_EQ('L', literal[literal.size() - 1]);
+  EXPECT_EQ(0.1L, std::strtold(literal.c_str(), NULL));
+}
+
+TEST(CodegenTest, SpecialConstants) {
+  Program<float> program;
+  int x = program.AddInput(0);
+  program.AddOutput(program.AddInstruction(
+      kMultiply, x,
+      program.AddConstant(-std::numeric_limits<float>::infinity())));
+  program.AddOutput(program.AddConstant(
+      std::numeric_limits<float>::quiet_NaN()));
+
+  std::ostringstream source;
+  GenerateGradientSource(program, "Special", &source);
+  const std::string text = source.str();
+  EXPECT_NE(std::string::npos,
+            text.find("inline float Special(const float* x, "
+                      "float* gradient) {"));
+  EXPECT_NE(std::string::npos,
+            text.find("-std::numeric_limits<float>::infinity()"));
+  EXPECT_NE(std::string::npos,
+            text.find("std::numeric_limits<float>::quiet_NaN()"));
+}
+
+TEST(CodegenTest, KernelMatchesFreshEvaluation) {
+  // The kernel was traced at x[j] = 0.1 * (j + 1). The differences change
+  // sign in the other points.
+  std::vector<std::vector<double> > points = {
+    {0.1, 0.2, 0.3, 0.4, 0.5}, {1.0, 0.2, -0.4, 0.9, -0.1},
+    {-0.3, 0.5, -1.1, -0.2, 0.9}};
+  for (std::size_t p = 0; p < points.size(); ++p) {
+    const std::vector<double>& x = points[p];
+    DifferentiationContext<double> context(kCodegenTestInputs);
+    std::vector<DifferentiationVariable<double> > inputs;
+    for (int j = 0; j < kCodegenTestInputs; ++j) {
+      inputs.push_back(context.MakeVariable(j, x[j]));
+    }
+    DifferentiationVariable<double> expected =
+        CodegenTestObjective()(inputs);
+
+    double gradient[kCodegenTestInputs];
+    double value = CodegenTestGradient(x.data(), gradient);
+    EXPECT_NEAR(expected.value(), value, 1e-12);
+    for (int j = 0; j < kCodegenTestInputs; ++j) {
+      EXPECT_NEAR(expected.gradient()[j], gradient[j], 1e-12);
+    }
+
+    std::vector<long double> long_x(x.begin(), x.end());
+    long double long_gradient[kCodegenTestInputs];
+    long double long_value =
+        CodegenTestLongGradient(long_x.data(), long_gradient);
+    EXPECT_NEAR(expected.value(), static_cast<double>(long_value), 1e-12);
+    for (int j = 0; j < kCodegenTestInputs; ++j) {
+      EXPECT_NEAR(expected.gradient()[j],
+                  static_cast<double>(long_gradient[j]), 1e-12);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
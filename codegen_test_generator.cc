@@ -0,0 +1,30 @@
+
+// Writes codegen_test_kernel.h, the generated gradients of
+// CodegenTestObjective in double and long double, to standard output.
+
+#include "codegen.h"
+#include "codegen_test_objective.h"
+#include "optimize.h"
+#include "trace.h"
+
+#include <iostream>
+#include <vector>
+
+int main() {
+  using namespace simple_differentiation;
+  std::vector<double> x0(kCodegenTestInputs);
+  for (int j = 0; j < kCodegenTestInputs; ++j) {
+    x0[j] = 0.1 * (j + 1);
+  }
+  Program<double> program =
+      Optimize(TraceGradient(CodegenTestObjective(), x0));
+  GenerateGradientSource(program, "CodegenTestGradient", &std::cout);
+
+  std::vector<long double> long_x0(x0.begin(), x0.end());
+  Program<long double> long_program =
+      Optimize(TraceGradient(CodegenTestObjective(), long_x0));
+  std::cout << "\n";
+  GenerateGradientSource(long_program, "CodegenTestLongGradient",
+                         &std::cout);
+  return 0;
+}
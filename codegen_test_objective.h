@@ -0,0 +1,33 @@
+// codegen_test_objective.h
+//
+// The objective compiled by codegen_test_generator into
+// codegen_test_kernel.h and checked against fresh evaluation in
+// codegen_test.
+
+#ifndef CODEGEN_TEST_OBJECTIVE_H_
+#define CODEGEN_TEST_OBJECTIVE_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace simple_differentiation {
+
+const int kCodegenTestInputs = 5;
+
+struct CodegenTestObjective {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    Variable sum = x[0] * x[1] / (1.0 + x[2] * x[2]);
+    for (std::size_t i = 1; i < x.size(); ++i) {
+      sum += sin(x[i - 1]) * exp(x[i] / 2.0) - fabs(x[i] - x[i - 1]);
+      sum += 2.0 * atan(x[i]) + sqrt(x[i] * x[i] + 1.0) - log(2.0 + cos(x[i]));
+      sum -= pow(x[i] * x[i] + 1.0, 1.5) / tan(x[i] / 4.0 + 1.0);
+      sum += asin(x[i] / 3.0) * acos(x[i - 1] / 3.0);
+    }
+    return sum;
+  }
+};
+
+}  // namespace simple_differentiation
+
+#endif  // CODEGEN_TEST_OBJECTIVE_H_
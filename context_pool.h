@@ -0,0 +1,202 @@
+// context_pool.h
+//
+// Reusable contexts for concurrent evaluations. A DifferentiationContext is
+// not safe to share between threads, and making a fresh one per evaluation
+// costs allocations that contend in the system allocator under load. A
+// ContextPool makes a fixed number of contexts up front and lends them out:
+//
+//   ContextPool<double, TapeGradient<double> > contexts(n, num_threads);
+//
+//   // On any thread:
+//   ContextPool<double, TapeGradient<double> >::Lease context =
+//       contexts.Acquire();
+//   ... context->MakeVariable(...), context->Backward(...) ...
+//
+// Acquire and returning a Lease are lock-free and safe to call from any
+// number of threads at once. Each context is used by one thread at a time,
+// and contexts are handed out most recently returned first, so a busy
+// thread tends to get back the context, and storage, it used last. A
+// returned context is recycled (its tape cleared or its gradient pool
+// reset), so variables made from a Lease must not outlive it.
+
+#ifndef CONTEXT_POOL_H_
+#define CONTEXT_POOL_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "differentiation.h"
+#include "gradient_pool.h"
+#include "tape.h"
+
+namespace simple_differentiation {
+
+namespace internal {
+
+// Prepares a context for its next user. Contexts with dense gradients keep
+// no state between evaluations.
+template <class T, class V>
+void Recycle(DifferentiationContext<T, V>*) { }
+
+template <class T>
+void Recycle(DifferentiationContext<T, TapeGradient<T> >* context) {
+  context->Clear();
+}
+
+template <class T>
+void Recycle(DifferentiationContext<T, PooledVector<T> >* context) {
+  context->Reset();
+}
+
+// Preallocates storage for an evaluation of the given size: tape nodes for
+// tape contexts, live gradients for pooled ones.
+template <class T, class V>
+void Reserve(DifferentiationContext<T, V>*, int) { }
+
+template <class T>
+void Reserve(DifferentiationContext<T, TapeGradient<T> >* context, int size) {
+  context->Reserve(size);
+}
+
+template <class T>
+void Reserve(DifferentiationContext<T, PooledVector<T> >* context, int size) {
+  context->Reserve(size);
+}
+
+}  // namespace internal
+
+template <class T, class V = Vector<T> >
+class ContextPool {
+ public:
+  typedef DifferentiationContext<T, V> Context;
+
+  // Exclusive use of one context until destroyed.
+  class Lease {
+   public:
+    Lease(Lease&& other)
+        : pool_(other.pool_),
+          slot_(other.slot_),
+          context_(other.context_),
+          overflow_(std::move(other.overflow_)) {
+      other.pool_ = NULL;
+    }
+
+    ~Lease() {
+      if (pool_ != NULL && slot_ >= 0) {
+        pool_->Release(slot_);
+      }
+    }
+
+    Context& operator*() const { return *context_; }
+    Context* operator->() const { return context_; }
+    Context* get() const { return context_; }
+
+   private:
+    friend class ContextPool;
+
+    Lease(ContextPool* pool, int slot, Context* context)
+        : pool_(pool), slot_(slot), context_(context) { }
+
+    explicit Lease(std::unique_ptr<Context> overflow)
+        : pool_(NULL),
+          slot_(-1),
+          context_(overflow.get()),
+          overflow_(std::move(overflow)) { }
+
+    ContextPool* pool_;
+    int slot_;
+    Context* context_;
+    std::unique_ptr<Context> overflow_;
+
+    Lease(const Lease& other);
+    Lease& operator=(const Lease& other);
+  };
+
+  // Makes num_contexts contexts over num_vars variables. If reserve is
+  // positive, each context preallocates that many tape nodes or pooled
+  // gradients, so that even the first evaluations do not allocate.
+  ContextPool(int num_vars, int num_contexts, int reserve = 0)
+      : num_vars_(num_vars),
+        next_(new std::atomic<int>[num_contexts]),
+        head_(0),
+        num_overflows_(0) {
+    contexts_.reserve(num_contexts);
+    for (int i = 0; i < num_contexts; ++i) {
+      contexts_.emplace_back(new Context(num_vars));
+      if (reserve > 0) {
+        internal::Reserve(contexts_.back().get(), reserve);
+      }
+    }
+    for (int i = num_contexts - 1; i >= 0; --i) {
+      Release(i);
+    }
+  }
+
+  // Lends out a free context. When all of them are in use, a new context is
+  // made for this lease alone rather than waiting for one to come back;
+  // num_overflows() counts these, as a hint that the pool is too small.
+  Lease Acquire() {
+    std::uint64_t head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      int slot = Slot(head);
+      if (slot < 0) {
+        num_overflows_.fetch_add(1, std::memory_order_relaxed);
+        return Lease(std::unique_ptr<Context>(new Context(num_vars_)));
+      }
+      int next = next_[slot].load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, Head(head, next),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return Lease(this, slot, contexts_[slot].get());
+      }
+    }
+  }
+
+  int num_contexts() const { return static_cast<int>(contexts_.size()); }
+  int num_overflows() const {
+    return num_overflows_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // The free list head packs the first free slot plus one, so that zero
+  // means empty, into the low 32 bits and a count of updates into the high
+  // 32 bits. The count changes on every push and pop, so a compare and swap
+  // fails if the list changed underneath it even when the same slot is back
+  // on top.
+  static int Slot(std::uint64_t head) {
+    return static_cast<int>(head & 0xffffffffu) - 1;
+  }
+
+  static std::uint64_t Head(std::uint64_t previous, int slot) {
+    return ((previous >> 32) + 1) << 32 |
+           static_cast<std::uint32_t>(slot + 1);
+  }
+
+  void Release(int slot) {
+    internal::Recycle(contexts_[slot].get());
+    std::uint64_t head = head_.load(std::memory_order_relaxed);
+    do {
+      next_[slot].store(Slot(head), std::memory_order_relaxed);
+    } while (!head_.compare_exchange_weak(head, Head(head, slot),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  int num_vars_;
+  std::vector<std::unique_ptr<Context> > contexts_;
+  // next_[i] is the slot after slot i on the free list, or -1.
+  std::unique_ptr<std::atomic<int>[]> next_;
+  std::atomic<std::uint64_t> head_;
+  std::atomic<int> num_overflows_;
+
+  ContextPool(const ContextPool& other);
+  ContextPool& operator=(const ContextPool& other);
+};
+
+}  // namespace simple_differentiation
+
+#endif  // CONTEXT_POOL_H_
@@ -0,0 +1,116 @@
+
+#include "context_pool.h"
+#include "differentiation.h"
+#include "gradient_pool.h"
+#include "tape.h"
+
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::ContextPool;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::PooledVector;
+using simple_differentiation::TapeGradient;
+using simple_differentiation::Vector;
+
+typedef ContextPool<double, TapeGradient<double> > TapeContextPool;
+
+TEST(ContextPoolTest, LendsDistinctContexts) {
+  TapeContextPool pool(3, 2);
+  EXPECT_EQ(2, pool.num_contexts());
+
+  DifferentiationContext<double, TapeGradient<double> >* first;
+  {
+    TapeContextPool::Lease a = pool.Acquire();
+    TapeContextPool::Lease b = pool.Acquire();
+    EXPECT_NE(a.get(), b.get());
+    EXPECT_EQ(3, a->size());
+    EXPECT_EQ(0, pool.num_overflows());
+
+    // With both contexts out, the next lease gets a context of its own.
+    TapeContextPool::Lease c = pool.Acquire();
+    EXPECT_NE(a.get(), c.get());
+    EXPECT_NE(b.get(), c.get());
+    EXPECT_EQ(1, pool.num_overflows());
+
+    a->MakeVariable(0, 1.0);
+    EXPECT_EQ(1, a->tape().size());
+    first = a.get();
+  }
+
+  // The most recently returned context comes back first, with its tape
+  // cleared.
+  TapeContextPool::Lease again = pool.Acquire();
+  EXPECT_EQ(first, again.get());
+  EXPECT_EQ(0, again->tape().size());
+
+  TapeContextPool::Lease moved(std::move(again));
+  EXPECT_EQ(first, moved.get());
+}
+
+TEST(ContextPoolTest, PooledContextsDoNotAllocateAfterReserving) {
+  typedef ContextPool<double, PooledVector<double> > PooledContextPool;
+  PooledContextPool pool(4, 1, 256);
+  std::size_t chunks;
+  {
+    PooledContextPool::Lease context = pool.Acquire();
+    chunks = context->pool().num_chunks();
+    EXPECT_LT(0u, chunks);
+  }
+  for (int round = 0; round < 5; ++round) {
+    PooledContextPool::Lease context = pool.Acquire();
+    std::vector<DifferentiationVariable<double, PooledVector<double> > > x;
+    for (int j = 0; j < 4; ++j) {
+      x.push_back(context->MakeVariable(j, 0.5 * j));
+    }
+    DifferentiationVariable<double, PooledVector<double> > y =
+        x[0] * x[1] + sin(x[2]) * x[3] - x[1] / (1.0 + x[3]);
+    EXPECT_DOUBLE_EQ(cos(1.0) * 1.5, y.gradient()[2]);
+    EXPECT_EQ(chunks, context->pool().num_chunks());
+  }
+}
+
+TEST(ContextPoolTest, ConcurrentGradients) {
+  const int kThreads = 4;
+  const int kEvaluations = 200;
+  TapeContextPool pool(2, kThreads, 64);
+  std::atomic<int> errors(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&pool, &errors, t]() {
+      for (int i = 0; i < kEvaluations; ++i) {
+        double a = 0.01 * i + t;
+        double b = 0.5 - 0.02 * i;
+        TapeContextPool::Lease context = pool.Acquire();
+        DifferentiationVariable<double, TapeGradient<double> > x =
+            context->MakeVariable(0, a);
+        DifferentiationVariable<double, TapeGradient<double> > y =
+            context->MakeVariable(1, b);
+        Vector<double> gradient = context->Backward(x * x * y + exp(y));
+        if (gradient[0] != 2.0 * a * b || gradient[1] != a * a + exp(b)) {
+          ++errors;
+        }
+      }
+    });
+  }
+  for (int t = 0; t < kThreads; ++t) {
+    threads[t].join();
+  }
+  EXPECT_EQ(0, errors);
+  EXPECT_EQ(0, pool.num_overflows());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
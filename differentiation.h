@@ -1,6 +1,12 @@
 #ifndef DIFFERENTIATION_H_
 #define DIFFERENTIATION_H_
 
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "opcode.h"
+#include "stats.h"
 #include "vector.h"
 
 namespace simple_differentiation {
@@ -11,96 +17,222 @@ template <class T, class V>
 class DifferentiationVariable;
 
 template <class T, class V>
-DifferentiationVariable<T, V> sin(const DifferentiationVariable<T, V>& x);
-template <class T, class V>
-DifferentiationVariable<T, V> cos(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> sin(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> tan(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> cos(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> asin(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> tan(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> acos(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> asin(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> atan(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> acos(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> fabs(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> atan(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> pow(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> fabs(DifferentiationVariable<T, V> x);
+template <class T, class V, class U>
+DifferentiationVariable<T, V> pow(DifferentiationVariable<T, V> x,
+                                  const U& exponent);
 template <class T, class V>
-DifferentiationVariable<T, V> sqrt(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> sqrt(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> exp(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> exp(DifferentiationVariable<T, V> x);
 template <class T, class V>
-DifferentiationVariable<T, V> log(const DifferentiationVariable<T, V>& x);
+DifferentiationVariable<T, V> log(DifferentiationVariable<T, V> x);
+
+// Restricts the mixed overloads to operands that convert to the value type,
+// so that when T is itself a DifferentiationVariable they do not also
+// capture gradient types.
+template <class U, class T>
+using EnableIfScalar =
+    typename std::enable_if<std::is_convertible<U, T>::value>::type;
 
 template <class T, class V = Vector<T> >
 class DifferentiationVariable {
  public:
   friend class DifferentiationContext<T, V>;
 
-  friend DifferentiationVariable<T, V> sin<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> cos<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> tan<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> asin<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> acos<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> atan<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> fabs<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> pow<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> sqrt<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> exp<>(const DifferentiationVariable<T, V>& x);
-  friend DifferentiationVariable<T, V> log<>(const DifferentiationVariable<T, V>& x);
+  friend DifferentiationVariable<T, V> sin<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> cos<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> tan<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> asin<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> acos<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> atan<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> fabs<>(DifferentiationVariable<T, V> x);
+  template <class T2, class V2, class U>
+  friend DifferentiationVariable<T2, V2> pow(
+      DifferentiationVariable<T2, V2> x, const U& exponent);
+  friend DifferentiationVariable<T, V> sqrt<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> exp<>(DifferentiationVariable<T, V> x);
+  friend DifferentiationVariable<T, V> log<>(DifferentiationVariable<T, V> x);
+
+  // Makes a constant, which lets a DifferentiationVariable stand in for a
+  // scalar: T may itself be a DifferentiationVariable, for higher
+  // derivatives, and literals like 1.0 convert implicitly. The gradient is
+  // V(), which is only a zero of the right size for gradient types without
+  // a run-time size (FixedVector, SparseVector, TapeGradient), so this
+  // constructor and the default one, which makes a zero constant, are only
+  // available for those. Constants to mix with variables that have Vector
+  // gradients come from DifferentiationContext::MakeConstant.
+  template <class G = V,
+            class = typename std::enable_if<
+                !internal::HasRunTimeSize<G>::value>::type>
+  DifferentiationVariable() : value_(), gradient_() { }
+
+  template <class G = V,
+            class = typename std::enable_if<
+                !internal::HasRunTimeSize<G>::value>::type>
+  DifferentiationVariable(const T& value) : value_(value), gradient_() { }
 
   DifferentiationVariable(const DifferentiationVariable& other);
+  // Moves do not throw when moving T and V does not, so that containers of
+  // variables move them rather than copying every gradient as they grow.
+  DifferentiationVariable(DifferentiationVariable&& other) noexcept(
+      std::is_nothrow_move_constructible<T>::value &&
+      std::is_nothrow_move_constructible<V>::value);
   DifferentiationVariable& operator=(const DifferentiationVariable& rhs);
+  DifferentiationVariable& operator=(DifferentiationVariable&& rhs) noexcept(
+      std::is_nothrow_move_assignable<T>::value &&
+      std::is_nothrow_move_assignable<V>::value);
+
+  // The rvalue overloads below update a temporary operand in place, so a
+  // chain like a*b + c*d - e only allocates gradients for a*b and c*d.
 
-  DifferentiationVariable operator-() const;
+  DifferentiationVariable operator-() const&;
+  DifferentiationVariable operator-() &&;
 
   DifferentiationVariable& operator+=(const DifferentiationVariable& rhs);
   DifferentiationVariable& operator-=(const DifferentiationVariable& rhs);
   DifferentiationVariable& operator*=(const DifferentiationVariable& rhs);
   DifferentiationVariable& operator/=(const DifferentiationVariable& rhs);
 
-  template <class U>
+  template <class U, class = EnableIfScalar<U, T> >
   DifferentiationVariable& operator+=(const U& rhs);
-  template <class U>
+  template <class U, class = EnableIfScalar<U, T> >
   DifferentiationVariable& operator-=(const U& rhs);
-  template <class U>
+  template <class U, class = EnableIfScalar<U, T> >
   DifferentiationVariable& operator*=(const U& rhs);
-  template <class U>
+  template <class U, class = EnableIfScalar<U, T> >
   DifferentiationVariable& operator/=(const U& rhs);
 
-  DifferentiationVariable operator+(const DifferentiationVariable& rhs) const;
-  DifferentiationVariable operator-(const DifferentiationVariable& rhs) const;
-  DifferentiationVariable operator*(const DifferentiationVariable& rhs) const;
-  DifferentiationVariable operator/(const DifferentiationVariable& rhs) const;
-
-  template <class U>
-  DifferentiationVariable operator+(const U& rhs) const;
-  template <class U>
-  DifferentiationVariable operator-(const U& rhs) const;
-  template <class U>
-  DifferentiationVariable operator*(const U& rhs) const;
-  template <class U>
-  DifferentiationVariable operator/(const U& rhs) const;
-
-  // This needs to live in the class body to avoid linker errors.
-  template <class U>
-  friend DifferentiationVariable<T, V> operator/(
-      const U& lhs, const DifferentiationVariable<T, V>& rhs) {
-    T new_value = lhs / rhs.value();
-    V new_gradient = -lhs * rhs.gradient() / (rhs.value() * rhs.value());
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator+(const U& rhs) const&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator+(const U& rhs) &&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator-(const U& rhs) const&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator-(const U& rhs) &&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator*(const U& rhs) const&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator*(const U& rhs) &&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator/(const U& rhs) const&;
+  template <class U, class = EnableIfScalar<U, T> >
+  DifferentiationVariable operator/(const U& rhs) &&;
+
+  // These need to live in the class body to avoid linker errors. The left
+  // operand is taken by value, so it is moved from when it is a temporary;
+  // the second overload of each reuses a temporary right operand instead,
+  // and the third disambiguates when both operands are temporaries.
+
+  friend DifferentiationVariable operator+(
+      DifferentiationVariable lhs, const DifferentiationVariable& rhs) {
+    lhs += rhs;
+    return lhs;
+  }
+
+  friend DifferentiationVariable operator+(
+      const DifferentiationVariable& lhs, DifferentiationVariable&& rhs) {
+    rhs += lhs;
+    return std::move(rhs);
+  }
+
+  friend DifferentiationVariable operator+(
+      DifferentiationVariable&& lhs, DifferentiationVariable&& rhs) {
+    lhs += rhs;
+    return std::move(lhs);
+  }
+
+  friend DifferentiationVariable operator-(
+      DifferentiationVariable lhs, const DifferentiationVariable& rhs) {
+    lhs -= rhs;
+    return lhs;
+  }
+
+  friend DifferentiationVariable operator-(
+      const DifferentiationVariable& lhs, DifferentiationVariable&& rhs) {
+    SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kSubtract);
+    rhs.value_ = lhs.value_ - rhs.value_;
+    rhs.gradient_ = lhs.gradient_ - rhs.gradient_;
+    return std::move(rhs);
+  }
+
+  friend DifferentiationVariable operator-(
+      DifferentiationVariable&& lhs, DifferentiationVariable&& rhs) {
+    lhs -= rhs;
+    return std::move(lhs);
+  }
+
+  friend DifferentiationVariable operator*(
+      DifferentiationVariable lhs, const DifferentiationVariable& rhs) {
+    lhs *= rhs;
+    return lhs;
+  }
+
+  friend DifferentiationVariable operator*(
+      const DifferentiationVariable& lhs, DifferentiationVariable&& rhs) {
+    rhs *= lhs;
+    return std::move(rhs);
+  }
 
-    return DifferentiationVariable<T, V>(new_value, new_gradient);
+  friend DifferentiationVariable operator*(
+      DifferentiationVariable&& lhs, DifferentiationVariable&& rhs) {
+    lhs *= rhs;
+    return std::move(lhs);
   }
 
+  friend DifferentiationVariable operator/(
+      DifferentiationVariable lhs, const DifferentiationVariable& rhs) {
+    lhs /= rhs;
+    return lhs;
+  }
+
+  friend DifferentiationVariable operator/(
+      const DifferentiationVariable& lhs, DifferentiationVariable&& rhs) {
+    SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kDivide);
+    rhs.gradient_ = (lhs.gradient_*rhs.value_ - lhs.value_*rhs.gradient_) /
+        (rhs.value_*rhs.value_);
+    rhs.value_ = lhs.value_ / rhs.value_;
+    return std::move(rhs);
+  }
+
+  friend DifferentiationVariable operator/(
+      DifferentiationVariable&& lhs, DifferentiationVariable&& rhs) {
+    lhs /= rhs;
+    return std::move(lhs);
+  }
+
+  template <class U, class = EnableIfScalar<U, T> >
+  friend DifferentiationVariable<T, V> operator/(
+      const U& lhs, DifferentiationVariable<T, V> rhs) {
+    SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kDivide);
+    rhs.gradient_ = -lhs * rhs.gradient_ / (rhs.value_ * rhs.value_);
+    rhs.value_ = lhs / rhs.value_;
+    return rhs;
+  }
 
   const T& value() const { return value_; }
   const V& gradient() const { return gradient_; }
 
  private:
-  DifferentiationVariable(const T& value, const V& gradient)
+  // G is V or anything V can be constructed from, such as a vector
+  // expression, which is then evaluated straight into gradient_.
+  template <class G>
+  DifferentiationVariable(const T& value, G&& gradient)
     : value_(value),
-      gradient_(gradient) { }
+      gradient_(std::forward<G>(gradient)) { }
 
   DifferentiationVariable(int index,
                           const T& value,
@@ -122,8 +254,28 @@ class DifferentiationContext {
 
   DifferentiationVariable<T, V> MakeVariable(int index, const T& value);
 
+  // Makes a variable whose gradient is seed[0 .. size()). The context then
+  // tracks derivatives along size() arbitrary directions, one lane each,
+  // rather than with respect to size() inputs.
+  DifferentiationVariable<T, V> MakeSeededVariable(const T& value,
+                                                   const T* seed) const {
+    V gradient(num_vars_);
+    for (int k = 0; k < num_vars_; ++k) {
+      // Skipping zeros keeps sparse gradients sparse.
+      if (seed[k] != T()) {
+        gradient[k] = seed[k];
+      }
+    }
+    return DifferentiationVariable<T, V>(value, std::move(gradient));
+  }
+
+  // Makes a variable with a zero gradient, for inputs held fixed.
+  DifferentiationVariable<T, V> MakeConstant(const T& value) const {
+    return DifferentiationVariable<T, V>(value, V(num_vars_));
+  }
+
   const T& original_value(int index) const { return original_values_[index]; }
-  const int size() const { return num_vars_; }
+  int size() const { return num_vars_; }
 
  private:
   int num_vars_;
@@ -144,11 +296,22 @@ template <class T, class V>
 DifferentiationVariable<T, V>::DifferentiationVariable(
     const DifferentiationVariable& other)
     : value_(other.value_),
-      gradient_(other.gradient_) { }
+      gradient_(other.gradient_) {
+  SIMPLE_DIFFERENTIATION_COUNT(copies, 1);
+}
+
+template <class T, class V>
+DifferentiationVariable<T, V>::DifferentiationVariable(
+    DifferentiationVariable&& other) noexcept(
+    std::is_nothrow_move_constructible<T>::value &&
+    std::is_nothrow_move_constructible<V>::value)
+    : value_(std::move(other.value_)),
+      gradient_(std::move(other.gradient_)) { }
 
 template <class T, class V>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator=(
     const DifferentiationVariable& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT(copies, 1);
   if (this != &rhs) {
     value_ = rhs.value_;
     gradient_ = rhs.gradient_;
@@ -157,16 +320,35 @@ DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator=(
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator-() const {
-  DifferentiationVariable result(*this);
-  result.value_ = -result.value_;
-  result.gradient_ = -result.gradient_;
-  return result;
+DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator=(
+    DifferentiationVariable&& rhs) noexcept(
+    std::is_nothrow_move_assignable<T>::value &&
+    std::is_nothrow_move_assignable<V>::value) {
+  if (this != &rhs) {
+    value_ = std::move(rhs.value_);
+    gradient_ = std::move(rhs.gradient_);
+  }
+  return *this;
+}
+
+template <class T, class V>
+DifferentiationVariable<T, V>
+DifferentiationVariable<T, V>::operator-() const& {
+  return -DifferentiationVariable(*this);
+}
+
+template <class T, class V>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator-() && {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kNegate);
+  value_ = -value_;
+  gradient_ = -gradient_;
+  return std::move(*this);
 }
 
 template <class T, class V>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator+=(
     const DifferentiationVariable& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kAdd);
   value_ += rhs.value_;
   gradient_ += rhs.gradient_;
   return *this;
@@ -175,6 +357,7 @@ DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator+=(
 template <class T, class V>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator-=(
     const DifferentiationVariable& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kSubtract);
   value_ -= rhs.value_;
   gradient_ -= rhs.gradient_;
   return *this;
@@ -183,6 +366,7 @@ DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator-=(
 template <class T, class V>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator*=(
     const DifferentiationVariable& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kMultiply);
   gradient_ = gradient_*rhs.value_ + value_*rhs.gradient_;
   value_ *= rhs.value_;
   return *this;
@@ -191,6 +375,7 @@ DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator*=(
 template <class T, class V>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator/=(
     const DifferentiationVariable& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kDivide);
   gradient_ = (gradient_*rhs.value_ - value_*rhs.gradient_) /
       (rhs.value_*rhs.value_);
   value_ /= rhs.value_;
@@ -198,170 +383,293 @@ DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator/=(
 }
 
 template <class T, class V>
-template <class U>
+template <class U, class>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator+=(
     const U& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kAdd);
   value_ += rhs;
   return *this;
 }
 
 template <class T, class V>
-template <class U>
+template <class U, class>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator-=(
     const U& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kSubtract);
   value_ -= rhs;
   return *this;
 }
 
 template <class T, class V>
-template <class U>
+template <class U, class>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator*=(
     const U& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kMultiply);
   value_ *= rhs;
   gradient_ *= rhs;
   return *this;
 }
 
 template <class T, class V>
-template <class U>
+template <class U, class>
 DifferentiationVariable<T, V>& DifferentiationVariable<T, V>::operator/=(
     const U& rhs) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kDivide);
   value_ /= rhs;
   gradient_ /= rhs;
   return *this;
 }
 
 template <class T, class V>
+template <class U, class>
 DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator+(
-    const DifferentiationVariable<T, V>& rhs) const {
-  return DifferentiationVariable(*this) += rhs;
+    const U& rhs) const& {
+  DifferentiationVariable result(*this);
+  result += rhs;
+  return result;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator-(
-    const DifferentiationVariable<T, V>& rhs) const {
-  return DifferentiationVariable(*this) -= rhs;
+template <class U, class>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator+(
+    const U& rhs) && {
+  return std::move(*this += rhs);
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator*(
-    const DifferentiationVariable<T, V>& rhs) const {
-  return DifferentiationVariable(*this) *= rhs;
+template <class U, class>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator-(
+    const U& rhs) const& {
+  DifferentiationVariable result(*this);
+  result -= rhs;
+  return result;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator/(
-    const DifferentiationVariable<T, V>& rhs) const {
-  return DifferentiationVariable(*this) /= rhs;
+template <class U, class>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator-(
+    const U& rhs) && {
+  return std::move(*this -= rhs);
 }
 
 template <class T, class V>
-template <class U>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator+(
-    const U& rhs) const {
-  return DifferentiationVariable(*this) += rhs;
+template <class U, class>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator*(
+    const U& rhs) const& {
+  DifferentiationVariable result(*this);
+  result *= rhs;
+  return result;
 }
 
 template <class T, class V>
-template <class U>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator-(
-    const U& rhs) const {
-  return DifferentiationVariable(*this) -= rhs;
+template <class U, class>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator*(
+    const U& rhs) && {
+  return std::move(*this *= rhs);
 }
 
 template <class T, class V>
-template <class U>
-DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator*(
-    const U& rhs) const {
-  return DifferentiationVariable(*this) *= rhs;
+template <class U, class>
+DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator/(
+    const U& rhs) const& {
+  DifferentiationVariable result(*this);
+  result /= rhs;
+  return result;
 }
 
 template <class T, class V>
-template <class U>
+template <class U, class>
 DifferentiationVariable<T, V> DifferentiationVariable<T, V>::operator/(
-    const U& rhs) const {
-  return DifferentiationVariable(*this) /= rhs;
+    const U& rhs) && {
+  return std::move(*this /= rhs);
 }
 
-template <class T, class V, class U>
+template <class T, class V, class U, class = EnableIfScalar<U, T> >
 DifferentiationVariable<T, V> operator+(const U& lhs,
-                                        const DifferentiationVariable<T, V>& rhs) {
-  return rhs + lhs;
+                                        DifferentiationVariable<T, V> rhs) {
+  rhs += lhs;
+  return rhs;
 }
 
-template <class T, class V, class U>
+template <class T, class V, class U, class = EnableIfScalar<U, T> >
 DifferentiationVariable<T, V> operator-(const U& lhs,
-                                        const DifferentiationVariable<T, V>& rhs) {
-  return -rhs + lhs;
+                                        DifferentiationVariable<T, V> rhs) {
+  return -std::move(rhs) + lhs;
 }
 
-template <class T, class V, class U>
+template <class T, class V, class U, class = EnableIfScalar<U, T> >
 DifferentiationVariable<T, V> operator*(const U& lhs,
-                                        const DifferentiationVariable<T, V>& rhs) {
-  return rhs * lhs;
+                                        DifferentiationVariable<T, V> rhs) {
+  rhs *= lhs;
+  return rhs;
+}
+
+// Comparisons look only at values, so that branches in user code behave as
+// they would on plain numbers.
+#define SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(op)                         \
+  template <class T, class V>                                               \
+  bool operator op(const DifferentiationVariable<T, V>& lhs,                \
+                   const DifferentiationVariable<T, V>& rhs) {              \
+    return lhs.value() op rhs.value();                                      \
+  }                                                                         \
+                                                                            \
+  template <class T, class V, class U, class = EnableIfScalar<U, T> >       \
+  bool operator op(const DifferentiationVariable<T, V>& lhs,                \
+                   const U& rhs) {                                          \
+    return lhs.value() op rhs;                                              \
+  }                                                                         \
+                                                                            \
+  template <class T, class V, class U, class = EnableIfScalar<U, T> >       \
+  bool operator op(const U& lhs,                                           \
+                   const DifferentiationVariable<T, V>& rhs) {              \
+    return lhs op rhs.value();                                              \
+  }
+
+SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(==)
+SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(!=)
+SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(<)
+SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(>)
+SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(<=)
+SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON(>=)
+
+#undef SIMPLE_DIFFERENTIATION_DEFINE_COMPARISON
+
+// The elementary functions pull in the std:: overloads so that plain
+// floating point values resolve there, while nested differentiation types
+// are still found by argument-dependent lookup. They take their argument by
+// value and apply the chain rule to it in place, so a temporary argument's
+// gradient is reused.
+
+// Sets *sin_x and *cos_x to the sine and cosine of x. Both share one
+// argument reduction, so value types that can compute them together (see
+// batch.h) overload this and the trigonometric functions below call it once
+// for a value and its derivative.
+template <class T>
+void SinCos(const T& x, T* sin_x, T* cos_x) {
+  using std::cos;
+  using std::sin;
+  *sin_x = sin(x);
+  *cos_x = cos(x);
 }
 
-template <class T, class V>
-DifferentiationVariable<T, V> sin(const DifferentiationVariable<T, V>& x) {
-  return DifferentiationVariable<T, V>(sin(x.value()),
-                                       cos(x.value()) * x.gradient());
+#if defined(__GNUC__)
+inline void SinCos(float x, float* sin_x, float* cos_x) {
+  __builtin_sincosf(x, sin_x, cos_x);
+}
+
+inline void SinCos(double x, double* sin_x, double* cos_x) {
+  __builtin_sincos(x, sin_x, cos_x);
 }
+#endif
 
 template <class T, class V>
-DifferentiationVariable<T, V> cos(const DifferentiationVariable<T, V>& x) {
-  return DifferentiationVariable<T, V>(cos(x.value()),
-                                       -sin(x.value()) * x.gradient());
+DifferentiationVariable<T, V> sin(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kSin);
+  T sin_x, cos_x;
+  SinCos(x.value_, &sin_x, &cos_x);
+  x.gradient_ *= cos_x;
+  x.value_ = std::move(sin_x);
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> tan(const DifferentiationVariable<T, V>& x) {
-  T cos_x = cos(x.value());
-  return DifferentiationVariable<T, V>(tan(x.value()),
-                                       x.gradient() / (cos_x*cos_x));
+DifferentiationVariable<T, V> cos(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kCos);
+  T sin_x, cos_x;
+  SinCos(x.value_, &sin_x, &cos_x);
+  x.gradient_ *= -sin_x;
+  x.value_ = std::move(cos_x);
+  return x;
 }
 
+// tan is sin / cos, and its derivative 1 / cos^2 needs the same cosine.
 template <class T, class V>
-DifferentiationVariable<T, V> asin(const DifferentiationVariable<T, V>& x) {
-  return DifferentiationVariable<T, V>(
-      asin(x.value()), x.gradient() / sqrt(1.0 - x.value()*x.value()));
+DifferentiationVariable<T, V> tan(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kTan);
+  T sin_x, cos_x;
+  SinCos(x.value_, &sin_x, &cos_x);
+  x.gradient_ /= cos_x*cos_x;
+  x.value_ = sin_x / cos_x;
+  return x;
 }
 
+// (1 - x)(1 + x) rather than 1 - x^2, since near the ends of the domain
+// 1 - x^2 magnifies the rounding error of x^2, while 1 - x is exact there.
 template <class T, class V>
-DifferentiationVariable<T, V> acos(const DifferentiationVariable<T, V>& x) {
-  return DifferentiationVariable<T, V>(
-      acos(x.value()), -x.gradient() / sqrt(1.0 - x.value()*x.value()));
+DifferentiationVariable<T, V> asin(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kAsin);
+  using std::asin;
+  using std::sqrt;
+  x.gradient_ /= sqrt((1.0 - x.value_)*(1.0 + x.value_));
+  x.value_ = asin(x.value_);
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> atan(const DifferentiationVariable<T, V>& x) {
-  return DifferentiationVariable<T, V>(
-      atan(x.value()), x.gradient() / (1.0 + x.value()*x.value()));
+DifferentiationVariable<T, V> acos(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kAcos);
+  using std::acos;
+  using std::sqrt;
+  x.gradient_ /= -sqrt((1.0 - x.value_)*(1.0 + x.value_));
+  x.value_ = acos(x.value_);
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> fabs(const DifferentiationVariable<T, V>& x) {
-  if (x.value() < T()) {
-    return DifferentiationVariable<T, V>(-x.value(), -x.gradient());
-  } else {
-    return DifferentiationVariable<T, V>(x.value(), x.gradient());
-  }
+DifferentiationVariable<T, V> atan(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kAtan);
+  using std::atan;
+  x.gradient_ /= 1.0 + x.value_*x.value_;
+  x.value_ = atan(x.value_);
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> pow(const DifferentiationVariable<T, V>& x) {
+DifferentiationVariable<T, V> fabs(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kFabs);
+  if (x.value_ < T()) {
+    return -std::move(x);
+  }
+  return x;
+}
 
+template <class T, class V, class U>
+DifferentiationVariable<T, V> pow(DifferentiationVariable<T, V> x,
+                                  const U& exponent) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kPow);
+  using std::pow;
+  x.gradient_ *= exponent * pow(x.value_, exponent - 1.0);
+  x.value_ = pow(x.value_, exponent);
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> sqrt(const DifferentiationVariable<T, V>& x) {
+DifferentiationVariable<T, V> sqrt(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kSqrt);
+  using std::sqrt;
+  T sqrt_x = sqrt(x.value_);
+  x.gradient_ /= 2.0 * sqrt_x;
+  x.value_ = sqrt_x;
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> exp(const DifferentiationVariable<T, V>& x) {
+DifferentiationVariable<T, V> exp(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kExp);
+  using std::exp;
+  T exp_x = exp(x.value_);
+  x.gradient_ *= exp_x;
+  x.value_ = exp_x;
+  return x;
 }
 
 template <class T, class V>
-DifferentiationVariable<T, V> log(const DifferentiationVariable<T, V>& x) {
+DifferentiationVariable<T, V> log(DifferentiationVariable<T, V> x) {
+  SIMPLE_DIFFERENTIATION_COUNT_OPERATION(kLog);
+  using std::log;
+  x.gradient_ /= x.value_;
+  x.value_ = log(x.value_);
+  return x;
 }
 
 }  // namespace simple_differentiation
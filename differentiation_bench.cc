@@ -0,0 +1,572 @@
+
+// Microbenchmarks for gradient arithmetic, the elementary functions and
+// whole objectives, swept over the number of variables and the gradient
+// type. `make bench` runs them all and writes the results as JSON to
+// bench.json, for tracking regressions; pass BENCH_FLAGS to select a
+// subset, e.g. BENCH_FLAGS=--benchmark_filter=Rosenbrock.
+//
+// Besides the time per iteration, every benchmark reports
+//
+//   allocs_per_op    calls to operator new per iteration,
+//   bytes_per_op     bytes requested from operator new per iteration,
+//
+// and the arithmetic benchmarks report the gradient bytes they read and
+// write as bytes_per_second. Gradient benchmarks of MixedGradient, float
+// gradients of double values, also report their relative_error against
+// double gradients. AlignedGradient and InlineGradient, the cache-aligned
+// AlignedVector without and with inline storage, run alongside Vector's
+// DenseGradient for comparison.
+
+#include "aligned_vector.h"
+#include "batch.h"
+#include "differentiation.h"
+#include "fixed_vector.h"
+#include "gradient_pool.h"
+#include "parallel_sum.h"
+#include "sparse_vector.h"
+#include "tape.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "vector.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// Counts every trip to the system allocator. The operators are kept out of
+// line so that GCC does not pair the inlined malloc with a free from some
+// other allocation function and warn.
+#if defined(__GNUC__)
+#define SIMPLE_DIFFERENTIATION_NOINLINE __attribute__((noinline))
+#else
+#define SIMPLE_DIFFERENTIATION_NOINLINE
+#endif
+
+static std::atomic<long> allocation_count(0);
+static std::atomic<long> allocated_bytes(0);
+
+SIMPLE_DIFFERENTIATION_NOINLINE void* operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+SIMPLE_DIFFERENTIATION_NOINLINE void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+SIMPLE_DIFFERENTIATION_NOINLINE void operator delete(void* p,
+                                                     std::size_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+using simple_differentiation::AlignedVector;
+using simple_differentiation::CompiledGradient;
+using simple_differentiation::CompileGradient;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::FixedVector;
+using simple_differentiation::ParallelReduceOptions;
+using simple_differentiation::ParallelSum;
+using simple_differentiation::PooledVector;
+using simple_differentiation::SparseVector;
+using simple_differentiation::TapeGradient;
+using simple_differentiation::ThreadPool;
+using simple_differentiation::Vector;
+
+typedef Vector<double> DenseGradient;
+typedef SparseVector<double> SparseGradient;
+typedef PooledVector<double> PooledGradient;
+typedef FixedVector<double, 8> FixedGradient;
+typedef TapeGradient<double> ReverseGradient;
+// Float gradients for double values; see vector.h.
+typedef Vector<float> MixedGradient;
+typedef AlignedVector<double> AlignedGradient;
+typedef AlignedVector<double, 64> InlineGradient;
+
+// Stands in for a gradient type to benchmark replay of a traced gradient.
+struct Replay { };
+
+// Reports the allocations made since construction, per iteration.
+class AllocationCounter {
+ public:
+  AllocationCounter()
+      : count_(allocation_count.load()), bytes_(allocated_bytes.load()) { }
+
+  void Report(benchmark::State& state) const {
+    state.counters["allocs_per_op"] = benchmark::Counter(
+        static_cast<double>(allocation_count.load() - count_),
+        benchmark::Counter::kAvgIterations);
+    state.counters["bytes_per_op"] = benchmark::Counter(
+        static_cast<double>(allocated_bytes.load() - bytes_),
+        benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  long count_;
+  long bytes_;
+};
+
+// The bytes a gradient occupies, counting indices for sparse ones.
+template <class V>
+std::size_t GradientBytes(const V& gradient) {
+  return gradient.size() * sizeof(double);
+}
+
+std::size_t GradientBytes(const SparseGradient& gradient) {
+  return gradient.nonzeros() * (sizeof(double) + sizeof(std::size_t));
+}
+
+std::size_t GradientBytes(const MixedGradient& gradient) {
+  return gradient.size() * sizeof(float);
+}
+
+void Dimensions(benchmark::internal::Benchmark* benchmark) {
+  benchmark->Arg(4)->Arg(64)->Arg(1024);
+}
+
+void ObjectiveDimensions(benchmark::internal::Benchmark* benchmark) {
+  benchmark->Arg(8)->Arg(64)->Arg(512);
+}
+
+template <class V>
+void BM_VectorAdd(benchmark::State& state) {
+  const int n = static_cast<int>(state.range(0));
+  V a(n, 1.0);
+  V b(n, 2.0);
+  V c(n);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    c = a + b;
+    benchmark::DoNotOptimize(c.data());
+    benchmark::ClobberMemory();
+  }
+  allocations.Report(state);
+  state.SetBytesProcessed(state.iterations() * 3 * n * sizeof(double));
+}
+BENCHMARK_TEMPLATE(BM_VectorAdd, DenseGradient)
+    ->RangeMultiplier(8)->Range(8, 32768);
+BENCHMARK_TEMPLATE(BM_VectorAdd, AlignedGradient)
+    ->RangeMultiplier(8)->Range(8, 32768);
+
+template <class V>
+void BM_VectorScaleAdd(benchmark::State& state) {
+  const int n = static_cast<int>(state.range(0));
+  V a(n, 1.0);
+  V c(n);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    c += a * 0.5;
+    benchmark::DoNotOptimize(c.data());
+    benchmark::ClobberMemory();
+  }
+  allocations.Report(state);
+  state.SetBytesProcessed(state.iterations() * 3 * n * sizeof(double));
+}
+BENCHMARK_TEMPLATE(BM_VectorScaleAdd, DenseGradient)
+    ->RangeMultiplier(8)->Range(8, 32768);
+BENCHMARK_TEMPLATE(BM_VectorScaleAdd, AlignedGradient)
+    ->RangeMultiplier(8)->Range(8, 32768);
+
+// sin and cos at n points, by the polynomial kernels of batch.h and by the
+// scalar library functions.
+typedef simple_differentiation::Batch<double, 8> Batch8;
+
+void BM_BatchSinCos(benchmark::State& state) {
+  const int n = static_cast<int>(state.range(0));
+  std::vector<Batch8> x(n / 8);
+  for (int i = 0; i < n; ++i) {
+    x[i / 8][i % 8] = 0.01 * i - 3.0;
+  }
+  std::vector<Batch8> sin_x(n / 8);
+  std::vector<Batch8> cos_x(n / 8);
+  for (auto _ : state) {
+    for (int i = 0; i < n / 8; ++i) {
+      SinCos(x[i], &sin_x[i], &cos_x[i]);
+    }
+    benchmark::DoNotOptimize(sin_x.data());
+    benchmark::DoNotOptimize(cos_x.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_BatchSinCos)->Arg(4096);
+
+void BM_ScalarSinCos(benchmark::State& state) {
+  const int n = static_cast<int>(state.range(0));
+  std::vector<double> x(n);
+  for (int i = 0; i < n; ++i) {
+    x[i] = 0.01 * i - 3.0;
+  }
+  std::vector<double> sin_x(n);
+  std::vector<double> cos_x(n);
+  for (auto _ : state) {
+    for (int i = 0; i < n; ++i) {
+      sin_x[i] = std::sin(x[i]);
+      cos_x[i] = std::cos(x[i]);
+    }
+    benchmark::DoNotOptimize(sin_x.data());
+    benchmark::DoNotOptimize(cos_x.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_ScalarSinCos)->Arg(4096);
+
+// A sum of 65536 squared residuals over 64 variables, by ParallelSum on a
+// pool of range(0) threads; range(1) makes the sum deterministic. Compare
+// with threads:1 for the scaling, which is only meaningful on a machine
+// with that many free cores.
+void BM_ParallelSum(benchmark::State& state) {
+  const int kNumVars = 64;
+  const int kNumTerms = 65536;
+  DifferentiationContext<double> context(kNumVars);
+  std::vector<DifferentiationVariable<double> > x;
+  for (int i = 0; i < kNumVars; ++i) {
+    x.push_back(context.MakeVariable(i, 0.01 * i));
+  }
+  auto term = [&x](int i) {
+    DifferentiationVariable<double> residual =
+        x[i % kNumVars] * x[(i * 7 + 3) % kNumVars] - 0.001 * i;
+    return residual * residual;
+  };
+  ThreadPool pool(static_cast<int>(state.range(0)));
+  ParallelReduceOptions options;
+  options.deterministic = state.range(1) != 0;
+  AllocationCounter counter;
+  for (auto _ : state) {
+    DifferentiationVariable<double> sum =
+        ParallelSum(context, kNumTerms, term, &pool, options);
+    benchmark::DoNotOptimize(sum.value());
+  }
+  counter.Report(state);
+  state.SetItemsProcessed(state.iterations() * kNumTerms);
+}
+BENCHMARK(BM_ParallelSum)
+    ->ArgNames({"threads", "deterministic"})
+    ->ArgsProduct({{1, 2, 4, 8}, {0, 1}})
+    ->UseRealTime();
+
+// Returns value plus a small multiple of every variable in context, so that
+// each lane of the gradient is nonzero. The variables are all zero, which
+// keeps value in the domain of every function.
+template <class V>
+DifferentiationVariable<double, V> Operand(
+    DifferentiationContext<double, V>* context, double value) {
+  DifferentiationVariable<double, V> result = context->MakeConstant(value);
+  for (int j = 0; j < context->size(); ++j) {
+    result += context->MakeVariable(j, 0.0) * (1e-3 * (j + 1));
+  }
+  return result;
+}
+
+struct Add {
+  template <class X>
+  X operator()(const X& a, const X& b) const { return a + b; }
+};
+
+struct Subtract {
+  template <class X>
+  X operator()(const X& a, const X& b) const { return a - b; }
+};
+
+struct Multiply {
+  template <class X>
+  X operator()(const X& a, const X& b) const { return a * b; }
+};
+
+struct Divide {
+  template <class X>
+  X operator()(const X& a, const X& b) const { return a / b; }
+};
+
+struct Pow {
+  template <class X>
+  X operator()(const X& a, const X&) const { return pow(a, 2.5); }
+};
+
+#define SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Name, function)  \
+  struct Name {                                                \
+    template <class X>                                         \
+    X operator()(const X& a, const X&) const {                 \
+      return function(a);                                      \
+    }                                                          \
+  };
+
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Sin, sin)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Cos, cos)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Tan, tan)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Asin, asin)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Acos, acos)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Atan, atan)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Fabs, fabs)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Sqrt, sqrt)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Exp, exp)
+SIMPLE_DIFFERENTIATION_BENCH_FUNCTION(Log, log)
+
+#undef SIMPLE_DIFFERENTIATION_BENCH_FUNCTION
+
+// Times one operation on two variables with full gradients. Unary
+// operations ignore the second operand.
+template <class V, class Operation>
+void BM_Operation(benchmark::State& state) {
+  typedef DifferentiationVariable<double, V> Variable;
+  DifferentiationContext<double, V> context(static_cast<int>(state.range(0)));
+  const Variable a = Operand(&context, 0.5);
+  const Variable b = Operand(&context, 1.5);
+  Operation operation;
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    Variable c = operation(a, b);
+    benchmark::DoNotOptimize(c);
+  }
+  allocations.Report(state);
+  state.SetBytesProcessed(state.iterations() * 3 * GradientBytes(a.gradient()));
+}
+
+#define SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Operation)                    \
+  BENCHMARK_TEMPLATE(BM_Operation, DenseGradient, Operation)                 \
+      ->Apply(Dimensions);                                                   \
+  BENCHMARK_TEMPLATE(BM_Operation, MixedGradient, Operation)                 \
+      ->Apply(Dimensions);                                                   \
+  BENCHMARK_TEMPLATE(BM_Operation, AlignedGradient, Operation)               \
+      ->Apply(Dimensions);                                                   \
+  BENCHMARK_TEMPLATE(BM_Operation, InlineGradient, Operation)                \
+      ->Arg(4)->Arg(64);                                                     \
+  BENCHMARK_TEMPLATE(BM_Operation, SparseGradient, Operation)                \
+      ->Apply(Dimensions);                                                   \
+  BENCHMARK_TEMPLATE(BM_Operation, PooledGradient, Operation)                \
+      ->Apply(Dimensions);                                                   \
+  BENCHMARK_TEMPLATE(BM_Operation, FixedGradient, Operation)->Arg(8);
+
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Add)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Subtract)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Multiply)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Divide)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Pow)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Sin)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Cos)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Tan)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Asin)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Acos)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Atan)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Fabs)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Sqrt)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Exp)
+SIMPLE_DIFFERENTIATION_BENCH_OPERATION(Log)
+
+#undef SIMPLE_DIFFERENTIATION_BENCH_OPERATION
+
+// The extended Rosenbrock function.
+struct Rosenbrock {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    Variable sum = (1.0 - x[0]) * (1.0 - x[0]);
+    for (std::size_t i = 0; i + 1 < x.size(); ++i) {
+      Variable t = x[i + 1] - x[i] * x[i];
+      sum += 100.0 * t * t;
+    }
+    return sum;
+  }
+};
+
+// A squared output of a network with one hidden layer of eight softsign
+// units, differentiated with respect to its inputs.
+struct Mlp {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    const int kHidden = 8;
+    Variable output = 0.25 * x[0];
+    for (int k = 0; k < kHidden; ++k) {
+      Variable h = 0.1 * (k + 1) * x[0];
+      for (std::size_t j = 1; j < x.size(); ++j) {
+        h += std::cos(1.0 + k * x.size() + j) * x[j];
+      }
+      output += (0.5 - 0.1 * k) * (h / (1.0 + fabs(h)));
+    }
+    return output * output;
+  }
+};
+
+// The sum of squares of residuals that each depend on three neighbouring
+// variables, as in a banded least-squares problem.
+struct LeastSquares {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    Variable sum = x[0] * x[0];
+    for (std::size_t i = 0; i + 2 < x.size(); ++i) {
+      Variable r = x[i] * x[i + 1] - exp(-x[i + 2]) + 0.5;
+      sum += r * r;
+    }
+    return sum;
+  }
+};
+
+// Computes the gradient of f in forward mode with gradients of type V.
+template <class V, class F>
+class GradientEvaluator {
+ public:
+  GradientEvaluator(const F& f, const std::vector<double>& x)
+      : f_(f), context_(static_cast<int>(x.size())) { }
+
+  void Evaluate(const std::vector<double>& x) {
+    std::vector<DifferentiationVariable<double, V> > inputs;
+    inputs.reserve(x.size());
+    for (int j = 0; j < context_.size(); ++j) {
+      inputs.push_back(context_.MakeVariable(j, x[j]));
+    }
+    DifferentiationVariable<double, V> y = f_(inputs);
+    benchmark::DoNotOptimize(y);
+  }
+
+ private:
+  F f_;
+  DifferentiationContext<double, V> context_;
+};
+
+template <class F>
+class GradientEvaluator<PooledGradient, F> {
+ public:
+  GradientEvaluator(const F& f, const std::vector<double>& x)
+      : f_(f), context_(static_cast<int>(x.size())) { }
+
+  void Evaluate(const std::vector<double>& x) {
+    {
+      std::vector<DifferentiationVariable<double, PooledGradient> > inputs;
+      inputs.reserve(x.size());
+      for (int j = 0; j < context_.size(); ++j) {
+        inputs.push_back(context_.MakeVariable(j, x[j]));
+      }
+      DifferentiationVariable<double, PooledGradient> y = f_(inputs);
+      benchmark::DoNotOptimize(y);
+    }
+    context_.Reset();
+  }
+
+ private:
+  F f_;
+  DifferentiationContext<double, PooledGradient> context_;
+};
+
+template <class F>
+class GradientEvaluator<ReverseGradient, F> {
+ public:
+  GradientEvaluator(const F& f, const std::vector<double>& x)
+      : f_(f), context_(static_cast<int>(x.size())) { }
+
+  void Evaluate(const std::vector<double>& x) {
+    context_.Clear();
+    std::vector<DifferentiationVariable<double, ReverseGradient> > inputs;
+    inputs.reserve(x.size());
+    for (int j = 0; j < context_.size(); ++j) {
+      inputs.push_back(context_.MakeVariable(j, x[j]));
+    }
+    Vector<double> gradient = context_.Backward(f_(inputs));
+    benchmark::DoNotOptimize(gradient.data());
+  }
+
+ private:
+  F f_;
+  DifferentiationContext<double, ReverseGradient> context_;
+};
+
+template <class F>
+class GradientEvaluator<Replay, F> {
+ public:
+  GradientEvaluator(const F& f, const std::vector<double>& x)
+      : compiled_(CompileGradient(f, x)) { }
+
+  void Evaluate(const std::vector<double>& x) {
+    benchmark::DoNotOptimize(compiled_.Evaluate(x, &gradient_));
+  }
+
+ private:
+  CompiledGradient<double> compiled_;
+  Vector<double> gradient_;
+};
+
+// Returns the gradient of f at x in forward mode with gradients of type V.
+template <class V, class F>
+V ForwardGradient(const F& f, const std::vector<double>& x) {
+  DifferentiationContext<double, V> context(static_cast<int>(x.size()));
+  std::vector<DifferentiationVariable<double, V> > inputs;
+  for (int j = 0; j < context.size(); ++j) {
+    inputs.push_back(context.MakeVariable(j, x[j]));
+  }
+  return f(inputs).gradient();
+}
+
+// Reports how far reduced precision gradients are from double ones, as
+// relative_error, the norm of the difference over the norm of the double
+// gradient.
+template <class V, class F>
+void ReportAccuracy(benchmark::State&, const F&, const std::vector<double>&,
+                    const V*) { }
+
+template <class F>
+void ReportAccuracy(benchmark::State& state, const F& f,
+                    const std::vector<double>& x, const MixedGradient*) {
+  MixedGradient mixed = ForwardGradient<MixedGradient>(f, x);
+  DenseGradient exact = ForwardGradient<DenseGradient>(f, x);
+  double error = 0.0;
+  double norm = 0.0;
+  for (std::size_t j = 0; j < exact.size(); ++j) {
+    error += (mixed[j] - exact[j]) * (mixed[j] - exact[j]);
+    norm += exact[j] * exact[j];
+  }
+  state.counters["relative_error"] = std::sqrt(error / norm);
+}
+
+template <class V, class F>
+void BM_Gradient(benchmark::State& state) {
+  std::vector<double> x(state.range(0));
+  for (std::size_t j = 0; j < x.size(); ++j) {
+    x[j] = 0.5 * std::sin(1.0 + j);
+  }
+  GradientEvaluator<V, F> evaluator((F()), x);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    evaluator.Evaluate(x);
+  }
+  allocations.Report(state);
+  ReportAccuracy(state, F(), x, static_cast<const V*>(NULL));
+}
+
+#define SIMPLE_DIFFERENTIATION_BENCH_OBJECTIVE(Objective)                    \
+  BENCHMARK_TEMPLATE(BM_Gradient, DenseGradient, Objective)                  \
+      ->Apply(ObjectiveDimensions);                                          \
+  BENCHMARK_TEMPLATE(BM_Gradient, MixedGradient, Objective)                  \
+      ->Apply(ObjectiveDimensions);                                          \
+  BENCHMARK_TEMPLATE(BM_Gradient, AlignedGradient, Objective)                \
+      ->Apply(ObjectiveDimensions);                                          \
+  BENCHMARK_TEMPLATE(BM_Gradient, InlineGradient, Objective)                 \
+      ->Arg(8)->Arg(64);                                                     \
+  BENCHMARK_TEMPLATE(BM_Gradient, SparseGradient, Objective)                 \
+      ->Apply(ObjectiveDimensions);                                          \
+  BENCHMARK_TEMPLATE(BM_Gradient, PooledGradient, Objective)                 \
+      ->Apply(ObjectiveDimensions);                                          \
+  BENCHMARK_TEMPLATE(BM_Gradient, FixedGradient, Objective)->Arg(8);         \
+  BENCHMARK_TEMPLATE(BM_Gradient, ReverseGradient, Objective)                \
+      ->Apply(ObjectiveDimensions);                                          \
+  BENCHMARK_TEMPLATE(BM_Gradient, Replay, Objective)                         \
+      ->Apply(ObjectiveDimensions);
+
+SIMPLE_DIFFERENTIATION_BENCH_OBJECTIVE(Rosenbrock)
+SIMPLE_DIFFERENTIATION_BENCH_OBJECTIVE(Mlp)
+SIMPLE_DIFFERENTIATION_BENCH_OBJECTIVE(LeastSquares)
+
+#undef SIMPLE_DIFFERENTIATION_BENCH_OBJECTIVE
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -1,12 +1,37 @@
 #include "vector.h"
 #include "differentiation.h"
+#include "fixed_vector.h"
 
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 namespace {
 
+// Counts the buffers it hands out, to check that temporaries are reused.
+int allocation_count = 0;
+
+template <class T>
+struct CountingAllocator : public std::allocator<T> {
+  template <class U>
+  struct rebind {
+    typedef CountingAllocator<U> other;
+  };
+
+  CountingAllocator() { }
+  template <class U>
+  CountingAllocator(const CountingAllocator<U>&) { }
+
+  T* allocate(std::size_t n) {
+    ++allocation_count;
+    return std::allocator<T>::allocate(n);
+  }
+};
+
 TEST(VectorTest, Create) {
   simple_differentiation::Vector<double> vec0;
   EXPECT_EQ(0, vec0.size());
@@ -52,7 +77,7 @@ TEST(VectorTest, Negate) {
   vec2.push_back(0.5);
   EXPECT_EQ(2, (-vec2).size());
   EXPECT_EQ(4.0, (-vec2)[0]);
-  EXPECT_EQ(-0.5, (-vec1)[1]);
+  EXPECT_EQ(-0.5, (-vec2)[1]);
 }
 
 TEST(VectorTest, AddAssign) {
@@ -207,6 +232,222 @@ TEST(VectorTest, Divide) {
   EXPECT_EQ(60.0, vec_div[1]);
 }
 
+TEST(VectorTest, Expression) {
+  simple_differentiation::Vector<double> vec_a;
+  vec_a.push_back(1.0);
+  vec_a.push_back(2.0);
+  simple_differentiation::Vector<double> vec_b;
+  vec_b.push_back(3.0);
+  vec_b.push_back(-1.0);
+
+  simple_differentiation::Vector<double> vec_c =
+      vec_a*2.0 + 3.0*vec_b - -vec_a/2.0;
+  EXPECT_EQ(2, vec_c.size());
+  EXPECT_EQ(11.5, vec_c[0]);
+  EXPECT_EQ(2.0, vec_c[1]);
+
+  // The destination may appear in the expression.
+  vec_a = vec_a*vec_b[0] - vec_b;
+  EXPECT_EQ(0.0, vec_a[0]);
+  EXPECT_EQ(7.0, vec_a[1]);
+
+  vec_c += vec_a + vec_b;
+  EXPECT_EQ(14.5, vec_c[0]);
+  EXPECT_EQ(8.0, vec_c[1]);
+
+  vec_c -= 2*vec_b;
+  EXPECT_EQ(8.5, vec_c[0]);
+  EXPECT_EQ(10.0, vec_c[1]);
+}
+
+TEST(DifferentiationTest, Arithmetic) {
+  simple_differentiation::DifferentiationContext<double> context(2);
+  simple_differentiation::DifferentiationVariable<double> x =
+      context.MakeVariable(0, 3.0);
+  simple_differentiation::DifferentiationVariable<double> y =
+      context.MakeVariable(1, 2.0);
+
+  simple_differentiation::DifferentiationVariable<double> f =
+      x*y - x/y + 2.0*x - 1.0/y + y*4.0;
+  EXPECT_DOUBLE_EQ(3.0*2.0 - 3.0/2.0 + 6.0 - 0.5 + 8.0, f.value());
+  EXPECT_DOUBLE_EQ(2.0 - 0.5 + 2.0, f.gradient()[0]);
+  EXPECT_DOUBLE_EQ(3.0 + 3.0/4.0 + 1.0/4.0 + 4.0, f.gradient()[1]);
+}
+
+TEST(DifferentiationTest, ElementaryFunctions) {
+  simple_differentiation::DifferentiationContext<double> context(1);
+  simple_differentiation::DifferentiationVariable<double> x =
+      context.MakeVariable(0, 0.3);
+
+  EXPECT_DOUBLE_EQ(std::cos(0.3), sin(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(-std::sin(0.3), cos(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(1.0 / (std::cos(0.3)*std::cos(0.3)),
+                   tan(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(1.0 / std::sqrt(1.0 - 0.09), asin(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(-1.0 / std::sqrt(1.0 - 0.09), acos(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(1.0 / 1.09, atan(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(1.0, fabs(-x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(-1.0, fabs(x - 1.0).gradient()[0]);
+  EXPECT_DOUBLE_EQ(2.5 * std::pow(0.3, 1.5), pow(x, 2.5).gradient()[0]);
+  EXPECT_DOUBLE_EQ(0.5 / std::sqrt(0.3), sqrt(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(std::exp(0.3), exp(x).gradient()[0]);
+  EXPECT_DOUBLE_EQ(1.0 / 0.3, log(x).gradient()[0]);
+
+  EXPECT_DOUBLE_EQ(std::sin(0.3), sin(x).value());
+  EXPECT_DOUBLE_EQ(std::cos(0.3), cos(x).value());
+  EXPECT_DOUBLE_EQ(std::tan(0.3), tan(x).value());
+
+  // The derivative stays accurate near the ends of the domain.
+  double y = 1.0 - 0x1p-30;
+  simple_differentiation::DifferentiationVariable<double> near_one =
+      context.MakeVariable(0, y);
+  EXPECT_DOUBLE_EQ(1.0 / std::sqrt(0x1p-30 * (2.0 - 0x1p-30)),
+                   asin(near_one).gradient()[0]);
+}
+
+TEST(DifferentiationTest, Constants) {
+  using simple_differentiation::DifferentiationVariable;
+  using simple_differentiation::FixedVector;
+
+  // A bare constant would have an empty Vector gradient, which loses
+  // derivatives or reads out of bounds, so only gradient types without a
+  // run-time size convert from values or default construct.
+  static_assert(!std::is_convertible<double,
+                    DifferentiationVariable<double> >::value,
+                "Vector gradients need a context for constants.");
+  static_assert(!std::is_default_constructible<
+                    DifferentiationVariable<double> >::value,
+                "Vector gradients need a context for zeros.");
+  static_assert(std::is_convertible<double,
+                    DifferentiationVariable<double, FixedVector<double, 2> >
+                >::value,
+                "FixedVector gradients need none.");
+  static_assert(std::is_default_constructible<
+                    DifferentiationVariable<double, FixedVector<double, 2> >
+                >::value,
+                "FixedVector gradients need none.");
+
+  simple_differentiation::DifferentiationContext<double> context(2);
+  DifferentiationVariable<double> x = context.MakeVariable(0, 2.0);
+  DifferentiationVariable<double> sum = context.MakeConstant(0.0);
+  sum += x*x;
+  EXPECT_EQ(4.0, sum.value());
+  ASSERT_EQ(2, sum.gradient().size());
+  EXPECT_EQ(4.0, sum.gradient()[0]);
+  EXPECT_EQ(0.0, sum.gradient()[1]);
+
+  DifferentiationVariable<double> product = x * context.MakeConstant(1.5);
+  EXPECT_EQ(3.0, product.value());
+  EXPECT_EQ(1.5, product.gradient()[0]);
+  EXPECT_EQ(0.0, product.gradient()[1]);
+
+  DifferentiationVariable<double, FixedVector<double, 2> > y(2.0);
+  y = 1.5 * y + DifferentiationVariable<double, FixedVector<double, 2> >(1.0);
+  EXPECT_EQ(4.0, y.value());
+  EXPECT_EQ(0.0, y.gradient()[0]);
+}
+
+TEST(DifferentiationTest, TemporariesAreReused) {
+  typedef simple_differentiation::Vector<double, CountingAllocator<double> >
+      CountedVector;
+  simple_differentiation::DifferentiationContext<double, CountedVector>
+      context(3);
+  simple_differentiation::DifferentiationVariable<double, CountedVector> x =
+      context.MakeVariable(0, 3.0);
+  simple_differentiation::DifferentiationVariable<double, CountedVector> y =
+      context.MakeVariable(1, 2.0);
+  simple_differentiation::DifferentiationVariable<double, CountedVector> z =
+      context.MakeVariable(2, 0.5);
+
+  allocation_count = 0;
+  simple_differentiation::DifferentiationVariable<double, CountedVector> f =
+      x*y + y*z - z;
+  EXPECT_EQ(2, allocation_count);
+  EXPECT_DOUBLE_EQ(6.5, f.value());
+  EXPECT_DOUBLE_EQ(2.0, f.gradient()[0]);
+  EXPECT_DOUBLE_EQ(3.5, f.gradient()[1]);
+  EXPECT_DOUBLE_EQ(1.0, f.gradient()[2]);
+
+  allocation_count = 0;
+  simple_differentiation::DifferentiationVariable<double, CountedVector> g =
+      exp(-sin(x * 2.0)) / (y - z*z) - 1.0 / (x - y) + 2.0 - y;
+  EXPECT_EQ(3, allocation_count);
+
+  double u = std::exp(-std::sin(6.0));
+  double du_dx = -2.0 * std::cos(6.0) * u;
+  EXPECT_DOUBLE_EQ(u / 1.75 - 1.0 + 2.0 - 2.0, g.value());
+  EXPECT_DOUBLE_EQ(du_dx / 1.75 + 1.0, g.gradient()[0]);
+  EXPECT_DOUBLE_EQ(-u / (1.75*1.75) - 1.0 - 1.0, g.gradient()[1]);
+  EXPECT_DOUBLE_EQ(u / (1.75*1.75), g.gradient()[2]);
+}
+
+// Growing a std::vector of variables moves their gradients instead of
+// copying them, which it only does for moves that cannot throw.
+TEST(DifferentiationTest, VariablesMoveWithoutCopying) {
+  typedef simple_differentiation::Vector<double, CountingAllocator<double> >
+      CountedVector;
+  typedef simple_differentiation::DifferentiationVariable<double,
+                                                          CountedVector>
+      Variable;
+  static_assert(std::is_nothrow_move_constructible<Variable>::value &&
+                    std::is_nothrow_move_assignable<Variable>::value,
+                "Moving a variable must not throw.");
+  static_assert(std::is_nothrow_move_constructible<
+                    simple_differentiation::DifferentiationVariable<double>
+                >::value,
+                "Moving a variable must not throw.");
+
+  simple_differentiation::DifferentiationContext<double, CountedVector>
+      context(4);
+  std::vector<Variable> x;
+  x.reserve(1);
+  allocation_count = 0;
+  for (int i = 0; i < 4; ++i) {
+    x.push_back(context.MakeVariable(i, 1.0 + i));
+  }
+  EXPECT_EQ(4, allocation_count);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(1.0, x[i].gradient()[i]);
+  }
+}
+
+template <class Variable>
+Variable MixedPrecisionObjective(const std::vector<Variable>& x) {
+  Variable sum = x[0] * x[0];
+  for (std::size_t i = 0; i + 1 < x.size(); ++i) {
+    sum += sin(x[i] * x[i + 1]) / (1.0 + exp(-x[i])) + sqrt(2.0 + x[i + 1]);
+  }
+  return sum;
+}
+
+// Float gradients of double values: the value is unaffected, and the
+// gradient is accurate to about float precision.
+TEST(DifferentiationTest, MixedPrecisionGradients) {
+  const int n = 40;
+  simple_differentiation::DifferentiationContext<double> context(n);
+  simple_differentiation::DifferentiationContext<
+      double, simple_differentiation::Vector<float> > mixed_context(n);
+  std::vector<simple_differentiation::DifferentiationVariable<double> > x;
+  std::vector<simple_differentiation::DifferentiationVariable<
+      double, simple_differentiation::Vector<float> > > mixed_x;
+  for (int j = 0; j < n; ++j) {
+    x.push_back(context.MakeVariable(j, std::cos(1.0 + j)));
+    mixed_x.push_back(mixed_context.MakeVariable(j, std::cos(1.0 + j)));
+  }
+  simple_differentiation::DifferentiationVariable<double> f =
+      MixedPrecisionObjective(x);
+  simple_differentiation::DifferentiationVariable<
+      double, simple_differentiation::Vector<float> > mixed_f =
+      MixedPrecisionObjective(mixed_x);
+
+  EXPECT_EQ(f.value(), mixed_f.value());
+  ASSERT_EQ(static_cast<std::size_t>(n), mixed_f.gradient().size());
+  for (int j = 0; j < n; ++j) {
+    EXPECT_NEAR(f.gradient()[j], mixed_f.gradient()[j],
+                1e-6 * (1.0 + std::fabs(f.gradient()[j])));
+  }
+}
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
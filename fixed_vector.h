@@ -0,0 +1,118 @@
+// fixed_vector.h
+//
+// A vector with a compile-time size and inline storage, for use as the
+// gradient type of a DifferentiationVariable when the number of variables
+// is small and known in advance:
+//
+//   DifferentiationContext<double, FixedVector<double, 3> > context(3);
+//
+// Every loop has a constant trip count, so the compiler fully unrolls them
+// and no arithmetic operation allocates.
+
+#ifndef FIXED_VECTOR_H_
+#define FIXED_VECTOR_H_
+
+#include <cassert>
+#include <cstddef>
+
+namespace simple_differentiation {
+
+template <class T, std::size_t N>
+class FixedVector {
+ public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+
+  constexpr FixedVector() : data_() { }
+
+  // Lets DifferentiationContext construct gradients by size. The size must
+  // match N.
+  constexpr explicit FixedVector(size_type n, const T& value = T())
+      : data_() {
+    assert(n == N);
+    (void)n;
+    for (size_type i = 0; i < N; ++i) {
+      data_[i] = value;
+    }
+  }
+
+  constexpr size_type size() const { return N; }
+
+  constexpr T& operator[](size_type i) { return data_[i]; }
+  constexpr const T& operator[](size_type i) const { return data_[i]; }
+
+  constexpr T* begin() { return data_; }
+  constexpr T* end() { return data_ + N; }
+  constexpr const T* begin() const { return data_; }
+  constexpr const T* end() const { return data_ + N; }
+
+  constexpr FixedVector operator-() const {
+    FixedVector result;
+    for (size_type i = 0; i < N; ++i) {
+      result.data_[i] = -data_[i];
+    }
+    return result;
+  }
+
+  constexpr FixedVector& operator+=(const FixedVector& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      data_[i] += rhs.data_[i];
+    }
+    return *this;
+  }
+
+  constexpr FixedVector& operator-=(const FixedVector& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      data_[i] -= rhs.data_[i];
+    }
+    return *this;
+  }
+
+  template <class U>
+  constexpr FixedVector& operator*=(const U& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      data_[i] *= rhs;
+    }
+    return *this;
+  }
+
+  template <class U>
+  constexpr FixedVector& operator/=(const U& rhs) {
+    for (size_type i = 0; i < N; ++i) {
+      data_[i] /= rhs;
+    }
+    return *this;
+  }
+
+  constexpr FixedVector operator+(const FixedVector& rhs) const {
+    return FixedVector(*this) += rhs;
+  }
+
+  constexpr FixedVector operator-(const FixedVector& rhs) const {
+    return FixedVector(*this) -= rhs;
+  }
+
+  template <class U>
+  constexpr FixedVector operator*(const U& rhs) const {
+    return FixedVector(*this) *= rhs;
+  }
+
+  template <class U>
+  constexpr FixedVector operator/(const U& rhs) const {
+    return FixedVector(*this) /= rhs;
+  }
+
+ private:
+  T data_[N];
+};
+
+// Handle cases where the scalar is on the left.
+template <class T, std::size_t N, class U>
+constexpr FixedVector<T, N> operator*(const U& lhs,
+                                      const FixedVector<T, N>& rhs) {
+  return rhs * lhs;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // FIXED_VECTOR_H_
@@ -0,0 +1,79 @@
+
+#include "fixed_vector.h"
+#include "differentiation.h"
+
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::FixedVector;
+
+TEST(FixedVectorTest, Create) {
+  FixedVector<double, 3> vec0;
+  EXPECT_EQ(3, vec0.size());
+  EXPECT_EQ(0.0, vec0[0]);
+  EXPECT_EQ(0.0, vec0[2]);
+
+  FixedVector<double, 2> vec1(2, 7.0);
+  EXPECT_EQ(7.0, vec1[0]);
+  EXPECT_EQ(7.0, vec1[1]);
+}
+
+TEST(FixedVectorTest, Arithmetic) {
+  FixedVector<double, 2> vec_a;
+  vec_a[0] = 1.0;
+  vec_a[1] = 2.0;
+  FixedVector<double, 2> vec_b;
+  vec_b[0] = 3.0;
+  vec_b[1] = -1.0;
+
+  FixedVector<double, 2> vec_c = 2.0 * (vec_a + vec_b) - vec_b / 2 + -vec_a;
+  EXPECT_EQ(2.0 * 4.0 - 1.5 - 1.0, vec_c[0]);
+  EXPECT_EQ(2.0 * 1.0 + 0.5 - 2.0, vec_c[1]);
+
+  vec_c *= 3;
+  EXPECT_EQ(16.5, vec_c[0]);
+  EXPECT_EQ(1.5, vec_c[1]);
+}
+
+constexpr FixedVector<int, 3> MakeConstant() {
+  FixedVector<int, 3> result(3, 2);
+  result[1] = 5;
+  return result * 3 - FixedVector<int, 3>(3, 1);
+}
+
+TEST(FixedVectorTest, Constexpr) {
+  constexpr FixedVector<int, 3> vec = MakeConstant();
+  static_assert(vec[0] == 5, "constexpr evaluation");
+  static_assert(vec[1] == 14, "constexpr evaluation");
+  EXPECT_EQ(5, vec[2]);
+}
+
+TEST(FixedVectorTest, Differentiation) {
+  DifferentiationContext<double, FixedVector<double, 2> > context(2);
+  DifferentiationVariable<double, FixedVector<double, 2> > x =
+      context.MakeVariable(0, 0.5);
+  DifferentiationVariable<double, FixedVector<double, 2> > y =
+      context.MakeVariable(1, 2.0);
+
+  DifferentiationVariable<double, FixedVector<double, 2> > f =
+      sin(x) * y / (1.0 + x * x);
+  double denominator = 1.25;
+  EXPECT_DOUBLE_EQ(std::sin(0.5) * 2.0 / denominator, f.value());
+  EXPECT_DOUBLE_EQ(
+      2.0 * (std::cos(0.5) * denominator - std::sin(0.5) * 1.0) /
+          (denominator * denominator),
+      f.gradient()[0]);
+  EXPECT_DOUBLE_EQ(std::sin(0.5) / denominator, f.gradient()[1]);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,254 @@
+// gradient_pool.h
+//
+// Pooled gradient storage. All gradients made by one DifferentiationContext
+// have the same length, so a pool of equally sized blocks serves every one
+// of them without touching the system allocator once it has warmed up:
+//
+//   DifferentiationContext<double, PooledVector<double> > context(n);
+//   for (...) {
+//     {
+//       ... evaluate the objective with context.MakeVariable(...) ...
+//     }
+//     context.Reset();
+//   }
+//
+// Blocks freed by temporaries go back on a free list straight away, and
+// Reset() rewinds the whole pool between evaluations, once every variable
+// of the last one has been destroyed; while any gradient is still alive it
+// does nothing. Variables made from a pooled context must not outlive it.
+
+#ifndef GRADIENT_POOL_H_
+#define GRADIENT_POOL_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "differentiation.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+// A pool of blocks of block_size elements of T, carved out of larger chunks.
+// Requests of any other size are passed on to operator new.
+template <class T>
+class GradientPool {
+ public:
+  explicit GradientPool(std::size_t block_size,
+                        std::size_t blocks_per_chunk = 64)
+      : block_size_(block_size),
+        block_bytes_(RoundUp(block_size * sizeof(T))),
+        blocks_per_chunk_(blocks_per_chunk),
+        free_list_(NULL),
+        num_live_blocks_(0),
+        current_chunk_(0),
+        next_(NULL),
+        end_(NULL) { }
+
+  ~GradientPool() {
+    for (std::size_t i = 0; i < chunks_.size(); ++i) {
+      ::operator delete(chunks_[i]);
+    }
+  }
+
+  T* Allocate(std::size_t n) {
+    if (n != block_size_) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    ++num_live_blocks_;
+    if (free_list_ != NULL) {
+      FreeBlock* block = free_list_;
+      free_list_ = block->next;
+      return reinterpret_cast<T*>(block);
+    }
+    if (next_ == end_) {
+      NextChunk();
+    }
+    T* block = reinterpret_cast<T*>(next_);
+    next_ += block_bytes_;
+    return block;
+  }
+
+  void Deallocate(T* p, std::size_t n) {
+    if (n != block_size_) {
+      ::operator delete(p);
+      return;
+    }
+    --num_live_blocks_;
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(p);
+    block->next = free_list_;
+    free_list_ = block;
+  }
+
+  // Makes every block available again, in the order they were first handed
+  // out, without returning memory to the system. Rewinding while a block is
+  // still in use would hand it out twice, so then this returns false and
+  // changes nothing; blocks freed since are already on the free list.
+  bool Reset() {
+    if (num_live_blocks_ != 0) {
+      return false;
+    }
+    free_list_ = NULL;
+    current_chunk_ = 0;
+    next_ = end_ = NULL;
+    return true;
+  }
+
+  // Obtains chunks from the system up front until at least num_blocks
+  // blocks can be handed out after a Reset without allocating.
+  void Reserve(std::size_t num_blocks) {
+    while (chunks_.size() * blocks_per_chunk_ < num_blocks) {
+      chunks_.push_back(static_cast<char*>(
+          ::operator new(block_bytes_ * blocks_per_chunk_)));
+    }
+  }
+
+  std::size_t block_size() const { return block_size_; }
+
+  // The number of chunks obtained from the system so far.
+  std::size_t num_chunks() const { return chunks_.size(); }
+  // The number of blocks handed out and not yet returned.
+  std::size_t num_live_blocks() const { return num_live_blocks_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Blocks are aligned for both T and the free list link.
+  static std::size_t RoundUp(std::size_t bytes) {
+    const std::size_t alignment =
+        alignof(T) > alignof(FreeBlock) ? alignof(T) : alignof(FreeBlock);
+    if (bytes < sizeof(FreeBlock)) {
+      bytes = sizeof(FreeBlock);
+    }
+    return (bytes + alignment - 1) / alignment * alignment;
+  }
+
+  void NextChunk() {
+    std::size_t chunk_bytes = block_bytes_ * blocks_per_chunk_;
+    if (current_chunk_ == chunks_.size()) {
+      chunks_.push_back(static_cast<char*>(::operator new(chunk_bytes)));
+    }
+    next_ = chunks_[current_chunk_++];
+    end_ = next_ + chunk_bytes;
+  }
+
+  std::size_t block_size_;
+  std::size_t block_bytes_;
+  std::size_t blocks_per_chunk_;
+  FreeBlock* free_list_;
+  std::size_t num_live_blocks_;
+  std::vector<char*> chunks_;
+  std::size_t current_chunk_;
+  char* next_;
+  char* end_;
+
+  GradientPool(const GradientPool& other);
+  GradientPool& operator=(const GradientPool& other);
+};
+
+// An allocator that draws from a GradientPool. A default-constructed
+// PoolAllocator has no pool and uses operator new.
+template <class T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  template <class U>
+  struct rebind {
+    typedef PoolAllocator<U> other;
+  };
+
+  PoolAllocator() : pool_(NULL) { }
+  explicit PoolAllocator(GradientPool<T>* pool) : pool_(pool) { }
+
+  // Pools only hold one element type, so rebound copies do without.
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) : pool_(NULL) { }
+
+  T* allocate(std::size_t n) {
+    if (pool_ == NULL) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return pool_->Allocate(n);
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    if (pool_ == NULL) {
+      ::operator delete(p);
+    } else {
+      pool_->Deallocate(p, n);
+    }
+  }
+
+  GradientPool<T>* pool() const { return pool_; }
+
+  bool operator==(const PoolAllocator& rhs) const {
+    return pool_ == rhs.pool_;
+  }
+  bool operator!=(const PoolAllocator& rhs) const {
+    return pool_ != rhs.pool_;
+  }
+
+ private:
+  GradientPool<T>* pool_;
+};
+
+template <class T>
+using PooledVector = Vector<T, PoolAllocator<T> >;
+
+// A DifferentiationContext whose gradients come from its own pool.
+template <class T>
+class DifferentiationContext<T, PooledVector<T> > {
+ public:
+  DifferentiationContext(int num_vars)
+      : num_vars_(num_vars), original_values_(num_vars), pool_(num_vars) { }
+
+  DifferentiationVariable<T, PooledVector<T> > MakeVariable(int index,
+                                                            const T& value);
+
+  // Makes a variable with a zero gradient, for inputs held fixed.
+  DifferentiationVariable<T, PooledVector<T> > MakeConstant(const T& value) {
+    return DifferentiationVariable<T, PooledVector<T> >(
+        value, PooledVector<T>(num_vars_, T(), PoolAllocator<T>(&pool_)));
+  }
+
+  // Recycles all gradient storage for the next evaluation. Returns false,
+  // doing nothing, while any variable made from this context is alive.
+  bool Reset() { return pool_.Reset(); }
+
+  // Preallocates storage for num_gradients live gradients.
+  void Reserve(int num_gradients) { pool_.Reserve(num_gradients); }
+
+  const T& original_value(int index) const { return original_values_[index]; }
+  int size() const { return num_vars_; }
+  const GradientPool<T>& pool() const { return pool_; }
+
+ private:
+  int num_vars_;
+  std::vector<T> original_values_;
+  GradientPool<T> pool_;
+
+  DifferentiationContext(const DifferentiationContext& other);
+  DifferentiationContext& operator=(const DifferentiationContext& other);
+};
+
+template <class T>
+DifferentiationVariable<T, PooledVector<T> >
+DifferentiationContext<T, PooledVector<T> >::MakeVariable(int index,
+                                                          const T& value) {
+  original_values_[index] = value;
+  PooledVector<T> gradient(num_vars_, T(), PoolAllocator<T>(&pool_));
+  gradient[index] = 1.0;
+  return DifferentiationVariable<T, PooledVector<T> >(value,
+                                                      std::move(gradient));
+}
+
+}  // namespace simple_differentiation
+
+#endif  // GRADIENT_POOL_H_
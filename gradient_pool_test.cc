@@ -0,0 +1,127 @@
+
+#include "gradient_pool.h"
+#include "differentiation.h"
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+// Counts every trip to the system allocator.
+static int new_count = 0;
+
+void* operator new(std::size_t size) {
+  ++new_count;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::GradientPool;
+using simple_differentiation::PooledVector;
+
+TEST(GradientPoolTest, ReusesBlocks) {
+  GradientPool<double> pool(10, 2);
+  double* a = pool.Allocate(10);
+  double* b = pool.Allocate(10);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(1, pool.num_chunks());
+
+  pool.Deallocate(a, 10);
+  EXPECT_EQ(a, pool.Allocate(10));
+
+  double* c = pool.Allocate(10);
+  EXPECT_EQ(2, pool.num_chunks());
+
+  // Other sizes bypass the pool.
+  double* d = pool.Allocate(3);
+  pool.Deallocate(d, 3);
+  EXPECT_EQ(2, pool.num_chunks());
+
+  // Blocks still in use keep the pool from rewinding.
+  EXPECT_FALSE(pool.Reset());
+  EXPECT_EQ(3, pool.num_live_blocks());
+  pool.Deallocate(c, 10);
+  pool.Deallocate(b, 10);
+  pool.Deallocate(a, 10);
+  EXPECT_TRUE(pool.Reset());
+  EXPECT_EQ(a, pool.Allocate(10));
+  EXPECT_EQ(b, pool.Allocate(10));
+  EXPECT_EQ(c, pool.Allocate(10));
+  EXPECT_EQ(2, pool.num_chunks());
+}
+
+template <class V>
+DifferentiationVariable<double, V> Objective(
+    DifferentiationContext<double, V>* context) {
+  std::vector<DifferentiationVariable<double, V> > x;
+  x.reserve(context->size());
+  for (int i = 0; i < context->size(); ++i) {
+    x.push_back(context->MakeVariable(i, 0.1 * (i + 1)));
+  }
+  DifferentiationVariable<double, V> result = x[0];
+  for (int i = 1; i < context->size(); ++i) {
+    result += sin(x[i] * x[i - 1]) / (1.0 + exp(x[i]));
+  }
+  return result;
+}
+
+TEST(GradientPoolTest, RepeatedEvaluationDoesNotAllocate) {
+  const int kNumVars = 50;
+  DifferentiationContext<double> reference_context(kNumVars);
+  DifferentiationVariable<double> reference = Objective(&reference_context);
+
+  DifferentiationContext<double, PooledVector<double> > context(kNumVars);
+  for (int evaluation = 0; evaluation < 3; ++evaluation) {
+    int new_count_before = new_count;
+    std::size_t chunks_before = context.pool().num_chunks();
+    {
+      DifferentiationVariable<double, PooledVector<double> > result =
+          Objective(&context);
+      EXPECT_EQ(reference.value(), result.value());
+      for (int i = 0; i < kNumVars; ++i) {
+        EXPECT_EQ(reference.gradient()[i], result.gradient()[i]);
+      }
+    }
+    EXPECT_TRUE(context.Reset());
+
+    if (evaluation > 0) {
+      EXPECT_EQ(chunks_before, context.pool().num_chunks());
+      // The only remaining allocation is the std::vector of inputs.
+      EXPECT_EQ(new_count_before + 1, new_count);
+    }
+  }
+}
+
+TEST(GradientPoolTest, ResetWithLiveVariables) {
+  DifferentiationContext<double, PooledVector<double> > context(4);
+  DifferentiationVariable<double, PooledVector<double> > x =
+      context.MakeVariable(0, 2.0);
+  EXPECT_FALSE(context.Reset());
+
+  // Had the pool rewound, y would share x's block.
+  DifferentiationVariable<double, PooledVector<double> > y =
+      context.MakeVariable(3, 5.0);
+  EXPECT_NE(x.gradient().data(), y.gradient().data());
+  EXPECT_EQ(1.0, x.gradient()[0]);
+  EXPECT_EQ(0.0, x.gradient()[3]);
+  EXPECT_EQ(0.0, y.gradient()[0]);
+  EXPECT_EQ(1.0, y.gradient()[3]);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
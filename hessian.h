@@ -0,0 +1,358 @@
+// hessian.h
+//
+// Second derivatives of scalar functions, written once as a template over
+// the variable type:
+//
+//   struct F {
+//     template <class Variable>
+//     Variable operator()(const std::vector<Variable>& x) const {
+//       return x[0] * x[0] * sin(x[1]);
+//     }
+//   };
+//
+//   Vector<double> hv = HessianVectorProduct(F(), x, v);
+//   DenseMatrix<double> h = Hessian(F(), x);
+//   CsrMatrix<double> sparse_h = SparseHessian(F(), x);
+//
+// Everything here is forward-over-reverse: the function is recorded on a
+// tape whose values are themselves forward-mode variables carrying a few
+// directions. One adjoint sweep then yields the gradient and, in the inner
+// derivatives, the Hessian times each direction, at a small multiple of the
+// cost of a gradient.
+//
+// Sparse Hessians use a star coloring, which exploits symmetry: H(i, j) is
+// recovered from whichever of columns i and j it can be read off uniquely,
+// so fewer directions are needed than for a Jacobian of the same pattern.
+
+#ifndef HESSIAN_H_
+#define HESSIAN_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "differentiation.h"
+#include "fixed_vector.h"
+#include "index_set.h"
+#include "jacobian.h"
+#include "sparse_jacobian.h"
+#include "tape.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+namespace internal {
+
+// Records f at the given inputs and returns the adjoint of every input. The
+// inputs are forward-mode variables, so each adjoint also carries its
+// directional derivatives.
+template <class D, class F>
+Vector<D> ForwardOverReverse(const F& f, const std::vector<D>& x) {
+  typedef DifferentiationVariable<D, TapeGradient<D> > Variable;
+  int n = static_cast<int>(x.size());
+  DifferentiationContext<D, TapeGradient<D> > context(n);
+  std::vector<Variable> inputs;
+  inputs.reserve(n);
+  for (int j = 0; j < n; ++j) {
+    inputs.push_back(context.MakeVariable(j, x[j]));
+  }
+  return context.Backward(f(inputs));
+}
+
+// Computes columns [begin, begin + kChunkSize) of H*S, where column c of the
+// seed matrix S has ones at the inputs j with seeds[j] == c, and passes each
+// entry to store(i, c, value).
+template <std::size_t kChunkSize, class T, class F, class Store>
+void SeededHessian(const F& f,
+                   const std::vector<T>& x,
+                   const std::vector<int>& seeds,
+                   int begin,
+                   const Store& store) {
+  typedef FixedVector<T, kChunkSize> Direction;
+  typedef DifferentiationVariable<T, Direction> Dual;
+  int n = static_cast<int>(x.size());
+  int end = begin + static_cast<int>(kChunkSize);
+
+  DifferentiationContext<T, Direction> directions(kChunkSize);
+  std::vector<Dual> inputs;
+  inputs.reserve(n);
+  for (int j = 0; j < n; ++j) {
+    if (seeds[j] >= begin && seeds[j] < end) {
+      inputs.push_back(directions.MakeVariable(seeds[j] - begin, x[j]));
+    } else {
+      inputs.push_back(directions.MakeConstant(x[j]));
+    }
+  }
+
+  Vector<Dual> adjoints = ForwardOverReverse(f, inputs);
+  for (int i = 0; i < n; ++i) {
+    for (int k = 0; k < static_cast<int>(kChunkSize); ++k) {
+      store(i, begin + k, adjoints[i].gradient()[k]);
+    }
+  }
+}
+
+}  // namespace internal
+
+// Returns H*v, the Hessian of f at x times v. If gradient is not NULL, it
+// is set to the gradient of f at x.
+template <class T, class F>
+Vector<T> HessianVectorProduct(const F& f,
+                               const std::vector<T>& x,
+                               const std::vector<T>& v,
+                               Vector<T>* gradient = NULL) {
+  typedef DifferentiationVariable<T, FixedVector<T, 1> > Dual;
+  int n = static_cast<int>(x.size());
+  DifferentiationContext<T, FixedVector<T, 1> > direction(1);
+  Dual t = direction.MakeVariable(0, T());
+
+  std::vector<Dual> inputs;
+  inputs.reserve(n);
+  for (int j = 0; j < n; ++j) {
+    inputs.push_back(t * v[j] + x[j]);
+  }
+
+  Vector<Dual> adjoints = internal::ForwardOverReverse(f, inputs);
+  Vector<T> result(n);
+  if (gradient != NULL) {
+    gradient->assign(n, T());
+  }
+  for (int i = 0; i < n; ++i) {
+    result[i] = adjoints[i].gradient()[0];
+    if (gradient != NULL) {
+      (*gradient)[i] = adjoints[i].value();
+    }
+  }
+  return result;
+}
+
+// Returns the dense Hessian of f at x, computed kChunkSize columns per
+// sweep, so n / kChunkSize sweeps in all. Every sweep yields whole columns,
+// so symmetry saves nothing here; it only pays off for sparse Hessians, see
+// SparseHessian. The lower triangle is overwritten with the upper one so
+// that the result is exactly symmetric despite rounding.
+template <std::size_t kChunkSize = 8, class T, class F>
+DenseMatrix<T> Hessian(const F& f,
+                       const std::vector<T>& x,
+                       MatrixLayout layout = kRowMajor) {
+  int n = static_cast<int>(x.size());
+  std::vector<int> seeds(n);
+  for (int j = 0; j < n; ++j) {
+    seeds[j] = j;
+  }
+
+  DenseMatrix<T> hessian(n, n, layout);
+  for (int begin = 0; begin < n; begin += static_cast<int>(kChunkSize)) {
+    internal::SeededHessian<kChunkSize>(
+        f, x, seeds, begin, [&hessian, n](int i, int j, const T& value) {
+          if (j < n && i <= j) {
+            hessian(i, j) = value;
+          }
+        });
+  }
+  for (int j = 0; j < n; ++j) {
+    for (int i = j + 1; i < n; ++i) {
+      hessian(i, j) = hessian(j, i);
+    }
+  }
+  return hessian;
+}
+
+// Returns the structural sparsity pattern of the Hessian of f at x, which
+// is symmetric and always includes the diagonal. The pattern only covers
+// the branches f takes at x.
+template <class T, class F>
+SparsityPattern DetectHessianSparsity(const F& f, const std::vector<T>& x) {
+  typedef DifferentiationVariable<T, IndexSet<T> > Dual;
+  typedef DifferentiationVariable<Dual, TapeGradient<Dual> > Variable;
+  int n = static_cast<int>(x.size());
+
+  DifferentiationContext<T, IndexSet<T> > dependencies(n);
+  DifferentiationContext<Dual, TapeGradient<Dual> > context(n);
+  std::vector<Variable> inputs;
+  inputs.reserve(n);
+  for (int j = 0; j < n; ++j) {
+    inputs.push_back(context.MakeVariable(j, dependencies.MakeVariable(j,
+                                                                       x[j])));
+  }
+  Variable y = f(inputs);
+
+  // Only nodes the output depends on may contribute, since a weight's
+  // dependencies survive multiplication by a zero adjoint.
+  std::vector<std::vector<int> > rows(n);
+  int output = y.gradient().node();
+  if (output >= 0) {
+    const Tape<Dual>& tape = context.tape();
+    std::vector<Dual> adjoints(output + 1);
+    std::vector<bool> reached(output + 1, false);
+    adjoints[output] = Dual(T(1));
+    reached[output] = true;
+    for (int i = output; i >= 0; --i) {
+      if (!reached[i]) {
+        continue;
+      }
+      const typename Tape<Dual>::Node& node = tape.node(i);
+      for (int k = 0; k < 2; ++k) {
+        if (node.parents[k] >= 0) {
+          adjoints[node.parents[k]] += node.weights[k] * adjoints[i];
+          reached[node.parents[k]] = true;
+        }
+      }
+    }
+    for (int j = 0; j < n; ++j) {
+      int input = inputs[j].gradient().node();
+      if (input > output) {
+        continue;
+      }
+      const IndexSet<T>& columns = adjoints[input].gradient();
+      for (std::size_t k = 0; k < columns.nonzeros(); ++k) {
+        int column = static_cast<int>(columns.index(k));
+        rows[j].push_back(column);
+        rows[column].push_back(j);
+      }
+    }
+  }
+
+  SparsityPattern pattern(n);
+  for (int j = 0; j < n; ++j) {
+    rows[j].push_back(j);
+    std::sort(rows[j].begin(), rows[j].end());
+    rows[j].erase(std::unique(rows[j].begin(), rows[j].end()), rows[j].end());
+    pattern.AddRow(rows[j]);
+  }
+  return pattern;
+}
+
+// Greedily star colors the adjacency graph of a symmetric pattern: adjacent
+// columns get different colors, and every path on four columns uses at
+// least three colors. Stores each column's color in *colors and returns the
+// number of colors used.
+inline int ColorHessian(const SparsityPattern& pattern,
+                        std::vector<int>* colors) {
+  const std::vector<int>& offsets = pattern.row_offsets();
+  const std::vector<int>& columns = pattern.column_indices();
+  int n = pattern.rows();
+  std::vector<int>& color = *colors;
+  color.assign(n, -1);
+
+  // forbidden[c] == v marks color c as unusable for column v, and count[c]
+  // is the number of v's colored neighbors with color c.
+  std::vector<int> forbidden;
+  std::vector<int> count;
+  int num_colors = 0;
+  for (int v = 0; v < n; ++v) {
+    for (int a = offsets[v]; a < offsets[v + 1]; ++a) {
+      int w = columns[a];
+      if (w != v && color[w] >= 0) {
+        forbidden[color[w]] = v;
+        ++count[color[w]];
+      }
+    }
+    for (int a = offsets[v]; a < offsets[v + 1]; ++a) {
+      int w = columns[a];
+      if (w == v || color[w] < 0) {
+        continue;
+      }
+      for (int b = offsets[w]; b < offsets[w + 1]; ++b) {
+        int x = columns[b];
+        if (x == w || x == v || color[x] < 0) {
+          continue;
+        }
+        // Path u-v-w-x with color(u) == color(w): v must not match x.
+        if (count[color[w]] >= 2) {
+          forbidden[color[x]] = v;
+          continue;
+        }
+        // Path v-w-x-y with color(y) == color(w): v must not match x.
+        for (int c = offsets[x]; c < offsets[x + 1]; ++c) {
+          int y = columns[c];
+          if (y != x && y != w && y != v && color[y] == color[w]) {
+            forbidden[color[x]] = v;
+            break;
+          }
+        }
+      }
+    }
+
+    int chosen = 0;
+    while (chosen < num_colors && forbidden[chosen] == v) {
+      ++chosen;
+    }
+    if (chosen == num_colors) {
+      forbidden.push_back(-1);
+      count.push_back(0);
+      ++num_colors;
+    }
+    color[v] = chosen;
+
+    for (int a = offsets[v]; a < offsets[v + 1]; ++a) {
+      int w = columns[a];
+      if (w != v && color[w] >= 0) {
+        count[color[w]] = 0;
+      }
+    }
+  }
+  return num_colors;
+}
+
+// Returns the Hessian of f at x with the given symmetric pattern, using one
+// direction per color of a star coloring.
+template <std::size_t kChunkSize = 8, class T, class F>
+CsrMatrix<T> SparseHessian(const F& f,
+                           const std::vector<T>& x,
+                           const SparsityPattern& pattern,
+                           const std::vector<int>& colors,
+                           int num_colors) {
+  int n = static_cast<int>(x.size());
+
+  // The compressed Hessian H*S, with one column per color.
+  std::vector<T> compressed(n * num_colors);
+  for (int begin = 0; begin < num_colors;
+       begin += static_cast<int>(kChunkSize)) {
+    internal::SeededHessian<kChunkSize>(
+        f, x, colors, begin,
+        [&compressed, num_colors](int i, int c, const T& value) {
+          if (c < num_colors) {
+            compressed[i * num_colors + c] = value;
+          }
+        });
+  }
+
+  // H(i, j) can be read from row i of column color(j) if j is i's only
+  // neighbor of that color. Otherwise the star coloring guarantees that i
+  // is j's only neighbor of color(i).
+  CsrMatrix<T> hessian(pattern);
+  const std::vector<int>& offsets = pattern.row_offsets();
+  const std::vector<int>& columns = pattern.column_indices();
+  std::vector<int> count(num_colors, 0);
+  for (int i = 0; i < n; ++i) {
+    for (int k = offsets[i]; k < offsets[i + 1]; ++k) {
+      ++count[colors[columns[k]]];
+    }
+    for (int k = offsets[i]; k < offsets[i + 1]; ++k) {
+      int j = columns[k];
+      if (count[colors[j]] == 1) {
+        hessian.values()[k] = compressed[i * num_colors + colors[j]];
+      } else {
+        hessian.values()[k] = compressed[j * num_colors + colors[i]];
+      }
+    }
+    for (int k = offsets[i]; k < offsets[i + 1]; ++k) {
+      count[colors[columns[k]]] = 0;
+    }
+  }
+  return hessian;
+}
+
+// Detects the pattern, colors it and evaluates the Hessian in one call.
+template <std::size_t kChunkSize = 8, class T, class F>
+CsrMatrix<T> SparseHessian(const F& f, const std::vector<T>& x) {
+  SparsityPattern pattern = DetectHessianSparsity(f, x);
+  std::vector<int> colors;
+  int num_colors = ColorHessian(pattern, &colors);
+  return SparseHessian<kChunkSize>(f, x, pattern, colors, num_colors);
+}
+
+}  // namespace simple_differentiation
+
+#endif  // HESSIAN_H_
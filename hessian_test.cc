@@ -0,0 +1,146 @@
+
+#include "hessian.h"
+#include "differentiation.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::ColorHessian;
+using simple_differentiation::CsrMatrix;
+using simple_differentiation::DenseMatrix;
+using simple_differentiation::DetectHessianSparsity;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::FixedVector;
+using simple_differentiation::Hessian;
+using simple_differentiation::HessianVectorProduct;
+using simple_differentiation::SparseHessian;
+using simple_differentiation::SparsityPattern;
+using simple_differentiation::Vector;
+
+// f = x0^2 x1 + sin(x0) exp(x1) + log(x2) x0.
+struct Small {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    return x[0] * x[0] * x[1] + sin(x[0]) * exp(x[1]) + log(x[2]) * x[0];
+  }
+};
+
+void SmallHessian(const std::vector<double>& x, double h[3][3]) {
+  h[0][0] = 2.0 * x[1] - sin(x[0]) * exp(x[1]);
+  h[0][1] = h[1][0] = 2.0 * x[0] + cos(x[0]) * exp(x[1]);
+  h[0][2] = h[2][0] = 1.0 / x[2];
+  h[1][1] = sin(x[0]) * exp(x[1]);
+  h[1][2] = h[2][1] = 0.0;
+  h[2][2] = -x[0] / (x[2] * x[2]);
+}
+
+// A chain with every elementary function, coupled to x0 at every link.
+struct Chain {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    Variable sum = x[0] * 0.0;
+    for (std::size_t i = 1; i < x.size(); ++i) {
+      Variable d = x[i] - x[i - 1] * x[i - 1];
+      sum += d * d + 0.1 * x[0] * sin(x[i]);
+      if (i % 4 == 0) {
+        sum += atan(x[i]) * sqrt(2.0 + cos(x[i - 1]));
+      } else if (i % 4 == 1) {
+        sum += pow(fabs(x[i]) + 1.0, 2.5) / exp(x[i - 1]);
+      } else if (i % 4 == 2) {
+        sum += asin(x[i] / 4.0) * acos(x[i - 1] / 4.0);
+      } else {
+        sum += tan(x[i] / 2.0) - log(3.0 + x[i]);
+      }
+    }
+    return sum;
+  }
+};
+
+TEST(HessianTest, NestedVariables) {
+  typedef DifferentiationVariable<double, FixedVector<double, 2> > Inner;
+  typedef DifferentiationVariable<Inner, FixedVector<Inner, 2> > Outer;
+
+  DifferentiationContext<double, FixedVector<double, 2> > inner(2);
+  DifferentiationContext<Inner, FixedVector<Inner, 2> > outer(2);
+  std::vector<Outer> x;
+  x.push_back(outer.MakeVariable(0, inner.MakeVariable(0, 0.7)));
+  x.push_back(outer.MakeVariable(1, inner.MakeVariable(1, -0.4)));
+  x.push_back(Outer(Inner(2.5)));
+  Outer f = Small()(x);
+
+  double h[3][3];
+  SmallHessian(std::vector<double>{0.7, -0.4, 2.5}, h);
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      EXPECT_DOUBLE_EQ(h[i][j], f.gradient()[i].gradient()[j]);
+    }
+  }
+  EXPECT_DOUBLE_EQ(f.gradient()[0].value(), f.value().gradient()[0]);
+  EXPECT_TRUE(x[0] > 0.5);
+  EXPECT_TRUE(0.0 > x[1]);
+}
+
+TEST(HessianTest, HessianVectorProduct) {
+  std::vector<double> x = {0.7, -0.4, 2.5};
+  std::vector<double> v = {1.0, -2.0, 0.5};
+  Vector<double> gradient;
+  Vector<double> hv = HessianVectorProduct(Small(), x, v, &gradient);
+
+  double h[3][3];
+  SmallHessian(x, h);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_NEAR(h[i][0] * v[0] + h[i][1] * v[1] + h[i][2] * v[2], hv[i],
+                1e-12);
+  }
+  EXPECT_DOUBLE_EQ(2.0 * x[0] * x[1] + cos(x[0]) * exp(x[1]) + log(x[2]),
+                   gradient[0]);
+}
+
+TEST(HessianTest, Dense) {
+  std::vector<double> x = {0.7, -0.4, 2.5};
+  DenseMatrix<double> hessian = Hessian<2>(Small(), x);
+  double h[3][3];
+  SmallHessian(x, h);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR(h[i][j], hessian(i, j), 1e-12);
+    }
+  }
+}
+
+TEST(HessianTest, Sparse) {
+  std::vector<double> x;
+  for (int j = 0; j < 30; ++j) {
+    x.push_back(0.5 * sin(1.3 * j));
+  }
+
+  SparsityPattern pattern = DetectHessianSparsity(Chain(), x);
+  ASSERT_EQ(30, pattern.rows());
+  // An arrowhead: x0 couples to everything, the rest is tridiagonal.
+  EXPECT_EQ(30 + 2 * 29 + 2 * 28, pattern.nonzeros());
+
+  std::vector<int> colors;
+  int num_colors = ColorHessian(pattern, &colors);
+  EXPECT_LE(num_colors, 4);
+
+  CsrMatrix<double> sparse =
+      SparseHessian<3>(Chain(), x, pattern, colors, num_colors);
+  DenseMatrix<double> dense = Hessian(Chain(), x);
+  for (int i = 0; i < 30; ++i) {
+    for (int j = 0; j < 30; ++j) {
+      EXPECT_NEAR(dense(i, j), sparse(i, j), 1e-12) << i << ", " << j;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
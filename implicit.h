@@ -0,0 +1,417 @@
+// implicit.h
+//
+// Derivatives of the solution of a nonlinear system. If y(p) is defined by
+// F(y, p) = 0, as the result of a Newton or fixed-point solve, then by the
+// implicit function theorem
+//
+//   dy/dp = -F_y^-1 F_p,
+//
+// where F_y and F_p are the Jacobians of F with respect to y and p. The
+// functions here need only the converged y and the residual F, so the solver
+// that produced y is never differentiated: the cost is one linear solve,
+// however many iterations the solver took. The residual is written once as
+// a template over the variable type and produces one entry per entry of y:
+//
+//   struct Residual {
+//     template <class Variable>
+//     void operator()(const std::vector<Variable>& y,
+//                     const std::vector<Variable>& p,
+//                     std::vector<Variable>* r) const {
+//       r->push_back(y[0] - p[0] * cos(y[1]));
+//       r->push_back(y[1] - 0.5 * sin(y[0]) - p[1]);
+//     }
+//   };
+//
+//   DenseMatrix<double> dy_dp(0, 0);
+//   bool ok = ImplicitJacobian(Residual(), y, p, &dy_dp);
+//
+// ImplicitJacobian and ImplicitGradient form F_y densely and factor it, which
+// suits systems of up to a few thousand unknowns. ImplicitGradient never
+// forms F_p: it solves F_y^T lambda = dL/dy and takes F_p^T lambda from one
+// reverse sweep over the residual, so its cost does not grow with the
+// number of parameters beyond that of evaluating F. ImplicitTangent never forms
+// F_y; it solves with BiCGSTAB, one evaluation of F per product with F_y, for
+// larger systems where the derivative along one direction of p is enough.
+
+#ifndef IMPLICIT_H_
+#define IMPLICIT_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "differentiation.h"
+#include "jacobian.h"
+#include "tangent.h"
+#include "tape.h"
+#include "thread_pool.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+// Controls the iterative solve of ImplicitTangent.
+struct ImplicitSolverOptions {
+  ImplicitSolverOptions() : max_iterations(1000), tolerance(1e-10) { }
+
+  int max_iterations;
+  // The solve stops once ||F_y t + F_p d|| <= tolerance * ||F_p d||.
+  double tolerance;
+};
+
+// What an iterative implicit solve cost and how far it got.
+struct ImplicitSolverStats {
+  ImplicitSolverStats()
+      : iterations(0), residual_evaluations(0), relative_residual(0.0) { }
+
+  int iterations;
+  // Forward-mode evaluations of F, one per Jacobian-vector product.
+  int residual_evaluations;
+  // ||F_y t + F_p d|| / ||F_p d|| at the returned t.
+  double relative_residual;
+};
+
+namespace internal {
+
+// The residual as a function of the concatenation of y and p, in the form
+// that jacobian.h and tangent.h expect.
+template <class F>
+class JoinedResidual {
+ public:
+  JoinedResidual(const F& residual, int num_states)
+      : residual_(residual), num_states_(num_states) { }
+
+  template <class Variable>
+  void operator()(const std::vector<Variable>& z,
+                  std::vector<Variable>* r) const {
+    std::vector<Variable> y(z.begin(), z.begin() + num_states_);
+    std::vector<Variable> p(z.begin() + num_states_, z.end());
+    residual_(y, p, r);
+    assert(static_cast<int>(r->size()) == num_states_);
+  }
+
+ private:
+  const F& residual_;
+  int num_states_;
+};
+
+// The residual as a function of y alone, with p held constant.
+template <class F, class T>
+class StateResidual {
+ public:
+  StateResidual(const F& residual, const std::vector<T>& p)
+      : residual_(residual), p_(p) { }
+
+  template <class Variable>
+  void operator()(const std::vector<Variable>& y,
+                  std::vector<Variable>* r) const {
+    std::vector<Variable> p(p_.begin(), p_.end());
+    residual_(y, p, r);
+    assert(r->size() == y.size());
+  }
+
+ private:
+  const F& residual_;
+  const std::vector<T>& p_;
+};
+
+template <class T>
+std::vector<T> Concatenate(const std::vector<T>& a, const std::vector<T>& b) {
+  std::vector<T> result(a);
+  result.insert(result.end(), b.begin(), b.end());
+  return result;
+}
+
+// An LU factorization with partial pivoting of F_y, the leading square
+// block of a residual Jacobian.
+template <class T>
+class LuFactorization {
+ public:
+  // Factors the square block jacobian(0:n, 0:n). Returns false if it meets
+  // a zero pivot.
+  bool Factor(const DenseMatrix<T>& jacobian, int n) {
+    n_ = n;
+    lu_.assign(n * n, T());
+    pivots_.resize(n);
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) {
+        lu_[i * n + j] = jacobian(i, j);
+      }
+    }
+    for (int k = 0; k < n; ++k) {
+      int pivot = k;
+      for (int i = k + 1; i < n; ++i) {
+        if (std::fabs(lu_[i * n + k]) > std::fabs(lu_[pivot * n + k])) {
+          pivot = i;
+        }
+      }
+      pivots_[k] = pivot;
+      if (lu_[pivot * n + k] == T()) {
+        return false;
+      }
+      if (pivot != k) {
+        for (int j = 0; j < n; ++j) {
+          std::swap(lu_[k * n + j], lu_[pivot * n + j]);
+        }
+      }
+      for (int i = k + 1; i < n; ++i) {
+        T factor = lu_[i * n + k] / lu_[k * n + k];
+        lu_[i * n + k] = factor;
+        for (int j = k + 1; j < n; ++j) {
+          lu_[i * n + j] -= factor * lu_[k * n + j];
+        }
+      }
+    }
+    return true;
+  }
+
+  // Overwrites b, of length n, with the solution of A x = b.
+  void Solve(T* b) const {
+    const int n = n_;
+    for (int k = 0; k < n; ++k) {
+      std::swap(b[k], b[pivots_[k]]);
+    }
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < i; ++j) {
+        b[i] -= lu_[i * n + j] * b[j];
+      }
+    }
+    for (int i = n - 1; i >= 0; --i) {
+      for (int j = i + 1; j < n; ++j) {
+        b[i] -= lu_[i * n + j] * b[j];
+      }
+      b[i] /= lu_[i * n + i];
+    }
+  }
+
+  // Overwrites b with the solution of A^T x = b.
+  void SolveTranspose(T* b) const {
+    const int n = n_;
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < i; ++j) {
+        b[i] -= lu_[j * n + i] * b[j];
+      }
+      b[i] /= lu_[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; --i) {
+      for (int j = i + 1; j < n; ++j) {
+        b[i] -= lu_[j * n + i] * b[j];
+      }
+    }
+    for (int k = n - 1; k >= 0; --k) {
+      std::swap(b[k], b[pivots_[k]]);
+    }
+  }
+
+ private:
+  int n_;
+  std::vector<T> lu_;
+  std::vector<int> pivots_;
+};
+
+template <class T>
+T Dot(const std::vector<T>& a, const std::vector<T>& b) {
+  T sum = T();
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+}  // namespace internal
+
+// Sets *dy_dp to the m x n Jacobian of the solution y of residual(y, p) = 0
+// with respect to p, given the converged y. Returns false, leaving *dy_dp
+// unspecified, if F_y is singular. If pool is not NULL, the Jacobian of the
+// residual is computed on it.
+template <std::size_t kChunkSize = 8, class T, class F>
+bool ImplicitJacobian(const F& residual,
+                      const std::vector<T>& y,
+                      const std::vector<T>& p,
+                      DenseMatrix<T>* dy_dp,
+                      ThreadPool* pool = NULL) {
+  int m = static_cast<int>(y.size());
+  int n = static_cast<int>(p.size());
+  DenseMatrix<T> jacobian = Jacobian<kChunkSize>(
+      internal::JoinedResidual<F>(residual, m), internal::Concatenate(y, p),
+      pool);
+  internal::LuFactorization<T> lu;
+  if (!lu.Factor(jacobian, m)) {
+    return false;
+  }
+
+  *dy_dp = DenseMatrix<T>(m, n, dy_dp->layout());
+  std::vector<T> column(m);
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i < m; ++i) {
+      column[i] = -jacobian(i, m + j);
+    }
+    lu.Solve(column.data());
+    for (int i = 0; i < m; ++i) {
+      (*dy_dp)(i, j) = column[i];
+    }
+  }
+  return true;
+}
+
+// Sets *gradient to the gradient with respect to p of a loss L(y(p)), given
+// the converged y and dL/dy. This is the adjoint form of ImplicitJacobian:
+// F_y is formed in m / kChunkSize forward-mode passes, on the pool if there
+// is one, and factored to solve F_y^T lambda = dL/dy; the gradient
+// -F_p^T lambda then comes from one reverse sweep over lambda^T F, with y
+// held constant. Returns false if F_y is singular.
+template <std::size_t kChunkSize = 8, class T, class F>
+bool ImplicitGradient(const F& residual,
+                      const std::vector<T>& y,
+                      const std::vector<T>& p,
+                      const std::vector<T>& loss_gradient,
+                      Vector<T>* gradient,
+                      ThreadPool* pool = NULL) {
+  typedef DifferentiationVariable<T, TapeGradient<T> > Variable;
+  int m = static_cast<int>(y.size());
+  int n = static_cast<int>(p.size());
+  assert(static_cast<int>(loss_gradient.size()) == m);
+  DenseMatrix<T> state_jacobian = Jacobian<kChunkSize>(
+      internal::StateResidual<F, T>(residual, p), y, pool);
+  internal::LuFactorization<T> lu;
+  if (!lu.Factor(state_jacobian, m)) {
+    return false;
+  }
+  std::vector<T> adjoint(loss_gradient);
+  lu.SolveTranspose(adjoint.data());
+
+  DifferentiationContext<T, TapeGradient<T> > context(n);
+  std::vector<Variable> y_constants(y.begin(), y.end());
+  std::vector<Variable> p_variables;
+  p_variables.reserve(n);
+  for (int j = 0; j < n; ++j) {
+    p_variables.push_back(context.MakeVariable(j, p[j]));
+  }
+  std::vector<Variable> r;
+  residual(y_constants, p_variables, &r);
+  assert(static_cast<int>(r.size()) == m);
+  Variable weighted = context.MakeConstant(T());
+  for (int i = 0; i < m; ++i) {
+    weighted += r[i] * adjoint[i];
+  }
+  *gradient = -context.Backward(weighted);
+  return true;
+}
+
+// Sets *tangent to dy/dp * direction without forming any Jacobian, by
+// solving F_y t = -F_p direction with BiCGSTAB. Each iteration evaluates the
+// residual twice in forward mode with a single direction. Returns whether
+// the solve reached options.tolerance; *tangent holds the last iterate
+// either way. If stats is not NULL, it receives the cost of the solve.
+template <class T, class F>
+bool ImplicitTangent(const F& residual,
+                     const std::vector<T>& y,
+                     const std::vector<T>& p,
+                     const std::vector<T>& direction,
+                     Vector<T>* tangent,
+                     const ImplicitSolverOptions& options =
+                         ImplicitSolverOptions(),
+                     ImplicitSolverStats* stats = NULL) {
+  using std::sqrt;
+  using internal::Dot;
+  ImplicitSolverStats local_stats;
+  if (stats == NULL) {
+    stats = &local_stats;
+  }
+  *stats = ImplicitSolverStats();
+  int m = static_cast<int>(y.size());
+  assert(direction.size() == p.size());
+  internal::JoinedResidual<F> joined(residual, m);
+  std::vector<T> z = internal::Concatenate(y, p);
+
+  // Returns F_y v, or F_p v when v is in the parameters.
+  std::vector<T> seed(z.size());
+  auto product = [&](const std::vector<T>& v, int offset) {
+    std::fill(seed.begin(), seed.end(), T());
+    std::copy(v.begin(), v.end(), seed.begin() + offset);
+    ++stats->residual_evaluations;
+    Vector<T> result = JacobianVectorProduct(joined, z, seed);
+    return std::vector<T>(result.begin(), result.end());
+  };
+
+  std::vector<T> x(m, T());
+  std::vector<T> r = product(direction, m);
+  for (int i = 0; i < m; ++i) {
+    r[i] = -r[i];
+  }
+  T b_norm = sqrt(Dot(r, r));
+  *tangent = Vector<T>(m);
+  if (b_norm == T()) {
+    return true;
+  }
+  T threshold = options.tolerance * b_norm;
+
+  std::vector<T> r_hat(r);
+  std::vector<T> search(m, T());
+  std::vector<T> v(m, T());
+  std::vector<T> s(m);
+  T rho = 1.0;
+  T alpha = 1.0;
+  T omega = 1.0;
+  T r_norm = b_norm;
+  bool converged = false;
+  while (stats->iterations < options.max_iterations) {
+    ++stats->iterations;
+    T rho_next = Dot(r_hat, r);
+    if (rho_next == T()) {
+      break;
+    }
+    T beta = rho_next / rho * (alpha / omega);
+    rho = rho_next;
+    for (int i = 0; i < m; ++i) {
+      search[i] = r[i] + beta * (search[i] - omega * v[i]);
+    }
+    v = product(search, 0);
+    T r_hat_v = Dot(r_hat, v);
+    if (r_hat_v == T()) {
+      break;
+    }
+    alpha = rho / r_hat_v;
+    for (int i = 0; i < m; ++i) {
+      s[i] = r[i] - alpha * v[i];
+    }
+    T s_norm = sqrt(Dot(s, s));
+    if (s_norm <= threshold) {
+      for (int i = 0; i < m; ++i) {
+        x[i] += alpha * search[i];
+      }
+      r_norm = s_norm;
+      converged = true;
+      break;
+    }
+    std::vector<T> t = product(s, 0);
+    T t_t = Dot(t, t);
+    if (t_t == T()) {
+      break;
+    }
+    omega = Dot(t, s) / t_t;
+    for (int i = 0; i < m; ++i) {
+      x[i] += alpha * search[i] + omega * s[i];
+      r[i] = s[i] - omega * t[i];
+    }
+    r_norm = sqrt(Dot(r, r));
+    if (r_norm <= threshold) {
+      converged = true;
+      break;
+    }
+    if (omega == T()) {
+      break;
+    }
+  }
+  for (int i = 0; i < m; ++i) {
+    (*tangent)[i] = x[i];
+  }
+  stats->relative_residual = static_cast<double>(r_norm / b_norm);
+  return converged;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // IMPLICIT_H_
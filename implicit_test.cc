@@ -0,0 +1,156 @@
+#include "implicit.h"
+#include "differentiation.h"
+#include "jacobian.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DenseMatrix;
+using simple_differentiation::ImplicitGradient;
+using simple_differentiation::ImplicitJacobian;
+using simple_differentiation::ImplicitSolverOptions;
+using simple_differentiation::ImplicitSolverStats;
+using simple_differentiation::ImplicitTangent;
+using simple_differentiation::Vector;
+
+const int kNumStates = 6;
+
+// y = G(y, p) for a contraction G, so that fixed-point iteration converges.
+struct FixedPoint {
+  template <class Variable>
+  void operator()(const std::vector<Variable>& y,
+                  const std::vector<Variable>& p,
+                  std::vector<Variable>* r) const {
+    for (int i = 0; i < kNumStates; ++i) {
+      const Variable& next = y[(i + 1) % kNumStates];
+      r->push_back(y[i] - (0.3 * p[0] * sin(next) +
+                           p[1] * cos(i + 0.5 * y[i]) + 0.1 * p[2] * i));
+    }
+  }
+};
+
+// Solves by plain fixed-point iteration, the kind of solver the implicit
+// derivatives avoid differentiating.
+std::vector<double> Solve(const std::vector<double>& p) {
+  std::vector<double> y(kNumStates, 0.0);
+  for (int iteration = 0; iteration < 200; ++iteration) {
+    std::vector<double> r;
+    FixedPoint()(y, p, &r);
+    for (int i = 0; i < kNumStates; ++i) {
+      y[i] -= r[i];
+    }
+  }
+  return y;
+}
+
+std::vector<double> Parameters() {
+  std::vector<double> p;
+  p.push_back(0.9);
+  p.push_back(0.4);
+  p.push_back(-0.7);
+  return p;
+}
+
+TEST(ImplicitTest, JacobianMatchesFiniteDifferences) {
+  std::vector<double> p = Parameters();
+  std::vector<double> y = Solve(p);
+  DenseMatrix<double> dy_dp(0, 0);
+  ASSERT_TRUE(ImplicitJacobian(FixedPoint(), y, p, &dy_dp));
+  ASSERT_EQ(kNumStates, dy_dp.rows());
+  ASSERT_EQ(3, dy_dp.cols());
+
+  const double h = 1e-6;
+  for (int j = 0; j < 3; ++j) {
+    std::vector<double> p_plus(p);
+    std::vector<double> p_minus(p);
+    p_plus[j] += h;
+    p_minus[j] -= h;
+    std::vector<double> y_plus = Solve(p_plus);
+    std::vector<double> y_minus = Solve(p_minus);
+    for (int i = 0; i < kNumStates; ++i) {
+      EXPECT_NEAR((y_plus[i] - y_minus[i]) / (2.0 * h), dy_dp(i, j), 1e-8);
+    }
+  }
+}
+
+TEST(ImplicitTest, GradientIsTransposedJacobian) {
+  std::vector<double> p = Parameters();
+  std::vector<double> y = Solve(p);
+  std::vector<double> loss_gradient;
+  for (int i = 0; i < kNumStates; ++i) {
+    loss_gradient.push_back(1.0 - 0.3 * i);
+  }
+  Vector<double> gradient;
+  ASSERT_TRUE(ImplicitGradient(FixedPoint(), y, p, loss_gradient, &gradient));
+  DenseMatrix<double> dy_dp(0, 0);
+  ASSERT_TRUE(ImplicitJacobian(FixedPoint(), y, p, &dy_dp));
+  ASSERT_EQ(3, gradient.size());
+  for (int j = 0; j < 3; ++j) {
+    double expected = 0.0;
+    for (int i = 0; i < kNumStates; ++i) {
+      expected += loss_gradient[i] * dy_dp(i, j);
+    }
+    EXPECT_NEAR(expected, gradient[j], 1e-12);
+  }
+}
+
+TEST(ImplicitTest, TangentMatchesJacobian) {
+  std::vector<double> p = Parameters();
+  std::vector<double> y = Solve(p);
+  DenseMatrix<double> dy_dp(0, 0);
+  ASSERT_TRUE(ImplicitJacobian(FixedPoint(), y, p, &dy_dp));
+
+  std::vector<double> direction;
+  direction.push_back(0.5);
+  direction.push_back(-1.0);
+  direction.push_back(2.0);
+  ImplicitSolverOptions options;
+  options.tolerance = 1e-13;
+  ImplicitSolverStats stats;
+  Vector<double> tangent;
+  ASSERT_TRUE(ImplicitTangent(FixedPoint(), y, p, direction, &tangent,
+                              options, &stats));
+  EXPECT_LE(stats.relative_residual, 1e-13);
+  EXPECT_GT(stats.iterations, 0);
+  EXPECT_LE(stats.iterations, kNumStates);
+  EXPECT_LE(stats.residual_evaluations, 1 + 2 * stats.iterations);
+  for (int i = 0; i < kNumStates; ++i) {
+    double expected = 0.0;
+    for (int j = 0; j < 3; ++j) {
+      expected += dy_dp(i, j) * direction[j];
+    }
+    EXPECT_NEAR(expected, tangent[i], 1e-12);
+  }
+}
+
+// r = (y_0 + y_1 - p_0, 2 y_0 + 2 y_1), whose F_y is singular.
+struct Singular {
+  template <class Variable>
+  void operator()(const std::vector<Variable>& y,
+                  const std::vector<Variable>& p,
+                  std::vector<Variable>* r) const {
+    r->push_back(y[0] + y[1] - p[0]);
+    r->push_back(2.0 * y[0] + 2.0 * y[1]);
+  }
+};
+
+TEST(ImplicitTest, SingularSystems) {
+  std::vector<double> y(2, 0.0);
+  std::vector<double> p(1, 0.0);
+  DenseMatrix<double> dy_dp(0, 0);
+  EXPECT_FALSE(ImplicitJacobian(Singular(), y, p, &dy_dp));
+  Vector<double> gradient;
+  EXPECT_FALSE(ImplicitGradient(Singular(), y, p, std::vector<double>(2, 1.0),
+                                &gradient));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
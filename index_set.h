@@ -0,0 +1,112 @@
+// index_set.h
+//
+// A gradient type that tracks only which variables a value depends on, not
+// the derivatives themselves. Evaluating a function with
+//
+//   DifferentiationContext<double, IndexSet<double> > context(n);
+//
+// yields, for each output, the sorted set of inputs it structurally depends
+// on, at the cost of a set union per binary operation. Scaling a set is a
+// no-op, so the pattern is the same whatever values the derivatives take.
+
+#ifndef INDEX_SET_H_
+#define INDEX_SET_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+namespace simple_differentiation {
+
+template <class T>
+class IndexSet {
+ public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+
+  IndexSet() : size_(0), ignored_() { }
+
+  // Creates an empty set over n variables. The value argument exists for
+  // compatibility with the dense vector types and must be zero.
+  explicit IndexSet(size_type n, const T& value = T())
+      : size_(n), ignored_() {
+    (void)value;
+  }
+
+  // The number of variables, not the number of members.
+  size_type size() const { return size_; }
+
+  size_type nonzeros() const { return indices_.size(); }
+  size_type index(size_type k) const { return indices_[k]; }
+  const std::vector<size_type>& indices() const { return indices_; }
+
+  // Adds i to the set. The returned reference is a placeholder that lets
+  // DifferentiationContext seed a variable; writes to it are discarded.
+  T& operator[](size_type i) {
+    typename std::vector<size_type>::iterator position =
+        std::lower_bound(indices_.begin(), indices_.end(), i);
+    if (position == indices_.end() || *position != i) {
+      indices_.insert(position, i);
+    }
+    return ignored_;
+  }
+
+  IndexSet operator-() const { return *this; }
+
+  IndexSet& operator+=(const IndexSet& rhs) { return Union(rhs); }
+  IndexSet& operator-=(const IndexSet& rhs) { return Union(rhs); }
+
+  template <class U>
+  IndexSet& operator*=(const U&) { return *this; }
+
+  template <class U>
+  IndexSet& operator/=(const U&) { return *this; }
+
+  IndexSet operator+(const IndexSet& rhs) const {
+    IndexSet result(*this);
+    result += rhs;
+    return result;
+  }
+
+  IndexSet operator-(const IndexSet& rhs) const {
+    IndexSet result(*this);
+    result -= rhs;
+    return result;
+  }
+
+  template <class U>
+  IndexSet operator*(const U&) const { return *this; }
+
+  template <class U>
+  IndexSet operator/(const U&) const { return *this; }
+
+ private:
+  IndexSet& Union(const IndexSet& rhs) {
+    if (rhs.indices_.empty()) {
+      return *this;
+    }
+    std::vector<size_type> indices;
+    indices.reserve(indices_.size() + rhs.indices_.size());
+    std::set_union(indices_.begin(), indices_.end(),
+                   rhs.indices_.begin(), rhs.indices_.end(),
+                   std::back_inserter(indices));
+    indices_.swap(indices);
+    size_ = std::max(size_, rhs.size_);
+    return *this;
+  }
+
+  size_type size_;
+  std::vector<size_type> indices_;
+  T ignored_;
+};
+
+// Handle cases where the scalar is on the left.
+template <class T, class U>
+IndexSet<T> operator*(const U& lhs, const IndexSet<T>& rhs) {
+  return rhs * lhs;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // INDEX_SET_H_
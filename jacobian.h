@@ -0,0 +1,154 @@
+// jacobian.h
+//
+// Jacobians of vector-valued functions. The function is written once as a
+// template over the variable type:
+//
+//   struct F {
+//     template <class Variable>
+//     void operator()(const std::vector<Variable>& x,
+//                     std::vector<Variable>* y) const {
+//       y->push_back(x[0] * x[1]);
+//       y->push_back(sin(x[2]));
+//     }
+//   };
+//
+//   ThreadPool pool;
+//   DenseMatrix<double> jacobian = Jacobian(F(), x, &pool);
+//
+// The inputs are split into chunks of kChunkSize directions. Each chunk is
+// one forward-mode evaluation with a FixedVector gradient, seeding only the
+// inputs in that chunk, and the chunks are run in parallel on the pool.
+
+#ifndef JACOBIAN_H_
+#define JACOBIAN_H_
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include "differentiation.h"
+#include "fixed_vector.h"
+#include "thread_pool.h"
+
+namespace simple_differentiation {
+
+enum MatrixLayout {
+  kRowMajor,
+  kColumnMajor
+};
+
+// A dense matrix in one contiguous block.
+template <class T>
+class DenseMatrix {
+ public:
+  DenseMatrix(int rows, int cols, MatrixLayout layout = kRowMajor)
+      : rows_(rows), cols_(cols), layout_(layout), values_(rows * cols) { }
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  MatrixLayout layout() const { return layout_; }
+
+  T& operator()(int i, int j) { return values_[Offset(i, j)]; }
+  const T& operator()(int i, int j) const { return values_[Offset(i, j)]; }
+
+  T* data() { return values_.data(); }
+  const T* data() const { return values_.data(); }
+
+ private:
+  int Offset(int i, int j) const {
+    return layout_ == kRowMajor ? i * cols_ + j : j * rows_ + i;
+  }
+
+  int rows_;
+  int cols_;
+  MatrixLayout layout_;
+  std::vector<T> values_;
+};
+
+namespace internal {
+
+// Evaluates f with the inputs [begin, begin + kChunkSize) seeded and the
+// rest held constant.
+template <std::size_t kChunkSize, class T, class F>
+void EvaluateChunk(
+    const F& f,
+    const std::vector<T>& x,
+    int begin,
+    std::vector<DifferentiationVariable<T, FixedVector<T, kChunkSize> > >*
+        outputs) {
+  typedef FixedVector<T, kChunkSize> Gradient;
+  DifferentiationContext<T, Gradient> context(kChunkSize);
+  std::vector<DifferentiationVariable<T, Gradient> > inputs;
+  inputs.reserve(x.size());
+  for (int j = 0; j < static_cast<int>(x.size()); ++j) {
+    if (j >= begin && j < begin + static_cast<int>(kChunkSize)) {
+      inputs.push_back(context.MakeVariable(j - begin, x[j]));
+    } else {
+      inputs.push_back(context.MakeConstant(x[j]));
+    }
+  }
+  outputs->clear();
+  f(inputs, outputs);
+}
+
+template <std::size_t kChunkSize, class T>
+void StoreChunk(
+    const std::vector<DifferentiationVariable<T, FixedVector<T, kChunkSize> > >&
+        outputs,
+    int begin,
+    DenseMatrix<T>* jacobian) {
+  assert(static_cast<int>(outputs.size()) == jacobian->rows());
+  int end = begin + static_cast<int>(kChunkSize);
+  if (end > jacobian->cols()) {
+    end = jacobian->cols();
+  }
+  for (int i = 0; i < jacobian->rows(); ++i) {
+    for (int j = begin; j < end; ++j) {
+      (*jacobian)(i, j) = outputs[i].gradient()[j - begin];
+    }
+  }
+}
+
+}  // namespace internal
+
+// Returns the Jacobian of f at x, with one row per output and one column per
+// input. f must produce the same number of outputs on every call. If pool is
+// NULL, every chunk runs on the calling thread.
+template <std::size_t kChunkSize = 8, class T, class F>
+DenseMatrix<T> Jacobian(const F& f,
+                        const std::vector<T>& x,
+                        ThreadPool* pool = NULL,
+                        MatrixLayout layout = kRowMajor) {
+  typedef DifferentiationVariable<T, FixedVector<T, kChunkSize> > Variable;
+  int num_inputs = static_cast<int>(x.size());
+  int num_chunks = (num_inputs + kChunkSize - 1) / kChunkSize;
+
+  // The first chunk tells us how many outputs there are.
+  std::vector<Variable> outputs;
+  internal::EvaluateChunk<kChunkSize>(f, x, 0, &outputs);
+  DenseMatrix<T> jacobian(static_cast<int>(outputs.size()), num_inputs,
+                          layout);
+  if (num_chunks == 0) {
+    return jacobian;
+  }
+  internal::StoreChunk<kChunkSize>(outputs, 0, &jacobian);
+
+  auto run_chunk = [&f, &x, &jacobian](int chunk) {
+    std::vector<Variable> chunk_outputs;
+    int begin = (chunk + 1) * static_cast<int>(kChunkSize);
+    internal::EvaluateChunk<kChunkSize>(f, x, begin, &chunk_outputs);
+    internal::StoreChunk<kChunkSize>(chunk_outputs, begin, &jacobian);
+  };
+  if (pool == NULL) {
+    for (int chunk = 0; chunk < num_chunks - 1; ++chunk) {
+      run_chunk(chunk);
+    }
+  } else {
+    pool->ParallelFor(num_chunks - 1, run_chunk);
+  }
+  return jacobian;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // JACOBIAN_H_
@@ -0,0 +1,74 @@
+
+#include "jacobian.h"
+#include "differentiation.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DenseMatrix;
+using simple_differentiation::Jacobian;
+using simple_differentiation::ThreadPool;
+using simple_differentiation::kColumnMajor;
+using simple_differentiation::kRowMajor;
+
+// y_i = sin(x_i) * x_{i+1} + x_0^2, for i < n - 1.
+struct Chain {
+  template <class Variable>
+  void operator()(const std::vector<Variable>& x,
+                  std::vector<Variable>* y) const {
+    for (std::size_t i = 0; i + 1 < x.size(); ++i) {
+      y->push_back(sin(x[i]) * x[i + 1] + x[0] * x[0]);
+    }
+  }
+};
+
+double Expected(const std::vector<double>& x, int i, int j) {
+  double value = 0.0;
+  if (j == i) {
+    value += cos(x[i]) * x[i + 1];
+  }
+  if (j == i + 1) {
+    value += sin(x[i]);
+  }
+  if (j == 0) {
+    value += 2.0 * x[0];
+  }
+  return value;
+}
+
+TEST(JacobianTest, MatchesAnalytic) {
+  std::vector<double> x;
+  for (int j = 0; j < 11; ++j) {
+    x.push_back(0.1 * j - 0.4);
+  }
+
+  ThreadPool pool(3);
+  DenseMatrix<double> serial = Jacobian<4>(Chain(), x);
+  DenseMatrix<double> parallel = Jacobian<4>(Chain(), x, &pool);
+  DenseMatrix<double> column_major =
+      Jacobian<3>(Chain(), x, &pool, kColumnMajor);
+
+  ASSERT_EQ(10, serial.rows());
+  ASSERT_EQ(11, serial.cols());
+  EXPECT_EQ(kRowMajor, parallel.layout());
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 11; ++j) {
+      EXPECT_DOUBLE_EQ(Expected(x, i, j), serial(i, j));
+      EXPECT_EQ(serial(i, j), parallel(i, j));
+      EXPECT_EQ(serial(i, j), column_major(i, j));
+      EXPECT_EQ(serial(i, j), parallel.data()[i * 11 + j]);
+      EXPECT_EQ(serial(i, j), column_major.data()[j * 10 + i]);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,39 @@
+// opcode.h
+//
+// The scalar operations the library knows about. They name the
+// instructions of a Program (see program.h) and the operation counters of
+// Stats (see stats.h).
+
+#ifndef OPCODE_H_
+#define OPCODE_H_
+
+namespace simple_differentiation {
+
+enum Opcode {
+  kInput,     // operands[0] is the input index.
+  kConstant,  // operands[0] is the constant index.
+  kAdd,
+  kSubtract,
+  kMultiply,
+  kDivide,
+  kNegate,
+  kSign,      // -1 for negative values, 1 otherwise.
+  kSin,
+  kCos,
+  kTan,
+  kAsin,
+  kAcos,
+  kAtan,
+  kFabs,
+  kSqrt,
+  kExp,
+  kLog,
+  kPow
+};
+
+// The number of opcodes, for tables indexed by opcode.
+const int kNumOpcodes = kPow + 1;
+
+}  // namespace simple_differentiation
+
+#endif  // OPCODE_H_
@@ -0,0 +1,210 @@
+// optimize.h
+//
+// Optimization of traced programs. Optimize returns an equivalent program
+// with
+//
+//   - constant subexpressions evaluated ahead of time, and the identities
+//     x + 0, x - 0, x * 1, x / 1 and -(-x) applied, with x * 0 taken to be
+//     0 as it is when tracing,
+//   - identical instructions shared, so that, for instance, the cos(x) that
+//     tan's derivative needs and a cos(x) in user code are computed once, and
+//   - instructions that no output depends on removed.
+//
+// Inputs are always kept, so the optimized program takes the same inputs.
+
+#ifndef OPTIMIZE_H_
+#define OPTIMIZE_H_
+
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "program.h"
+
+namespace simple_differentiation {
+
+namespace internal {
+
+// Builds a program in which no instruction or constant appears twice and no
+// instruction has only constant operands.
+template <class T>
+class ProgramBuilder {
+ public:
+  const Program<T>& program() const { return program_; }
+
+  int Input(int index) {
+    return Share(kInput, index, -1);
+  }
+
+  int Constant(const T& value) {
+    // Zeros of different signs compare equal but are not interchangeable.
+    bool negative_zero = value == T() && T(1) / value < T();
+    std::pair<T, bool> key(value, negative_zero);
+    // NaNs do not compare equal to themselves, so they are never shared.
+    if (value == value) {
+      typename std::map<std::pair<T, bool>, int>::const_iterator found =
+          constants_.find(key);
+      if (found != constants_.end()) {
+        return found->second;
+      }
+    }
+    int node = program_.AddConstant(value);
+    Record(node, true, value);
+    if (value == value) {
+      constants_[key] = node;
+    }
+    return node;
+  }
+
+  int Operation(Opcode opcode, int a, int b) {
+    bool binary = NumOperands(opcode) == 2;
+    if (is_constant_[a] && (!binary || is_constant_[b])) {
+      return Constant(Apply(opcode, values_[a], binary ? values_[b] : T()));
+    }
+    switch (opcode) {
+      case kAdd:
+        if (IsConstant(a, T(0))) return b;
+        if (IsConstant(b, T(0))) return a;
+        break;
+      case kSubtract:
+        if (IsConstant(b, T(0))) return a;
+        break;
+      case kMultiply:
+        if (IsConstant(a, T(0)) || IsConstant(b, T(0))) return Constant(T(0));
+        if (IsConstant(a, T(1))) return b;
+        if (IsConstant(b, T(1))) return a;
+        break;
+      case kDivide:
+        if (IsConstant(b, T(1))) return a;
+        break;
+      case kNegate:
+        if (program_.instruction(a).opcode == kNegate) {
+          return program_.instruction(a).operands[0];
+        }
+        break;
+      default:
+        break;
+    }
+    if ((opcode == kAdd || opcode == kMultiply) && b < a) {
+      std::swap(a, b);
+    }
+    return Share(opcode, a, b);
+  }
+
+  void Output(int node) { program_.AddOutput(node); }
+
+ private:
+  int Share(Opcode opcode, int a, int b) {
+    std::tuple<int, int, int> key(opcode, a, b);
+    std::map<std::tuple<int, int, int>, int>::const_iterator found =
+        instructions_.find(key);
+    if (found != instructions_.end()) {
+      return found->second;
+    }
+    int node = opcode == kInput ? program_.AddInput(a)
+                                : program_.AddInstruction(opcode, a, b);
+    Record(node, false, T());
+    instructions_[key] = node;
+    return node;
+  }
+
+  void Record(int node, bool is_constant, const T& value) {
+    is_constant_.resize(node + 1);
+    values_.resize(node + 1);
+    is_constant_[node] = is_constant;
+    values_[node] = value;
+  }
+
+  bool IsConstant(int node, const T& value) const {
+    return is_constant_[node] && values_[node] == value;
+  }
+
+  Program<T> program_;
+  std::vector<bool> is_constant_;
+  std::vector<T> values_;
+  std::map<std::pair<T, bool>, int> constants_;
+  std::map<std::tuple<int, int, int>, int> instructions_;
+};
+
+}  // namespace internal
+
+template <class T>
+Program<T> Optimize(const Program<T>& program) {
+  // Fold constants and share identical instructions.
+  internal::ProgramBuilder<T> builder;
+  std::vector<int> shared(program.size());
+  for (int i = 0; i < program.size(); ++i) {
+    const typename Program<T>::Instruction& instruction =
+        program.instruction(i);
+    const int a = instruction.operands[0];
+    const int b = instruction.operands[1];
+    switch (instruction.opcode) {
+      case kInput:
+        shared[i] = builder.Input(a);
+        break;
+      case kConstant:
+        shared[i] = builder.Constant(program.constant(a));
+        break;
+      default:
+        shared[i] = builder.Operation(instruction.opcode, shared[a],
+                                      NumOperands(instruction.opcode) == 2
+                                          ? shared[b] : -1);
+    }
+  }
+  for (int k = 0; k < program.num_outputs(); ++k) {
+    builder.Output(shared[program.output(k)]);
+  }
+
+  // Drop everything the outputs do not depend on.
+  const Program<T>& folded = builder.program();
+  std::vector<bool> live(folded.size(), false);
+  for (int k = 0; k < folded.num_outputs(); ++k) {
+    live[folded.output(k)] = true;
+  }
+  for (int i = folded.size() - 1; i >= 0; --i) {
+    const typename Program<T>::Instruction& instruction =
+        folded.instruction(i);
+    if (instruction.opcode == kInput) {
+      live[i] = true;
+    }
+    if (!live[i]) {
+      continue;
+    }
+    for (int k = 0; k < NumOperands(instruction.opcode); ++k) {
+      live[instruction.operands[k]] = true;
+    }
+  }
+
+  Program<T> result;
+  std::vector<int> renumbered(folded.size(), -1);
+  for (int i = 0; i < folded.size(); ++i) {
+    if (!live[i]) {
+      continue;
+    }
+    const typename Program<T>::Instruction& instruction =
+        folded.instruction(i);
+    const int a = instruction.operands[0];
+    const int b = instruction.operands[1];
+    switch (instruction.opcode) {
+      case kInput:
+        renumbered[i] = result.AddInput(a);
+        break;
+      case kConstant:
+        renumbered[i] = result.AddConstant(folded.constant(a));
+        break;
+      default:
+        renumbered[i] = result.AddInstruction(
+            instruction.opcode, renumbered[a],
+            NumOperands(instruction.opcode) == 2 ? renumbered[b] : -1);
+    }
+  }
+  for (int k = 0; k < folded.num_outputs(); ++k) {
+    result.AddOutput(renumbered[folded.output(k)]);
+  }
+  return result;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // OPTIMIZE_H_
@@ -0,0 +1,107 @@
+
+#include "optimize.h"
+#include "trace.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::Optimize;
+using simple_differentiation::Program;
+using simple_differentiation::TraceGradient;
+using simple_differentiation::kAdd;
+using simple_differentiation::kConstant;
+using simple_differentiation::kCos;
+using simple_differentiation::kInput;
+using simple_differentiation::kMultiply;
+using simple_differentiation::kSin;
+
+// Counts the instructions that do arithmetic.
+template <class T>
+int CountOperations(const Program<T>& program) {
+  int count = 0;
+  for (int i = 0; i < program.size(); ++i) {
+    if (program.instruction(i).opcode != kInput &&
+        program.instruction(i).opcode != kConstant) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+// Uses cos(x) directly and through tan's derivative, and x*x directly and
+// through atan's.
+struct Objective {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    Variable sum = x[0] * 0.0;
+    for (std::size_t i = 0; i < x.size(); ++i) {
+      sum += tan(x[i]) * cos(x[i]) + atan(x[i]) + x[i] * x[i];
+      sum += (x[i] + 2.0) * 3.0 + sin(x[i]) * 1.0;
+    }
+    return sum;
+  }
+};
+
+TEST(OptimizeTest, FoldsSharesAndDrops) {
+  Program<double> program;
+  int x = program.AddInput(0);
+  int two = program.AddConstant(2.0);
+  int three = program.AddInstruction(kAdd, program.AddConstant(1.0), two);
+  int sin_x = program.AddInstruction(kSin, x);
+  int sin_x_again = program.AddInstruction(kSin, x);
+  program.AddInstruction(kCos, x);  // Dead.
+  int product = program.AddInstruction(kMultiply, sin_x, three);
+  int product_again = program.AddInstruction(kMultiply, three, sin_x_again);
+  program.AddOutput(program.AddInstruction(kAdd, product, product_again));
+  int one = program.AddConstant(1.0);
+  program.AddOutput(program.AddInstruction(kMultiply, x, one));
+
+  Program<double> optimized = Optimize(program);
+  // x, 3, sin(x), sin(x)*3 and the sum.
+  EXPECT_EQ(5, optimized.size());
+  EXPECT_EQ(1, optimized.num_constants());
+  EXPECT_EQ(3.0, optimized.constant(0));
+  EXPECT_EQ(1, optimized.num_inputs());
+  EXPECT_EQ(kInput, optimized.instruction(optimized.output(1)).opcode);
+
+  double input = 0.4;
+  double expected[2];
+  double actual[2];
+  std::vector<double> values;
+  program.Run(&input, expected, &values);
+  optimized.Run(&input, actual, &values);
+  EXPECT_EQ(expected[0], actual[0]);
+  EXPECT_EQ(expected[1], actual[1]);
+}
+
+TEST(OptimizeTest, TracedGradientDoesLessArithmetic) {
+  std::vector<double> x = {0.3, -0.5, 1.1, 0.2};
+  Program<double> traced = TraceGradient(Objective(), x);
+  Program<double> optimized = Optimize(traced);
+  EXPECT_LT(CountOperations(optimized), CountOperations(traced));
+  EXPECT_LT(optimized.size(), traced.size());
+
+  // Optimizing again finds nothing more to do.
+  EXPECT_EQ(optimized.size(), Optimize(optimized).size());
+
+  std::vector<double> point = {-0.7, 0.1, 0.4, 1.3};
+  std::vector<double> expected(traced.num_outputs());
+  std::vector<double> actual(optimized.num_outputs());
+  std::vector<double> values;
+  traced.Run(point.data(), expected.data(), &values);
+  optimized.Run(point.data(), actual.data(), &values);
+  for (std::size_t k = 0; k < expected.size(); ++k) {
+    EXPECT_DOUBLE_EQ(expected[k], actual[k]);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
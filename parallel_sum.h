@@ -0,0 +1,174 @@
+// parallel_sum.h
+//
+// Sums of many differentiable terms, evaluated on a thread pool:
+//
+//   ThreadPool pool;
+//   DifferentiationVariable<double> loss = ParallelSum(
+//       context, num_residuals,
+//       [&](int i) { return Square(Residual(x, i)); }, &pool);
+//
+// Adding terms one by one to a single DifferentiationVariable runs on one
+// core and updates one dense gradient. Here the terms are split into
+// contiguous chunks, each thread adds its chunks into an accumulator of its
+// own, and the accumulators are merged pairwise, in parallel, by a binary
+// tree. Merging costs O(log(num_threads)) gradient additions on the
+// critical path, so the sum scales with the number of threads once each
+// has many terms to add.
+//
+// Floating-point addition is not associative, so by default the result can
+// change in the last bits from run to run, depending on which thread takes
+// which chunk. With ParallelReduceOptions::deterministic the chunks and the
+// order in which they are added are fixed, so the result depends only on
+// num_chunks, not on the pool or on scheduling.
+//
+// ParallelMapReduce is the same reduction over any type with a fold.
+//
+// Terms are evaluated concurrently, so they must only read shared inputs.
+// In particular they cannot record onto a tape, which is not thread safe,
+// or take gradients from a shared GradientPool.
+
+#ifndef PARALLEL_SUM_H_
+#define PARALLEL_SUM_H_
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "differentiation.h"
+#include "thread_pool.h"
+
+namespace simple_differentiation {
+
+struct ParallelReduceOptions {
+  ParallelReduceOptions() : deterministic(false), num_chunks(256) { }
+
+  // Whether to add items in a fixed order, at the cost of keeping one
+  // accumulator per chunk rather than one per thread.
+  bool deterministic;
+  // The number of contiguous chunks the items are split into. More chunks
+  // balance uneven items better, but each chunk costs a little scheduling.
+  int num_chunks;
+};
+
+namespace internal {
+
+// Runs task(i) for every i in [0, num_tasks), on the pool if there is one.
+template <class F>
+void RunTasks(ThreadPool* pool, int num_tasks, const F& task) {
+  if (pool == NULL) {
+    for (int i = 0; i < num_tasks; ++i) {
+      task(i);
+    }
+  } else {
+    pool->ParallelFor(num_tasks, task);
+  }
+}
+
+// Folds items [chunk * num_items / num_chunks, (chunk + 1) * num_items /
+// num_chunks) into *accumulator, in order.
+template <class R, class Map, class Reduce>
+void FoldChunk(int chunk, int num_chunks, int num_items, const Map& map,
+               const Reduce& reduce, R* accumulator) {
+  long begin = static_cast<long>(chunk) * num_items / num_chunks;
+  long end = static_cast<long>(chunk + 1) * num_items / num_chunks;
+  for (long i = begin; i < end; ++i) {
+    reduce(accumulator, map(static_cast<int>(i)));
+  }
+}
+
+// Folds (*partials)[i + stride] into (*partials)[i] for every i that is a
+// multiple of 2 * stride, doubling stride until (*partials)[0] holds
+// everything.
+template <class R, class Reduce>
+void ReduceTree(const Reduce& reduce, ThreadPool* pool,
+                std::vector<R>* partials) {
+  int size = static_cast<int>(partials->size());
+  for (int stride = 1; stride < size; stride *= 2) {
+    int num_pairs = (size - stride + 2 * stride - 1) / (2 * stride);
+    RunTasks(pool, num_pairs, [&reduce, partials, stride](int pair) {
+      int i = 2 * stride * pair;
+      reduce(&(*partials)[i], (*partials)[i + stride]);
+    });
+  }
+}
+
+}  // namespace internal
+
+// Returns identity folded with map(i) for every i in [0, num_items), where
+// reduce(&accumulator, value) folds value into accumulator. reduce must be
+// associative and identity must be its identity. Unless the reduction is
+// deterministic, reduce must also be commutative, since each thread folds
+// whichever chunks it claims. map and reduce are called concurrently from
+// the pool's threads.
+template <class R, class Map, class Reduce>
+R ParallelMapReduce(int num_items,
+                    const R& identity,
+                    const Map& map,
+                    const Reduce& reduce,
+                    ThreadPool* pool = NULL,
+                    const ParallelReduceOptions& options =
+                        ParallelReduceOptions()) {
+  int num_chunks = options.num_chunks < num_items ? options.num_chunks
+                                                  : num_items;
+  if (num_chunks < 1) {
+    return identity;
+  }
+
+  std::vector<R> partials;
+  if (options.deterministic) {
+    partials.assign(num_chunks, identity);
+    internal::RunTasks(pool, num_chunks, [&](int chunk) {
+      // Accumulate locally so that threads do not write to neighbouring
+      // partials, which may share cache lines, on every item.
+      R accumulator(identity);
+      internal::FoldChunk(chunk, num_chunks, num_items, map, reduce,
+                          &accumulator);
+      partials[chunk] = std::move(accumulator);
+    });
+  } else {
+    // Each task takes the next chunk until none are left, so a thread that
+    // is held up takes fewer chunks instead of delaying the rest.
+    int num_tasks = pool == NULL ? 1 : pool->num_threads();
+    if (num_tasks > num_chunks) {
+      num_tasks = num_chunks;
+    }
+    partials.assign(num_tasks, identity);
+    std::atomic<int> next_chunk(0);
+    internal::RunTasks(pool, num_tasks, [&](int task) {
+      R accumulator(identity);
+      for (;;) {
+        int chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= num_chunks) {
+          break;
+        }
+        internal::FoldChunk(chunk, num_chunks, num_items, map, reduce,
+                            &accumulator);
+      }
+      partials[task] = std::move(accumulator);
+    });
+  }
+  internal::ReduceTree(reduce, pool, &partials);
+  return partials[0];
+}
+
+// Returns the sum of term(i) for every i in [0, num_terms), where term
+// returns a DifferentiationVariable<T, V>. context provides the zero that
+// each accumulator starts from; it is not otherwise used, and V must not
+// be TapeGradient<T>.
+template <class T, class V, class Term>
+DifferentiationVariable<T, V> ParallelSum(
+    const DifferentiationContext<T, V>& context,
+    int num_terms,
+    const Term& term,
+    ThreadPool* pool = NULL,
+    const ParallelReduceOptions& options = ParallelReduceOptions()) {
+  typedef DifferentiationVariable<T, V> Variable;
+  return ParallelMapReduce(
+      num_terms, context.MakeConstant(T()), term,
+      [](Variable* sum, const Variable& value) { *sum += value; }, pool,
+      options);
+}
+
+}  // namespace simple_differentiation
+
+#endif  // PARALLEL_SUM_H_
@@ -0,0 +1,129 @@
+#include "parallel_sum.h"
+#include "differentiation.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::ParallelMapReduce;
+using simple_differentiation::ParallelReduceOptions;
+using simple_differentiation::ParallelSum;
+using simple_differentiation::ThreadPool;
+
+typedef DifferentiationVariable<double> Variable;
+
+const int kNumVars = 8;
+const int kNumTerms = 5000;
+
+class ParallelSumTest : public ::testing::Test {
+ protected:
+  ParallelSumTest() : context_(kNumVars) {
+    for (int i = 0; i < kNumVars; ++i) {
+      x_.push_back(context_.MakeVariable(i, 0.1 * i - 0.3));
+    }
+  }
+
+  // A residual that reads two of the shared inputs.
+  Variable Term(int i) const {
+    const Variable& a = x_[i % kNumVars];
+    const Variable& b = x_[(i * 7 + 3) % kNumVars];
+    Variable residual = a * sin(b + 0.001 * i) - cos(0.01 * i);
+    return residual * residual;
+  }
+
+  DifferentiationContext<double> context_;
+  std::vector<Variable> x_;
+};
+
+TEST_F(ParallelSumTest, MatchesSerialSum) {
+  Variable expected = context_.MakeConstant(0.0);
+  for (int i = 0; i < kNumTerms; ++i) {
+    expected += Term(i);
+  }
+
+  ThreadPool pool(4);
+  auto term = [this](int i) { return Term(i); };
+  Variable sum = ParallelSum(context_, kNumTerms, term, &pool);
+  EXPECT_NEAR(expected.value(), sum.value(), 1e-9);
+  ASSERT_EQ(kNumVars, sum.gradient().size());
+  for (int i = 0; i < kNumVars; ++i) {
+    EXPECT_NEAR(expected.gradient()[i], sum.gradient()[i], 1e-9);
+  }
+
+  Variable serial = ParallelSum(context_, kNumTerms, term);
+  EXPECT_NEAR(expected.value(), serial.value(), 1e-9);
+}
+
+TEST_F(ParallelSumTest, DeterministicSumsDoNotDependOnThePool) {
+  ParallelReduceOptions options;
+  options.deterministic = true;
+  options.num_chunks = 37;
+  auto term = [this](int i) { return Term(i); };
+  Variable expected = ParallelSum(context_, kNumTerms, term, NULL, options);
+
+  for (int num_threads = 1; num_threads <= 4; ++num_threads) {
+    ThreadPool pool(num_threads);
+    for (int repeat = 0; repeat < 3; ++repeat) {
+      Variable sum = ParallelSum(context_, kNumTerms, term, &pool, options);
+      EXPECT_EQ(expected.value(), sum.value());
+      for (int i = 0; i < kNumVars; ++i) {
+        EXPECT_EQ(expected.gradient()[i], sum.gradient()[i]);
+      }
+    }
+  }
+}
+
+TEST_F(ParallelSumTest, EmptySumIsZero) {
+  ThreadPool pool(2);
+  Variable sum = ParallelSum(context_, 0, [this](int i) { return Term(i); },
+                             &pool);
+  EXPECT_EQ(0.0, sum.value());
+  ASSERT_EQ(kNumVars, sum.gradient().size());
+  for (int i = 0; i < kNumVars; ++i) {
+    EXPECT_EQ(0.0, sum.gradient()[i]);
+  }
+}
+
+TEST(ParallelMapReduceTest, DeterministicReductionKeepsOrder) {
+  // Concatenation is associative but not commutative.
+  ParallelReduceOptions options;
+  options.deterministic = true;
+  options.num_chunks = 5;
+  ThreadPool pool(3);
+  std::string letters = ParallelMapReduce(
+      23, std::string(),
+      [](int i) { return std::string(1, static_cast<char>('a' + i)); },
+      [](std::string* lhs, const std::string& rhs) { *lhs += rhs; }, &pool,
+      options);
+  EXPECT_EQ("abcdefghijklmnopqrstuvw", letters);
+}
+
+TEST(ParallelMapReduceTest, CommutativeReductions) {
+  ThreadPool pool(4);
+  ParallelReduceOptions options;
+  options.num_chunks = 64;
+  long sum = ParallelMapReduce(
+      100000, 0L, [](int i) { return static_cast<long>(i); },
+      [](long* lhs, long rhs) { *lhs += rhs; }, &pool, options);
+  EXPECT_EQ(100000L * 99999 / 2, sum);
+
+  double largest = ParallelMapReduce(
+      1000, -HUGE_VAL, [](int i) { return std::sin(0.1 * i); },
+      [](double* lhs, double rhs) { *lhs = std::fmax(*lhs, rhs); }, &pool);
+  EXPECT_GT(largest, 0.9999);
+  EXPECT_LE(largest, 1.0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,186 @@
+// program.h
+//
+// A straight-line program over scalars, stored as a flat instruction array.
+// Instruction i computes value i from the program's inputs, its constants
+// and earlier values, so one forward loop over a single buffer evaluates
+// the whole program. Programs are produced by tracing (see trace.h) and can
+// be run any number of times on new inputs.
+
+#ifndef PROGRAM_H_
+#define PROGRAM_H_
+
+#include <cmath>
+#include <vector>
+
+#include "opcode.h"
+
+namespace simple_differentiation {
+
+// Returns the number of value operands read by an instruction.
+inline int NumOperands(Opcode opcode) {
+  switch (opcode) {
+    case kInput:
+    case kConstant:
+      return 0;
+    case kAdd:
+    case kSubtract:
+    case kMultiply:
+    case kDivide:
+    case kPow:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// Applies a value instruction to its operand values. b is ignored by unary
+// instructions, and kInput and kConstant yield T().
+template <class T>
+T Apply(Opcode opcode, const T& a, const T& b) {
+  using std::acos;
+  using std::asin;
+  using std::atan;
+  using std::cos;
+  using std::exp;
+  using std::fabs;
+  using std::log;
+  using std::pow;
+  using std::sin;
+  using std::sqrt;
+  using std::tan;
+
+  switch (opcode) {
+    case kAdd: return a + b;
+    case kSubtract: return a - b;
+    case kMultiply: return a * b;
+    case kDivide: return a / b;
+    case kNegate: return -a;
+    case kSign: return a < T() ? T(-1) : T(1);
+    case kSin: return sin(a);
+    case kCos: return cos(a);
+    case kTan: return tan(a);
+    case kAsin: return asin(a);
+    case kAcos: return acos(a);
+    case kAtan: return atan(a);
+    case kFabs: return fabs(a);
+    case kSqrt: return sqrt(a);
+    case kExp: return exp(a);
+    case kLog: return log(a);
+    case kPow: return pow(a, b);
+    default: return T();
+  }
+}
+
+template <class T>
+class Program {
+ public:
+  struct Instruction {
+    Opcode opcode;
+    int operands[2];
+  };
+
+  Program() : num_inputs_(0) { }
+
+  int AddInput(int index) {
+    if (index >= num_inputs_) {
+      num_inputs_ = index + 1;
+    }
+    return Add(kInput, index, -1);
+  }
+
+  int AddConstant(const T& value) {
+    constants_.push_back(value);
+    return Add(kConstant, static_cast<int>(constants_.size()) - 1, -1);
+  }
+
+  int AddInstruction(Opcode opcode, int operand0, int operand1 = -1) {
+    return Add(opcode, operand0, operand1);
+  }
+
+  // Marks a value as the next output of the program.
+  void AddOutput(int value) { outputs_.push_back(value); }
+
+  int size() const { return static_cast<int>(instructions_.size()); }
+  int num_inputs() const { return num_inputs_; }
+  int num_outputs() const { return static_cast<int>(outputs_.size()); }
+
+  const Instruction& instruction(int i) const { return instructions_[i]; }
+  const T& constant(int k) const { return constants_[k]; }
+  int num_constants() const { return static_cast<int>(constants_.size()); }
+  int output(int k) const { return outputs_[k]; }
+
+  // Evaluates the program. values is scratch space for every intermediate
+  // value; it is resized as needed and can be reused across calls to avoid
+  // allocation.
+  void Run(const T* inputs, T* outputs, std::vector<T>* values) const;
+
+ private:
+  int Add(Opcode opcode, int operand0, int operand1) {
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.operands[0] = operand0;
+    instruction.operands[1] = operand1;
+    instructions_.push_back(instruction);
+    return static_cast<int>(instructions_.size()) - 1;
+  }
+
+  int num_inputs_;
+  std::vector<Instruction> instructions_;
+  std::vector<T> constants_;
+  std::vector<int> outputs_;
+};
+
+template <class T>
+void Program<T>::Run(const T* inputs,
+                     T* outputs,
+                     std::vector<T>* values) const {
+  using std::acos;
+  using std::asin;
+  using std::atan;
+  using std::cos;
+  using std::exp;
+  using std::fabs;
+  using std::log;
+  using std::pow;
+  using std::sin;
+  using std::sqrt;
+  using std::tan;
+
+  // This is the replay loop, so it spells out every case rather than
+  // calling Apply.
+  values->resize(instructions_.size());
+  T* v = values->data();
+  const Instruction* instruction = instructions_.data();
+  for (int i = 0; i < size(); ++i, ++instruction) {
+    const int a = instruction->operands[0];
+    const int b = instruction->operands[1];
+    switch (instruction->opcode) {
+      case kInput: v[i] = inputs[a]; break;
+      case kConstant: v[i] = constants_[a]; break;
+      case kAdd: v[i] = v[a] + v[b]; break;
+      case kSubtract: v[i] = v[a] - v[b]; break;
+      case kMultiply: v[i] = v[a] * v[b]; break;
+      case kDivide: v[i] = v[a] / v[b]; break;
+      case kNegate: v[i] = -v[a]; break;
+      case kSign: v[i] = v[a] < T() ? T(-1) : T(1); break;
+      case kSin: v[i] = sin(v[a]); break;
+      case kCos: v[i] = cos(v[a]); break;
+      case kTan: v[i] = tan(v[a]); break;
+      case kAsin: v[i] = asin(v[a]); break;
+      case kAcos: v[i] = acos(v[a]); break;
+      case kAtan: v[i] = atan(v[a]); break;
+      case kFabs: v[i] = fabs(v[a]); break;
+      case kSqrt: v[i] = sqrt(v[a]); break;
+      case kExp: v[i] = exp(v[a]); break;
+      case kLog: v[i] = log(v[a]); break;
+      case kPow: v[i] = pow(v[a], v[b]); break;
+    }
+  }
+  for (int k = 0; k < num_outputs(); ++k) {
+    outputs[k] = v[outputs_[k]];
+  }
+}
+
+}  // namespace simple_differentiation
+
+#endif  // PROGRAM_H_
@@ -0,0 +1,220 @@
+// sparse_jacobian.h
+//
+// Jacobians that are mostly zeros. Functions are written as for jacobian.h.
+// The computation runs in three steps, the first two of which can be reused
+// for as long as the structure of the function does not change:
+//
+//   SparsityPattern pattern = DetectSparsity(f, x);
+//   std::vector<int> colors;
+//   int num_colors = ColorColumns(pattern, &colors);
+//   CsrMatrix<double> jacobian = SparseJacobian(f, x, pattern, colors,
+//                                               num_colors);
+//
+// Columns that never share a row get the same color, and all the inputs of
+// one color are seeded in the same gradient direction. A single evaluation
+// with num_colors gradient entries then recovers every nonzero, where a
+// dense evaluation would need one entry per input.
+
+#ifndef SPARSE_JACOBIAN_H_
+#define SPARSE_JACOBIAN_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include "differentiation.h"
+#include "index_set.h"
+
+namespace simple_differentiation {
+
+// The positions of the nonzeros of a matrix in compressed sparse row form.
+// Column indices are sorted within each row.
+class SparsityPattern {
+ public:
+  explicit SparsityPattern(int cols) : cols_(cols), row_offsets_(1, 0) { }
+
+  // Appends a row with nonzeros in the given sorted columns.
+  template <class Index>
+  void AddRow(const std::vector<Index>& columns) {
+    for (std::size_t k = 0; k < columns.size(); ++k) {
+      column_indices_.push_back(static_cast<int>(columns[k]));
+    }
+    row_offsets_.push_back(static_cast<int>(column_indices_.size()));
+  }
+
+  int rows() const { return static_cast<int>(row_offsets_.size()) - 1; }
+  int cols() const { return cols_; }
+  int nonzeros() const { return static_cast<int>(column_indices_.size()); }
+
+  // The nonzeros of row i are column_indices()[row_offsets()[i]] up to but
+  // not including column_indices()[row_offsets()[i + 1]].
+  const std::vector<int>& row_offsets() const { return row_offsets_; }
+  const std::vector<int>& column_indices() const { return column_indices_; }
+
+ private:
+  int cols_;
+  std::vector<int> row_offsets_;
+  std::vector<int> column_indices_;
+};
+
+// A sparse matrix in compressed sparse row form.
+template <class T>
+class CsrMatrix {
+ public:
+  explicit CsrMatrix(const SparsityPattern& pattern)
+      : pattern_(pattern), values_(pattern.nonzeros()) { }
+
+  int rows() const { return pattern_.rows(); }
+  int cols() const { return pattern_.cols(); }
+  int nonzeros() const { return pattern_.nonzeros(); }
+
+  const SparsityPattern& pattern() const { return pattern_; }
+  const std::vector<int>& row_offsets() const {
+    return pattern_.row_offsets();
+  }
+  const std::vector<int>& column_indices() const {
+    return pattern_.column_indices();
+  }
+  std::vector<T>& values() { return values_; }
+  const std::vector<T>& values() const { return values_; }
+
+  // Returns element (i, j), which is zero if it is not in the pattern.
+  T operator()(int i, int j) const {
+    const std::vector<int>& columns = pattern_.column_indices();
+    std::vector<int>::const_iterator begin =
+        columns.begin() + pattern_.row_offsets()[i];
+    std::vector<int>::const_iterator end =
+        columns.begin() + pattern_.row_offsets()[i + 1];
+    std::vector<int>::const_iterator position =
+        std::lower_bound(begin, end, j);
+    if (position == end || *position != j) {
+      return T();
+    }
+    return values_[position - columns.begin()];
+  }
+
+ private:
+  SparsityPattern pattern_;
+  std::vector<T> values_;
+};
+
+// Returns the structural sparsity pattern of the Jacobian of f at x. The
+// pattern only covers the branches f takes at x.
+template <class T, class F>
+SparsityPattern DetectSparsity(const F& f, const std::vector<T>& x) {
+  typedef DifferentiationVariable<T, IndexSet<T> > Variable;
+  int num_inputs = static_cast<int>(x.size());
+  DifferentiationContext<T, IndexSet<T> > context(num_inputs);
+  std::vector<Variable> inputs;
+  inputs.reserve(num_inputs);
+  for (int j = 0; j < num_inputs; ++j) {
+    inputs.push_back(context.MakeVariable(j, x[j]));
+  }
+  std::vector<Variable> outputs;
+  f(inputs, &outputs);
+
+  SparsityPattern pattern(num_inputs);
+  for (std::size_t i = 0; i < outputs.size(); ++i) {
+    pattern.AddRow(outputs[i].gradient().indices());
+  }
+  return pattern;
+}
+
+// Greedily colors the columns of pattern so that no two columns with a
+// nonzero in the same row share a color. Stores each column's color in
+// *colors and returns the number of colors used.
+inline int ColorColumns(const SparsityPattern& pattern,
+                        std::vector<int>* colors) {
+  const std::vector<int>& row_offsets = pattern.row_offsets();
+  const std::vector<int>& column_indices = pattern.column_indices();
+
+  // The rows touching each column, in compressed sparse column form.
+  std::vector<int> column_offsets(pattern.cols() + 1, 0);
+  for (int k = 0; k < pattern.nonzeros(); ++k) {
+    ++column_offsets[column_indices[k] + 1];
+  }
+  for (int j = 0; j < pattern.cols(); ++j) {
+    column_offsets[j + 1] += column_offsets[j];
+  }
+  std::vector<int> row_indices(pattern.nonzeros());
+  std::vector<int> next(column_offsets.begin(), column_offsets.end() - 1);
+  for (int i = 0; i < pattern.rows(); ++i) {
+    for (int k = row_offsets[i]; k < row_offsets[i + 1]; ++k) {
+      row_indices[next[column_indices[k]]++] = i;
+    }
+  }
+
+  // forbidden[c] == j marks color c as taken by a neighbor of column j.
+  colors->assign(pattern.cols(), -1);
+  std::vector<int> forbidden;
+  int num_colors = 0;
+  for (int j = 0; j < pattern.cols(); ++j) {
+    for (int r = column_offsets[j]; r < column_offsets[j + 1]; ++r) {
+      int i = row_indices[r];
+      for (int k = row_offsets[i]; k < row_offsets[i + 1]; ++k) {
+        int color = (*colors)[column_indices[k]];
+        if (color >= 0) {
+          forbidden[color] = j;
+        }
+      }
+    }
+    int color = 0;
+    while (color < num_colors && forbidden[color] == j) {
+      ++color;
+    }
+    if (color == num_colors) {
+      forbidden.push_back(-1);
+      ++num_colors;
+    }
+    (*colors)[j] = color;
+  }
+  return num_colors;
+}
+
+// Returns the Jacobian of f at x with the given pattern, evaluated with one
+// gradient entry per color.
+template <class T, class F>
+CsrMatrix<T> SparseJacobian(const F& f,
+                            const std::vector<T>& x,
+                            const SparsityPattern& pattern,
+                            const std::vector<int>& colors,
+                            int num_colors) {
+  typedef DifferentiationVariable<T> Variable;
+  int num_inputs = static_cast<int>(x.size());
+  assert(num_inputs == pattern.cols());
+
+  // Every input of a color shares that color's seed direction.
+  DifferentiationContext<T> context(num_colors);
+  std::vector<Variable> inputs;
+  inputs.reserve(num_inputs);
+  for (int j = 0; j < num_inputs; ++j) {
+    inputs.push_back(context.MakeVariable(colors[j], x[j]));
+  }
+  std::vector<Variable> outputs;
+  f(inputs, &outputs);
+  assert(static_cast<int>(outputs.size()) == pattern.rows());
+
+  CsrMatrix<T> jacobian(pattern);
+  const std::vector<int>& row_offsets = pattern.row_offsets();
+  const std::vector<int>& column_indices = pattern.column_indices();
+  for (int i = 0; i < pattern.rows(); ++i) {
+    for (int k = row_offsets[i]; k < row_offsets[i + 1]; ++k) {
+      jacobian.values()[k] = outputs[i].gradient()[colors[column_indices[k]]];
+    }
+  }
+  return jacobian;
+}
+
+// Detects the pattern, colors it and evaluates the Jacobian in one call.
+template <class T, class F>
+CsrMatrix<T> SparseJacobian(const F& f, const std::vector<T>& x) {
+  SparsityPattern pattern = DetectSparsity(f, x);
+  std::vector<int> colors;
+  int num_colors = ColorColumns(pattern, &colors);
+  return SparseJacobian(f, x, pattern, colors, num_colors);
+}
+
+}  // namespace simple_differentiation
+
+#endif  // SPARSE_JACOBIAN_H_
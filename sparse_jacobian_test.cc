@@ -0,0 +1,100 @@
+
+#include "sparse_jacobian.h"
+#include "differentiation.h"
+#include "jacobian.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::ColorColumns;
+using simple_differentiation::CsrMatrix;
+using simple_differentiation::DenseMatrix;
+using simple_differentiation::DetectSparsity;
+using simple_differentiation::IndexSet;
+using simple_differentiation::Jacobian;
+using simple_differentiation::SparseJacobian;
+using simple_differentiation::SparsityPattern;
+
+// A discretized 1D Laplacian with a nonlinear term, plus a row that reads
+// the two ends.
+struct Banded {
+  template <class Variable>
+  void operator()(const std::vector<Variable>& x,
+                  std::vector<Variable>* y) const {
+    int n = static_cast<int>(x.size());
+    for (int i = 1; i + 1 < n; ++i) {
+      y->push_back(x[i - 1] - 2.0 * x[i] + x[i + 1] + exp(x[i]) / 4.0);
+    }
+    y->push_back(x[0] * x[n - 1]);
+  }
+};
+
+TEST(SparseJacobianTest, IndexSet) {
+  IndexSet<double> a(10);
+  a[7] = 1.0;
+  a[2] = 1.0;
+  IndexSet<double> b(10);
+  b[3] = 1.0;
+  b[7] = 1.0;
+
+  IndexSet<double> c = 2.0 * a - b / 3.0;
+  ASSERT_EQ(3, c.nonzeros());
+  EXPECT_EQ(2, c.index(0));
+  EXPECT_EQ(3, c.index(1));
+  EXPECT_EQ(7, c.index(2));
+  EXPECT_EQ(10, c.size());
+}
+
+TEST(SparseJacobianTest, PatternAndColoring) {
+  std::vector<double> x(50, 0.5);
+  SparsityPattern pattern = DetectSparsity(Banded(), x);
+  ASSERT_EQ(49, pattern.rows());
+  EXPECT_EQ(50, pattern.cols());
+  EXPECT_EQ(48 * 3 + 2, pattern.nonzeros());
+  EXPECT_EQ(3, pattern.row_offsets()[1]);
+  EXPECT_EQ(0, pattern.column_indices()[0]);
+  EXPECT_EQ(49, pattern.column_indices()[pattern.nonzeros() - 1]);
+
+  std::vector<int> colors;
+  int num_colors = ColorColumns(pattern, &colors);
+  EXPECT_LE(num_colors, 4);
+
+  // No two columns in a row may share a color.
+  for (int i = 0; i < pattern.rows(); ++i) {
+    for (int k = pattern.row_offsets()[i];
+         k < pattern.row_offsets()[i + 1]; ++k) {
+      for (int l = k + 1; l < pattern.row_offsets()[i + 1]; ++l) {
+        EXPECT_NE(colors[pattern.column_indices()[k]],
+                  colors[pattern.column_indices()[l]]);
+      }
+    }
+  }
+}
+
+TEST(SparseJacobianTest, MatchesDense) {
+  std::vector<double> x;
+  for (int j = 0; j < 40; ++j) {
+    x.push_back(sin(0.3 * j));
+  }
+  CsrMatrix<double> sparse = SparseJacobian(Banded(), x);
+  DenseMatrix<double> dense = Jacobian(Banded(), x);
+
+  ASSERT_EQ(dense.rows(), sparse.rows());
+  ASSERT_EQ(dense.cols(), sparse.cols());
+  for (int i = 0; i < dense.rows(); ++i) {
+    for (int j = 0; j < dense.cols(); ++j) {
+      EXPECT_DOUBLE_EQ(dense(i, j), sparse(i, j));
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
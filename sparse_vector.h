@@ -0,0 +1,174 @@
+// sparse_vector.h
+//
+// A sparse vector stored as sorted (index, value) pairs, for use as the
+// gradient type of a DifferentiationVariable when there are many variables
+// but each intermediate value depends on only a few of them:
+//
+//   DifferentiationContext<double, SparseVector<double> > context(100000);
+//
+// Memory and time then scale with the number of dependencies rather than
+// with the number of variables. Entries are never dropped when they become
+// zero through cancellation, so the stored indices are exactly the
+// structural dependencies of a value.
+
+#ifndef SPARSE_VECTOR_H_
+#define SPARSE_VECTOR_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace simple_differentiation {
+
+template <class T>
+class SparseVector {
+ public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+
+  SparseVector() : size_(0) { }
+
+  // Creates an all-zero vector of logical size n. The value argument exists
+  // for compatibility with the dense vector types and must be zero.
+  explicit SparseVector(size_type n, const T& value = T()) : size_(n) {
+    (void)value;
+  }
+
+  // The logical size, not the number of stored entries.
+  size_type size() const { return size_; }
+
+  size_type nonzeros() const { return indices_.size(); }
+  size_type index(size_type k) const { return indices_[k]; }
+  const T& value(size_type k) const { return values_[k]; }
+
+  // Returns a reference to element i, inserting a zero entry if needed.
+  T& operator[](size_type i) {
+    typename std::vector<size_type>::iterator position =
+        std::lower_bound(indices_.begin(), indices_.end(), i);
+    size_type k = position - indices_.begin();
+    if (position == indices_.end() || *position != i) {
+      indices_.insert(position, i);
+      values_.insert(values_.begin() + k, T());
+    }
+    return values_[k];
+  }
+
+  T operator[](size_type i) const {
+    typename std::vector<size_type>::const_iterator position =
+        std::lower_bound(indices_.begin(), indices_.end(), i);
+    if (position == indices_.end() || *position != i) {
+      return T();
+    }
+    return values_[position - indices_.begin()];
+  }
+
+  SparseVector operator-() const {
+    SparseVector result(*this);
+    for (size_type k = 0; k < result.values_.size(); ++k) {
+      result.values_[k] = -result.values_[k];
+    }
+    return result;
+  }
+
+  SparseVector& operator+=(const SparseVector& rhs) {
+    return Merge(rhs, T(1));
+  }
+
+  SparseVector& operator-=(const SparseVector& rhs) {
+    return Merge(rhs, T(-1));
+  }
+
+  template <class U>
+  SparseVector& operator*=(const U& rhs) {
+    for (size_type k = 0; k < values_.size(); ++k) {
+      values_[k] *= rhs;
+    }
+    return *this;
+  }
+
+  template <class U>
+  SparseVector& operator/=(const U& rhs) {
+    for (size_type k = 0; k < values_.size(); ++k) {
+      values_[k] /= rhs;
+    }
+    return *this;
+  }
+
+  SparseVector operator+(const SparseVector& rhs) const {
+    SparseVector result(*this);
+    result += rhs;
+    return result;
+  }
+
+  SparseVector operator-(const SparseVector& rhs) const {
+    SparseVector result(*this);
+    result -= rhs;
+    return result;
+  }
+
+  template <class U>
+  SparseVector operator*(const U& rhs) const {
+    SparseVector result(*this);
+    result *= rhs;
+    return result;
+  }
+
+  template <class U>
+  SparseVector operator/(const U& rhs) const {
+    SparseVector result(*this);
+    result /= rhs;
+    return result;
+  }
+
+ private:
+  // Sets *this to *this + sign*rhs, merging the two index lists.
+  SparseVector& Merge(const SparseVector& rhs, const T& sign) {
+    if (rhs.indices_.empty()) {
+      return *this;
+    }
+
+    std::vector<size_type> indices;
+    std::vector<T> values;
+    indices.reserve(indices_.size() + rhs.indices_.size());
+    values.reserve(indices_.size() + rhs.indices_.size());
+
+    size_type a = 0;
+    size_type b = 0;
+    while (a < indices_.size() || b < rhs.indices_.size()) {
+      if (b == rhs.indices_.size() ||
+          (a < indices_.size() && indices_[a] < rhs.indices_[b])) {
+        indices.push_back(indices_[a]);
+        values.push_back(values_[a]);
+        ++a;
+      } else if (a == indices_.size() || rhs.indices_[b] < indices_[a]) {
+        indices.push_back(rhs.indices_[b]);
+        values.push_back(sign * rhs.values_[b]);
+        ++b;
+      } else {
+        indices.push_back(indices_[a]);
+        values.push_back(values_[a] + sign * rhs.values_[b]);
+        ++a;
+        ++b;
+      }
+    }
+
+    indices_.swap(indices);
+    values_.swap(values);
+    size_ = std::max(size_, rhs.size_);
+    return *this;
+  }
+
+  size_type size_;
+  std::vector<size_type> indices_;
+  std::vector<T> values_;
+};
+
+// Handle cases where the scalar is on the left.
+template <class T, class U>
+SparseVector<T> operator*(const U& lhs, const SparseVector<T>& rhs) {
+  return rhs * lhs;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // SPARSE_VECTOR_H_
@@ -0,0 +1,75 @@
+
+#include "sparse_vector.h"
+#include "differentiation.h"
+
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::SparseVector;
+
+TEST(SparseVectorTest, Create) {
+  SparseVector<double> vec(1000);
+  EXPECT_EQ(1000, vec.size());
+  EXPECT_EQ(0, vec.nonzeros());
+
+  const SparseVector<double>& const_vec = vec;
+  EXPECT_EQ(0.0, const_vec[10]);
+  EXPECT_EQ(0, vec.nonzeros());
+
+  vec[10] = 2.0;
+  vec[3] = 1.0;
+  vec[500] = -1.0;
+  EXPECT_EQ(3, vec.nonzeros());
+  EXPECT_EQ(3, vec.index(0));
+  EXPECT_EQ(10, vec.index(1));
+  EXPECT_EQ(500, vec.index(2));
+  EXPECT_EQ(2.0, const_vec[10]);
+}
+
+TEST(SparseVectorTest, Arithmetic) {
+  SparseVector<double> vec_a(100);
+  vec_a[1] = 1.0;
+  vec_a[50] = 2.0;
+  SparseVector<double> vec_b(100);
+  vec_b[50] = 3.0;
+  vec_b[99] = -1.0;
+
+  SparseVector<double> vec_c = 2.0 * vec_a - vec_b / 2.0 + -vec_a;
+  EXPECT_EQ(3, vec_c.nonzeros());
+  EXPECT_EQ(1.0, vec_c[1]);
+  EXPECT_EQ(0.5, vec_c[50]);
+  EXPECT_EQ(0.5, vec_c[99]);
+
+  // Cancellation keeps the structural entry.
+  vec_c -= vec_c;
+  EXPECT_EQ(3, vec_c.nonzeros());
+  EXPECT_EQ(0.0, vec_c[50]);
+}
+
+TEST(SparseVectorTest, Differentiation) {
+  const int kNumVars = 100000;
+  DifferentiationContext<double, SparseVector<double> > context(kNumVars);
+  DifferentiationVariable<double, SparseVector<double> > x =
+      context.MakeVariable(12, 0.5);
+  DifferentiationVariable<double, SparseVector<double> > y =
+      context.MakeVariable(70000, 2.0);
+
+  DifferentiationVariable<double, SparseVector<double> > f =
+      exp(x) * y - y / x;
+  EXPECT_EQ(kNumVars, f.gradient().size());
+  EXPECT_EQ(2, f.gradient().nonzeros());
+  EXPECT_DOUBLE_EQ(std::exp(0.5) * 2.0 + 2.0 / 0.25, f.gradient()[12]);
+  EXPECT_DOUBLE_EQ(std::exp(0.5) - 1.0 / 0.5, f.gradient()[70000]);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
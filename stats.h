@@ -0,0 +1,110 @@
+// stats.h
+//
+// Opt-in instrumentation. When SIMPLE_DIFFERENTIATION_STATS is defined
+// before any header of this library is included, Vector, AlignedVector and
+// DifferentiationVariable count the work they do into a Stats struct:
+//
+//   Stats stats;
+//   {
+//     StatsScope scope(&stats);
+//     ... evaluate the objective ...
+//   }
+//   stats.operation(kMultiply), stats.allocations, ...
+//
+// Counts go to the innermost StatsScope on the calling thread, so an
+// evaluation on a thread of its own gets stats of its own. Without the
+// macro the counting statements expand to nothing, and Stats and
+// StatsScope remain available but are never updated.
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <cstddef>
+
+#include "opcode.h"
+
+namespace simple_differentiation {
+
+struct Stats {
+  Stats() { Clear(); }
+
+  void Clear() {
+    allocations = 0;
+    copies = 0;
+    bytes_written = 0;
+    for (int i = 0; i < kNumOpcodes; ++i) {
+      operations[i] = 0;
+    }
+  }
+
+  long operation(Opcode opcode) const { return operations[opcode]; }
+
+  // Adds other's counts, for combining stats from several threads.
+  Stats& operator+=(const Stats& other) {
+    allocations += other.allocations;
+    copies += other.copies;
+    bytes_written += other.bytes_written;
+    for (int i = 0; i < kNumOpcodes; ++i) {
+      operations[i] += other.operations[i];
+    }
+    return *this;
+  }
+
+  // Vectors given storage by a constructor or by growing on assignment.
+  long allocations;
+  // Deep copies of DifferentiationVariables.
+  long copies;
+  // Bytes of Vector and AlignedVector storage written by copies and
+  // evaluated expressions.
+  long bytes_written;
+  // Calls of each DifferentiationVariable operation, indexed by opcode.
+  // Compound assignments and the binary operators built on them count
+  // once.
+  long operations[kNumOpcodes];
+};
+
+namespace internal {
+
+inline Stats*& CurrentStats() {
+  static thread_local Stats* stats = NULL;
+  return stats;
+}
+
+}  // namespace internal
+
+// Directs the counts made on this thread to stats for its lifetime.
+class StatsScope {
+ public:
+  explicit StatsScope(Stats* stats) : previous_(internal::CurrentStats()) {
+    internal::CurrentStats() = stats;
+  }
+
+  ~StatsScope() { internal::CurrentStats() = previous_; }
+
+ private:
+  Stats* previous_;
+
+  StatsScope(const StatsScope& other);
+  StatsScope& operator=(const StatsScope& other);
+};
+
+}  // namespace simple_differentiation
+
+#ifdef SIMPLE_DIFFERENTIATION_STATS
+#define SIMPLE_DIFFERENTIATION_COUNT(field, amount)                          \
+  do {                                                                       \
+    ::simple_differentiation::Stats* stats_ =                                \
+        ::simple_differentiation::internal::CurrentStats();                  \
+    if (stats_ != NULL) {                                                    \
+      stats_->field += (amount);                                             \
+    }                                                                        \
+  } while (false)
+#else
+#define SIMPLE_DIFFERENTIATION_COUNT(field, amount) do { } while (false)
+#endif
+
+#define SIMPLE_DIFFERENTIATION_COUNT_OPERATION(opcode)                       \
+  SIMPLE_DIFFERENTIATION_COUNT(                                              \
+      operations[::simple_differentiation::opcode], 1)
+
+#endif  // STATS_H_
@@ -0,0 +1,127 @@
+
+#define SIMPLE_DIFFERENTIATION_STATS
+
+#include "stats.h"
+#include "differentiation.h"
+#include "fixed_vector.h"
+#include "program.h"
+#include "vector.h"
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::FixedVector;
+using simple_differentiation::Stats;
+using simple_differentiation::StatsScope;
+using simple_differentiation::Vector;
+using simple_differentiation::kAdd;
+using simple_differentiation::kDivide;
+using simple_differentiation::kExp;
+using simple_differentiation::kMultiply;
+using simple_differentiation::kNegate;
+using simple_differentiation::kSin;
+using simple_differentiation::kSubtract;
+
+TEST(StatsTest, CountsOperations) {
+  typedef DifferentiationVariable<double, FixedVector<double, 2> > Variable;
+  DifferentiationContext<double, FixedVector<double, 2> > context(2);
+  Variable x = context.MakeVariable(0, 1.0);
+  Variable y = context.MakeVariable(1, 2.0);
+
+  Stats stats;
+  {
+    StatsScope scope(&stats);
+    Variable z = x * y + sin(x) - 2.0 / y;
+    z = -exp(z) * 3.0;
+  }
+  EXPECT_EQ(2, stats.operation(kMultiply));
+  EXPECT_EQ(1, stats.operation(kAdd));
+  EXPECT_EQ(1, stats.operation(kSubtract));
+  EXPECT_EQ(1, stats.operation(kDivide));
+  EXPECT_EQ(1, stats.operation(kSin));
+  EXPECT_EQ(1, stats.operation(kExp));
+  EXPECT_EQ(1, stats.operation(kNegate));
+
+  // Nothing is counted outside a scope.
+  Variable product = x * y;
+  EXPECT_EQ(2.0, product.value());
+  EXPECT_EQ(2, stats.operation(kMultiply));
+
+  stats.Clear();
+  EXPECT_EQ(0, stats.operation(kMultiply));
+}
+
+TEST(StatsTest, CountsVectorWork) {
+  const int kNumVars = 10;
+  DifferentiationContext<double> context(kNumVars);
+  Stats stats;
+  StatsScope scope(&stats);
+
+  DifferentiationVariable<double> x = context.MakeVariable(0, 1.0);
+  EXPECT_EQ(1, stats.allocations);
+
+  // x is an lvalue, so x * x copies it and then updates the copy's
+  // gradient in place.
+  stats.Clear();
+  DifferentiationVariable<double> y = x * x;
+  EXPECT_EQ(1, stats.copies);
+  EXPECT_EQ(1, stats.allocations);
+  EXPECT_EQ(2 * kNumVars * static_cast<long>(sizeof(double)),
+            stats.bytes_written);
+
+  // A temporary operand is reused without copying.
+  stats.Clear();
+  DifferentiationVariable<double> z = sin(x * y);
+  EXPECT_EQ(1, stats.copies);
+  EXPECT_EQ(1, stats.operation(kMultiply));
+
+  stats.Clear();
+  Vector<double> a(kNumVars, 1.0);
+  Vector<double> b = a;
+  b = a + b;
+  EXPECT_EQ(2, stats.allocations);
+  EXPECT_EQ(2 * kNumVars * static_cast<long>(sizeof(double)),
+            stats.bytes_written);
+}
+
+TEST(StatsTest, ScopesAreNestedAndPerThread) {
+  typedef DifferentiationVariable<double, FixedVector<double, 1> > Variable;
+  Variable x(2.0);
+  Stats outer;
+  Stats inner;
+  Stats other;
+  {
+    StatsScope outer_scope(&outer);
+    Variable y = x + x;
+    {
+      StatsScope inner_scope(&inner);
+      y = y + x;
+      std::thread thread([&other, &x]() {
+        StatsScope thread_scope(&other);
+        Variable z = x + x;
+        z = z + x;
+        z = z + x;
+      });
+      thread.join();
+    }
+    y = y + x;
+  }
+  EXPECT_EQ(2, outer.operation(kAdd));
+  EXPECT_EQ(1, inner.operation(kAdd));
+  EXPECT_EQ(3, other.operation(kAdd));
+
+  outer += other;
+  EXPECT_EQ(5, outer.operation(kAdd));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,127 @@
+// tangent.h
+//
+// Jacobian-vector products. Rather than one lane per input, as with
+// DifferentiationContext(n), each forward evaluation here carries kLanes
+// arbitrary directions, so gradients cost O(kLanes) memory per variable
+// however many inputs there are:
+//
+//   DenseMatrix<double> directions(n, m);  // One column per direction.
+//   ...
+//   DenseMatrix<double> products = JacobianVectorProducts<4>(f, x, directions);
+//
+// computes J * directions in ceil(m / 4) evaluations of f. kLanes trades
+// evaluations against the size of each gradient and is best chosen so that
+// a gradient fits in a few cache lines. f follows the convention of
+// jacobian.h.
+
+#ifndef TANGENT_H_
+#define TANGENT_H_
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include "differentiation.h"
+#include "fixed_vector.h"
+#include "jacobian.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+// Evaluates f at x once for every kLanes columns of directions, which has
+// one row per input. After each evaluation calls visit(begin, outputs), in
+// which lane l of outputs[i].gradient() is the derivative of output i along
+// column begin + l. The lanes past the last column are zero. Only one chunk
+// of derivatives is held at a time.
+template <std::size_t kLanes = 8, class T, class F, class Visit>
+void ForEachTangentChunk(const F& f,
+                         const std::vector<T>& x,
+                         const DenseMatrix<T>& directions,
+                         const Visit& visit) {
+  typedef FixedVector<T, kLanes> Gradient;
+  typedef DifferentiationVariable<T, Gradient> Variable;
+  assert(directions.rows() == static_cast<int>(x.size()));
+  const int lanes = static_cast<int>(kLanes);
+
+  DifferentiationContext<T, Gradient> context(lanes);
+  std::vector<Variable> inputs;
+  std::vector<Variable> outputs;
+  T seed[kLanes];
+  for (int begin = 0; begin < directions.cols(); begin += lanes) {
+    inputs.clear();
+    for (int j = 0; j < directions.rows(); ++j) {
+      for (int l = 0; l < lanes; ++l) {
+        seed[l] = begin + l < directions.cols() ? directions(j, begin + l)
+                                                : T();
+      }
+      inputs.push_back(context.MakeSeededVariable(x[j], seed));
+    }
+    outputs.clear();
+    f(inputs, &outputs);
+    visit(begin, outputs);
+  }
+}
+
+// Returns J * directions, where J is the Jacobian of f at x. If values is
+// not NULL, it is set to f(x).
+template <std::size_t kLanes = 8, class T, class F>
+DenseMatrix<T> JacobianVectorProducts(const F& f,
+                                      const std::vector<T>& x,
+                                      const DenseMatrix<T>& directions,
+                                      std::vector<T>* values = NULL,
+                                      MatrixLayout layout = kRowMajor) {
+  typedef DifferentiationVariable<T, FixedVector<T, kLanes> > Variable;
+  DenseMatrix<T> products(0, directions.cols(), layout);
+  if (values != NULL) {
+    values->clear();
+  }
+  auto store = [&products, values](int begin,
+                                   const std::vector<Variable>& outputs) {
+    int rows = static_cast<int>(outputs.size());
+    if (begin == 0) {
+      products = DenseMatrix<T>(rows, products.cols(), products.layout());
+      if (values != NULL) {
+        for (int i = 0; i < rows; ++i) {
+          values->push_back(outputs[i].value());
+        }
+      }
+    }
+    assert(rows == products.rows());
+    int end = begin + static_cast<int>(kLanes);
+    if (end > products.cols()) {
+      end = products.cols();
+    }
+    for (int i = 0; i < rows; ++i) {
+      for (int j = begin; j < end; ++j) {
+        products(i, j) = outputs[i].gradient()[j - begin];
+      }
+    }
+  };
+  ForEachTangentChunk<kLanes>(f, x, directions, store);
+  return products;
+}
+
+// Returns J * direction in a single evaluation of f. If values is not NULL,
+// it is set to f(x).
+template <class T, class F>
+Vector<T> JacobianVectorProduct(const F& f,
+                                const std::vector<T>& x,
+                                const std::vector<T>& direction,
+                                std::vector<T>* values = NULL) {
+  int n = static_cast<int>(x.size());
+  DenseMatrix<T> directions(n, 1);
+  for (int j = 0; j < n; ++j) {
+    directions(j, 0) = direction[j];
+  }
+  DenseMatrix<T> product =
+      JacobianVectorProducts<1>(f, x, directions, values);
+  Vector<T> result(product.rows());
+  for (int i = 0; i < product.rows(); ++i) {
+    result[i] = product(i, 0);
+  }
+  return result;
+}
+
+}  // namespace simple_differentiation
+
+#endif  // TANGENT_H_
@@ -0,0 +1,142 @@
+
+#include "tangent.h"
+#include "differentiation.h"
+#include "jacobian.h"
+#include "sparse_vector.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DenseMatrix;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::FixedVector;
+using simple_differentiation::ForEachTangentChunk;
+using simple_differentiation::Jacobian;
+using simple_differentiation::JacobianVectorProduct;
+using simple_differentiation::JacobianVectorProducts;
+using simple_differentiation::SparseVector;
+using simple_differentiation::Vector;
+using simple_differentiation::kColumnMajor;
+
+// y_i = sin(x_i) * x_{i+1} + exp(x_0 / 4), for i < n - 1.
+struct Chain {
+  template <class Variable>
+  void operator()(const std::vector<Variable>& x,
+                  std::vector<Variable>* y) const {
+    for (std::size_t i = 0; i + 1 < x.size(); ++i) {
+      y->push_back(sin(x[i]) * x[i + 1] + exp(x[0] / 4.0));
+    }
+  }
+};
+
+std::vector<double> Point() {
+  std::vector<double> x;
+  for (int j = 0; j < 9; ++j) {
+    x.push_back(0.2 * j - 0.7);
+  }
+  return x;
+}
+
+DenseMatrix<double> Directions(int rows, int cols) {
+  DenseMatrix<double> directions(rows, cols);
+  for (int j = 0; j < rows; ++j) {
+    for (int k = 0; k < cols; ++k) {
+      directions(j, k) = cos(1.0 + j * cols + k);
+    }
+  }
+  return directions;
+}
+
+TEST(TangentTest, SeededVariable) {
+  double seed[2] = {2.0, 0.0};
+  DifferentiationContext<double, FixedVector<double, 2> > context(2);
+  DifferentiationVariable<double, FixedVector<double, 2> > x =
+      context.MakeSeededVariable(3.0, seed);
+  DifferentiationVariable<double, FixedVector<double, 2> > y = x * x;
+  EXPECT_EQ(9.0, y.value());
+  EXPECT_EQ(12.0, y.gradient()[0]);
+  EXPECT_EQ(0.0, y.gradient()[1]);
+
+  DifferentiationContext<double, SparseVector<double> > sparse(2);
+  EXPECT_EQ(1, sparse.MakeSeededVariable(3.0, seed).gradient().nonzeros());
+}
+
+TEST(TangentTest, MatchesJacobian) {
+  std::vector<double> x = Point();
+  DenseMatrix<double> jacobian = Jacobian(Chain(), x);
+  // Five directions do not fill the last chunk of two or four lanes.
+  DenseMatrix<double> directions = Directions(9, 5);
+
+  std::vector<double> values;
+  DenseMatrix<double> two = JacobianVectorProducts<2>(Chain(), x, directions);
+  DenseMatrix<double> four = JacobianVectorProducts<4>(
+      Chain(), x, directions, &values, kColumnMajor);
+  ASSERT_EQ(8, two.rows());
+  ASSERT_EQ(5, two.cols());
+  EXPECT_EQ(kColumnMajor, four.layout());
+  ASSERT_EQ(8u, values.size());
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_DOUBLE_EQ(sin(x[i]) * x[i + 1] + exp(x[0] / 4.0), values[i]);
+    for (int k = 0; k < 5; ++k) {
+      double expected = 0.0;
+      for (int j = 0; j < 9; ++j) {
+        expected += jacobian(i, j) * directions(j, k);
+      }
+      EXPECT_NEAR(expected, two(i, k), 1e-14);
+      EXPECT_NEAR(expected, four(i, k), 1e-14);
+    }
+  }
+}
+
+TEST(TangentTest, SingleDirection) {
+  std::vector<double> x = Point();
+  DenseMatrix<double> directions = Directions(9, 1);
+  std::vector<double> direction(9);
+  for (int j = 0; j < 9; ++j) {
+    direction[j] = directions(j, 0);
+  }
+  DenseMatrix<double> expected =
+      JacobianVectorProducts(Chain(), x, directions);
+  Vector<double> product = JacobianVectorProduct(Chain(), x, direction);
+  ASSERT_EQ(8, product.size());
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_DOUBLE_EQ(expected(i, 0), product[i]);
+  }
+}
+
+TEST(TangentTest, Streaming) {
+  typedef DifferentiationVariable<double, FixedVector<double, 3> > Variable;
+  std::vector<double> x = Point();
+  DenseMatrix<double> directions = Directions(9, 7);
+  DenseMatrix<double> expected =
+      JacobianVectorProducts<3>(Chain(), x, directions);
+
+  std::vector<int> begins;
+  auto visit = [&](int begin, const std::vector<Variable>& outputs) {
+    begins.push_back(begin);
+    ASSERT_EQ(8u, outputs.size());
+    for (int i = 0; i < 8; ++i) {
+      for (int l = 0; l < 3; ++l) {
+        if (begin + l < 7) {
+          EXPECT_EQ(expected(i, begin + l), outputs[i].gradient()[l]);
+        } else {
+          EXPECT_EQ(0.0, outputs[i].gradient()[l]);
+        }
+      }
+    }
+  };
+  ForEachTangentChunk<3>(Chain(), x, directions, visit);
+  EXPECT_EQ(std::vector<int>({0, 3, 6}), begins);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,434 @@
+// tape.h
+//
+// Reverse-mode differentiation. Using TapeGradient<T> as the gradient type
+// of a DifferentiationVariable makes every gradient operation append a node
+// to a Tape instead of touching a dense vector, and the matching
+// DifferentiationContext runs a single adjoint sweep over that tape. The
+// cost of a full gradient is then a small constant multiple of the cost of
+// evaluating the function, independent of the number of variables.
+//
+// Usage:
+//
+//   DifferentiationContext<double, TapeGradient<double> > context(n);
+//   DifferentiationVariable<double, TapeGradient<double> > x =
+//       context.MakeVariable(0, 1.0);
+//   ...
+//   Vector<double> gradient = context.Backward(f);
+//
+// A tape too large for memory can be spilled to a file as it is recorded:
+//
+//   context.mutable_tape()->SpillTo("/scratch/f.tape");
+//
+// Only the newest block of nodes is then kept in memory, and the backward
+// sweep reads the file back through a memory mapping, so reading the nodes
+// is bounded by the disk rather than by the available memory. The sweep
+// still keeps one adjoint per node in memory, since adjoints are updated in
+// no particular order: for double, 8 bytes per node instead of the 24 of a
+// node, so a tape about three times larger than memory can be swept. After
+// Flush the file holds the whole tape and can be swept again later with
+// Open. Node indices are ints, so a tape, spilled or not, holds at most
+// 2^31 - 1 nodes; past that Tape::full is set and Backward fails.
+
+#ifndef TAPE_H_
+#define TAPE_H_
+
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "differentiation.h"
+#include "tape_file.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+// A linear computation graph. Each node is a weighted sum of at most two
+// earlier nodes, so nodes are always stored in topological order.
+template <class T>
+class Tape {
+ public:
+  struct Node {
+    int parents[2];
+    T weights[2];
+  };
+
+  // The default number of nodes written to a spill file at a time.
+  static const int kDefaultBlockNodes = 1 << 16;
+
+  // Node indices are ints, so a tape holds at most this many nodes. Once it
+  // is full, new nodes are dropped and the tape reports itself full until
+  // the next Clear or Open.
+  static constexpr int kMaxNodes = std::numeric_limits<int>::max();
+
+  Tape() : num_spilled_(0), block_nodes_(0), full_(false) { }
+
+  // Streams the tape to the file at path from now on, writing block_nodes
+  // nodes at a time and keeping only the unwritten ones in memory. Nodes
+  // already recorded are written too. Returns false, changing nothing, if
+  // the tape already has a file or the file cannot be created. If a later
+  // write fails, the tape stops spilling and keeps growing in memory
+  // instead.
+  bool SpillTo(const std::string& path,
+               int block_nodes = kDefaultBlockNodes) {
+    static_assert(std::is_trivially_copyable<Node>::value,
+                  "Only tapes of trivially copyable values can be spilled.");
+    if (file_ != NULL) {
+      return false;
+    }
+    std::unique_ptr<internal::TapeFile<Node> > file(
+        new internal::TapeFile<Node>);
+    if (!file->Create(path)) {
+      return false;
+    }
+    file_.swap(file);
+    num_spilled_ = 0;
+    block_nodes_ = block_nodes;
+    if (!nodes_.empty() && !Flush()) {
+      block_nodes_ = 0;
+    }
+    return true;
+  }
+
+  // Writes the nodes held in memory to the spill file, so that it holds the
+  // whole tape. Returns false if they cannot be written, in which case they
+  // stay in memory.
+  bool Flush() {
+    if (file_ == NULL) {
+      return false;
+    }
+    if (!file_->Append(nodes_.data(), nodes_.size())) {
+      return false;
+    }
+    num_spilled_ += static_cast<int>(nodes_.size());
+    nodes_.clear();
+    return true;
+  }
+
+  // Replaces the tape with one saved by SpillTo and Flush, for replaying
+  // its backward sweep. Nodes added afterwards are kept in memory. Returns
+  // false, leaving the tape empty, if the file cannot be read as a tape.
+  // Files of more than kMaxNodes nodes cannot be read as a tape.
+  bool Open(const std::string& path) {
+    nodes_.clear();
+    num_spilled_ = 0;
+    block_nodes_ = 0;
+    full_ = false;
+    file_.reset(new internal::TapeFile<Node>);
+    if (!file_->Open(path) ||
+        file_->size() > static_cast<std::size_t>(kMaxNodes)) {
+      file_.reset();
+      return false;
+    }
+    num_spilled_ = static_cast<int>(file_->size());
+    return true;
+  }
+
+  // Adds a node with no parents, for an independent variable.
+  int AddInput() {
+    return AddNode(-1, T(), -1, T());
+  }
+
+  int AddNode(int parent, const T& weight) {
+    return AddNode(parent, weight, -1, T());
+  }
+
+  // Returns the new node's index, or -1, for no node, if the tape is full.
+  int AddNode(int parent0, const T& weight0, int parent1, const T& weight1) {
+    if (size() == kMaxNodes) {
+      full_ = true;
+      return -1;
+    }
+    Node node;
+    node.parents[0] = parent0;
+    node.weights[0] = weight0;
+    node.parents[1] = parent1;
+    node.weights[1] = weight1;
+    nodes_.push_back(node);
+    int index = num_spilled_ + static_cast<int>(nodes_.size()) - 1;
+    if (static_cast<int>(nodes_.size()) == block_nodes_ && !Flush()) {
+      block_nodes_ = 0;
+    }
+    return index;
+  }
+
+  // Sets (*adjoints)[i] to d(node)/d(node i) for every i <= node. Returns
+  // false, clearing *adjoints, if the tape is full or spilled nodes cannot
+  // be read back.
+  bool Backward(int node, std::vector<T>* adjoints) const {
+    if (full_) {
+      adjoints->clear();
+      return false;
+    }
+    adjoints->assign(node + 1, T());
+    (*adjoints)[node] = T(1);
+    int i = node;
+    for (; i >= num_spilled_; --i) {
+      Propagate(nodes_[i - num_spilled_], i, adjoints);
+    }
+    if (i < 0) {
+      return true;
+    }
+
+    // Sweep the file a block at a time, asking for the block before each
+    // one to be read while it is being swept.
+    const Node* spilled = file_->Map();
+    if (spilled == NULL) {
+      adjoints->clear();
+      return false;
+    }
+    int block_nodes = kDefaultBlockNodes;
+    if (block_nodes_ > 0) {
+      block_nodes = block_nodes_;
+    }
+    while (i >= 0) {
+      int begin = i + 1 > block_nodes ? i + 1 - block_nodes : 0;
+      file_->Prefetch(begin > block_nodes ? begin - block_nodes : 0, begin);
+      for (; i >= begin; --i) {
+        Propagate(spilled[i], i, adjoints);
+      }
+    }
+    return true;
+  }
+
+  // Discards every node. A spill file is emptied and kept for the next
+  // evaluation; a file attached by Open, or one that cannot be emptied, is
+  // left as it is and the tape goes back to memory.
+  void Clear() {
+    nodes_.clear();
+    num_spilled_ = 0;
+    full_ = false;
+    if (file_ != NULL && !file_->Truncate()) {
+      file_.reset();
+      block_nodes_ = 0;
+    }
+  }
+
+  // Preallocates room for num_nodes nodes.
+  void Reserve(int num_nodes) { nodes_.reserve(num_nodes); }
+
+  int size() const { return num_spilled_ + static_cast<int>(nodes_.size()); }
+
+  int num_spilled() const { return num_spilled_; }
+
+  // Whether nodes were dropped because the tape held kMaxNodes nodes.
+  bool full() const { return full_; }
+
+  // Returns a node held in memory, one not before num_spilled().
+  const Node& node(int index) const {
+    assert(index >= num_spilled_);
+    return nodes_[index - num_spilled_];
+  }
+
+  // Copies any node, spilled or not, to *node. Returns false if a spilled
+  // node cannot be read back.
+  bool ReadNode(int index, Node* node) const {
+    if (index >= num_spilled_) {
+      *node = nodes_[index - num_spilled_];
+      return true;
+    }
+    const Node* spilled = file_->Map();
+    if (spilled == NULL) {
+      return false;
+    }
+    *node = spilled[index];
+    return true;
+  }
+
+ private:
+  static void Propagate(const Node& node, int index,
+                        std::vector<T>* adjoints) {
+    for (int j = 0; j < 2; ++j) {
+      if (node.parents[j] >= 0) {
+        (*adjoints)[node.parents[j]] += node.weights[j] * (*adjoints)[index];
+      }
+    }
+  }
+
+  std::vector<Node> nodes_;
+  // Nodes before num_spilled_ are in file_, the rest in nodes_.
+  std::unique_ptr<internal::TapeFile<Node> > file_;
+  int num_spilled_;
+  // Nodes are spilled whenever this many are in memory; 0 never spills.
+  int block_nodes_;
+  bool full_;
+
+  Tape(const Tape& other);
+  Tape& operator=(const Tape& other);
+};
+
+// A handle to a tape node. A default-constructed TapeGradient has no node
+// and stands for an exactly zero gradient, so operations on constants do
+// not grow the tape.
+template <class T>
+class TapeGradient {
+ public:
+  TapeGradient() : tape_(NULL), node_(-1) { }
+  TapeGradient(Tape<T>* tape, int node) : tape_(tape), node_(node) { }
+
+  Tape<T>* tape() const { return tape_; }
+  int node() const { return node_; }
+  bool is_zero() const { return node_ < 0; }
+
+  TapeGradient operator-() const {
+    return *this * T(-1);
+  }
+
+  TapeGradient& operator+=(const TapeGradient& rhs) {
+    return Accumulate(rhs, T(1));
+  }
+
+  TapeGradient& operator-=(const TapeGradient& rhs) {
+    return Accumulate(rhs, T(-1));
+  }
+
+  template <class U>
+  TapeGradient& operator*=(const U& rhs) {
+    if (!is_zero()) {
+      node_ = tape_->AddNode(node_, rhs);
+    }
+    return *this;
+  }
+
+  template <class U>
+  TapeGradient& operator/=(const U& rhs) {
+    return *this *= T(1) / rhs;
+  }
+
+  TapeGradient operator+(const TapeGradient& rhs) const {
+    return TapeGradient(*this) += rhs;
+  }
+
+  TapeGradient operator-(const TapeGradient& rhs) const {
+    return TapeGradient(*this) -= rhs;
+  }
+
+  template <class U>
+  TapeGradient operator*(const U& rhs) const {
+    return TapeGradient(*this) *= rhs;
+  }
+
+  template <class U>
+  TapeGradient operator/(const U& rhs) const {
+    return TapeGradient(*this) /= rhs;
+  }
+
+ private:
+  TapeGradient& Accumulate(const TapeGradient& rhs, const T& weight) {
+    if (rhs.is_zero()) {
+      return *this;
+    }
+    if (is_zero()) {
+      tape_ = rhs.tape_;
+      node_ = tape_->AddNode(rhs.node_, weight);
+    } else {
+      node_ = tape_->AddNode(node_, T(1), rhs.node_, weight);
+    }
+    return *this;
+  }
+
+  Tape<T>* tape_;
+  int node_;
+};
+
+// Handle cases where the scalar is on the left.
+template <class T, class U>
+TapeGradient<T> operator*(const U& lhs, const TapeGradient<T>& rhs) {
+  return rhs * lhs;
+}
+
+// A DifferentiationContext that records onto a tape. Variables made from a
+// context refer to its tape, so they must not outlive it.
+template <class T>
+class DifferentiationContext<T, TapeGradient<T> > {
+ public:
+  DifferentiationContext(int num_vars)
+      : num_vars_(num_vars),
+        original_values_(num_vars),
+        input_nodes_(num_vars, -1) { }
+
+  DifferentiationVariable<T, TapeGradient<T> > MakeVariable(int index,
+                                                            const T& value);
+
+  // Makes a variable with a zero gradient, for inputs held fixed.
+  DifferentiationVariable<T, TapeGradient<T> > MakeConstant(
+      const T& value) const {
+    return DifferentiationVariable<T, TapeGradient<T> >(value,
+                                                        TapeGradient<T>());
+  }
+
+  // Returns the gradient of |output| with respect to every variable made by
+  // this context, or an empty Vector if the tape filled up or was spilled
+  // to a file that can no longer be read.
+  Vector<T> Backward(
+      const DifferentiationVariable<T, TapeGradient<T> >& output) const;
+
+  // Discards the recorded tape so the context can be reused for another
+  // evaluation. Variables made before the call become invalid.
+  void Clear();
+
+  // Preallocates room for an evaluation that records num_nodes nodes.
+  void Reserve(int num_nodes) { tape_.Reserve(num_nodes); }
+
+  const T& original_value(int index) const { return original_values_[index]; }
+  int size() const { return num_vars_; }
+  const Tape<T>& tape() const { return tape_; }
+  // For spilling the tape to a file; see Tape::SpillTo.
+  Tape<T>* mutable_tape() { return &tape_; }
+
+ private:
+  int num_vars_;
+  std::vector<T> original_values_;
+  std::vector<int> input_nodes_;
+  Tape<T> tape_;
+
+  DifferentiationContext(const DifferentiationContext& other);
+  DifferentiationContext& operator=(const DifferentiationContext& other);
+};
+
+template <class T>
+DifferentiationVariable<T, TapeGradient<T> >
+DifferentiationContext<T, TapeGradient<T> >::MakeVariable(int index,
+                                                          const T& value) {
+  original_values_[index] = value;
+  input_nodes_[index] = tape_.AddInput();
+  return DifferentiationVariable<T, TapeGradient<T> >(
+      value, TapeGradient<T>(&tape_, input_nodes_[index]));
+}
+
+template <class T>
+Vector<T> DifferentiationContext<T, TapeGradient<T> >::Backward(
+    const DifferentiationVariable<T, TapeGradient<T> >& output) const {
+  if (tape_.full()) {
+    return Vector<T>();
+  }
+  Vector<T> gradient(num_vars_);
+  int output_node = output.gradient().node();
+  if (output_node < 0) {
+    return gradient;
+  }
+
+  std::vector<T> adjoints;
+  if (!tape_.Backward(output_node, &adjoints)) {
+    return Vector<T>();
+  }
+  for (int i = 0; i < num_vars_; ++i) {
+    if (input_nodes_[i] >= 0 && input_nodes_[i] <= output_node) {
+      gradient[i] = adjoints[input_nodes_[i]];
+    }
+  }
+  return gradient;
+}
+
+template <class T>
+void DifferentiationContext<T, TapeGradient<T> >::Clear() {
+  tape_.Clear();
+  input_nodes_.assign(num_vars_, -1);
+}
+
+}  // namespace simple_differentiation
+
+#endif  // TAPE_H_
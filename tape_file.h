@@ -0,0 +1,172 @@
+// tape_file.h
+//
+// File storage for tapes too large to keep in memory; see Tape::SpillTo in
+// tape.h. Records are appended to the file in blocks as they are recorded
+// and read back, newest first, through a read-only memory mapping. Clean
+// mapped pages can be dropped by the kernel at any time, so a backward sweep
+// needs memory only for its adjoints and the pages it is working through.
+// Before each block is swept the kernel is asked to start reading the one
+// before it, so disk reads overlap with the arithmetic.
+//
+// This needs POSIX files and mmap.
+
+#ifndef TAPE_FILE_H_
+#define TAPE_FILE_H_
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace simple_differentiation {
+namespace internal {
+
+// An append-only file of fixed-size, trivially copyable records.
+template <class Record>
+class TapeFile {
+ public:
+  TapeFile()
+      : fd_(-1), writable_(false), size_(0), mapping_(NULL),
+        mapped_size_(0) { }
+  ~TapeFile() { Close(); }
+
+  // Creates the file at path, or empties it if it exists. Returns false if
+  // it cannot be opened for writing.
+  bool Create(const std::string& path) {
+    Close();
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    writable_ = fd_ >= 0;
+    return writable_;
+  }
+
+  // Opens an existing file for reading. Returns false if it cannot be
+  // opened or does not hold a whole number of records.
+  bool Open(const std::string& path) {
+    Close();
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      return false;
+    }
+    struct stat status;
+    if (fstat(fd_, &status) != 0 ||
+        status.st_size % static_cast<off_t>(sizeof(Record)) != 0) {
+      Close();
+      return false;
+    }
+    size_ = static_cast<std::size_t>(status.st_size) / sizeof(Record);
+    return true;
+  }
+
+  // Appends n records. Returns false if they cannot all be written, and
+  // from then on if the partial write cannot be cut off again, so that the
+  // file never holds records that were not appended.
+  bool Append(const Record* records, std::size_t n) {
+    if (!writable_) {
+      return false;
+    }
+    const char* data = reinterpret_cast<const char*>(records);
+    std::size_t bytes = n * sizeof(Record);
+    off_t offset = static_cast<off_t>(size_ * sizeof(Record));
+    std::size_t written = 0;
+    while (written < bytes) {
+      ssize_t result = pwrite(fd_, data + written, bytes - written,
+                              offset + static_cast<off_t>(written));
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      if (result <= 0) {
+        if (ftruncate(fd_, offset) != 0) {
+          writable_ = false;
+        }
+        return false;
+      }
+      written += static_cast<std::size_t>(result);
+    }
+    size_ += n;
+    return true;
+  }
+
+  // Discards every record. Returns false, changing nothing, if the file is
+  // read-only or cannot be cut.
+  bool Truncate() {
+    if (!writable_ || ftruncate(fd_, 0) != 0) {
+      return false;
+    }
+    Unmap();
+    size_ = 0;
+    return true;
+  }
+
+  // Returns the records, mapped into memory. The pointer stays valid until
+  // the next call to Append, Truncate or Map that changes the file's size.
+  const Record* Map() const {
+    if (mapped_size_ != size_) {
+      Unmap();
+      if (size_ > 0) {
+        void* mapping = mmap(NULL, size_ * sizeof(Record), PROT_READ,
+                             MAP_SHARED, fd_, 0);
+        if (mapping == MAP_FAILED) {
+          return NULL;
+        }
+        mapping_ = mapping;
+        mapped_size_ = size_;
+      }
+    }
+    return static_cast<const Record*>(mapping_);
+  }
+
+  // Asks the kernel to start reading records [begin, end) of the mapping
+  // into memory, without waiting for them.
+  void Prefetch(std::size_t begin, std::size_t end) const {
+    if (mapping_ == NULL || begin >= end) {
+      return;
+    }
+    std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t first = begin * sizeof(Record) / page * page;
+    std::size_t last = end * sizeof(Record);
+    madvise(static_cast<char*>(mapping_) + first, last - first,
+            MADV_WILLNEED);
+  }
+
+  std::size_t size() const { return size_; }
+  // False for files opened with Open, and after a failed write that could
+  // not be undone.
+  bool writable() const { return writable_; }
+
+ private:
+  void Unmap() const {
+    if (mapping_ != NULL) {
+      munmap(mapping_, mapped_size_ * sizeof(Record));
+      mapping_ = NULL;
+      mapped_size_ = 0;
+    }
+  }
+
+  void Close() {
+    Unmap();
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+    writable_ = false;
+    size_ = 0;
+  }
+
+  int fd_;
+  bool writable_;
+  std::size_t size_;
+  mutable void* mapping_;
+  mutable std::size_t mapped_size_;
+
+  TapeFile(const TapeFile& other);
+  TapeFile& operator=(const TapeFile& other);
+};
+
+}  // namespace internal
+}  // namespace simple_differentiation
+
+#endif  // TAPE_FILE_H_
@@ -0,0 +1,201 @@
+
+#include "tape.h"
+#include "differentiation.h"
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::Tape;
+using simple_differentiation::TapeGradient;
+using simple_differentiation::Vector;
+
+// Written once against DifferentiationVariable so that it can be evaluated
+// in either mode.
+template <class T, class V>
+DifferentiationVariable<T, V> Objective(
+    const std::vector<DifferentiationVariable<T, V> >& x) {
+  DifferentiationVariable<T, V> result = x[0] * x[1] - 2.0 / x[2];
+  result += sin(x[0]) * exp(x[1]) + log(x[2]) / x[3];
+  result -= atan(x[3] * x[0]) + sqrt(x[1]) * pow(x[2], 1.5);
+  result *= cos(x[3]) - fabs(-x[1]) + tan(x[0]);
+  result /= 3.0;
+  return result + asin(x[0] / 4.0) * acos(x[3] / 5.0);
+}
+
+template <class V>
+DifferentiationVariable<double, V> EvaluateObjective(
+    DifferentiationContext<double, V>* context) {
+  const double point[] = { 0.7, 1.3, 2.1, -0.4 };
+  std::vector<DifferentiationVariable<double, V> > x;
+  for (int i = 0; i < context->size(); ++i) {
+    x.push_back(context->MakeVariable(i, point[i]));
+  }
+  return Objective(x);
+}
+
+TEST(TapeTest, MatchesForwardMode) {
+  DifferentiationContext<double> forward_context(4);
+  DifferentiationVariable<double> forward =
+      EvaluateObjective(&forward_context);
+
+  DifferentiationContext<double, TapeGradient<double> > reverse_context(4);
+  DifferentiationVariable<double, TapeGradient<double> > reverse =
+      EvaluateObjective(&reverse_context);
+  Vector<double> gradient = reverse_context.Backward(reverse);
+
+  EXPECT_DOUBLE_EQ(forward.value(), reverse.value());
+  ASSERT_EQ(4, gradient.size());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_NEAR(forward.gradient()[i], gradient[i], 1e-12);
+  }
+}
+
+TEST(TapeTest, UnusedAndConstantInputs) {
+  DifferentiationContext<double, TapeGradient<double> > context(3);
+  DifferentiationVariable<double, TapeGradient<double> > x =
+      context.MakeVariable(0, 2.0);
+  context.MakeVariable(1, 5.0);
+
+  Vector<double> gradient = context.Backward(x * x * 3.0 + 1.0);
+  EXPECT_DOUBLE_EQ(12.0, gradient[0]);
+  EXPECT_DOUBLE_EQ(0.0, gradient[1]);
+  EXPECT_DOUBLE_EQ(0.0, gradient[2]);
+}
+
+TEST(TapeTest, TapeGrowsLinearlyWithOperations) {
+  DifferentiationContext<double, TapeGradient<double> > context(1000);
+  DifferentiationVariable<double, TapeGradient<double> > sum =
+      context.MakeVariable(0, 1.0);
+  for (int i = 1; i < 1000; ++i) {
+    sum += context.MakeVariable(i, 1.0) * static_cast<double>(i);
+  }
+  EXPECT_EQ(1000 + 2 * 999, context.tape().size());
+
+  Vector<double> gradient = context.Backward(sum);
+  for (int i = 1; i < 1000; ++i) {
+    EXPECT_DOUBLE_EQ(i, gradient[i]);
+  }
+
+  context.Clear();
+  EXPECT_EQ(0, context.tape().size());
+}
+
+TEST(TapeTest, SpilledTapeMatchesInMemory) {
+  DifferentiationContext<double, TapeGradient<double> > memory_context(4);
+  DifferentiationVariable<double, TapeGradient<double> > expected =
+      EvaluateObjective(&memory_context);
+  Vector<double> expected_gradient = memory_context.Backward(expected);
+
+  std::string path = ::testing::TempDir() + "spilled.tape";
+  DifferentiationContext<double, TapeGradient<double> > context(4);
+  ASSERT_TRUE(context.mutable_tape()->SpillTo(path, 5));
+  for (int repeat = 0; repeat < 2; ++repeat) {
+    context.Clear();
+    DifferentiationVariable<double, TapeGradient<double> > actual =
+        EvaluateObjective(&context);
+    EXPECT_EQ(memory_context.tape().size(), context.tape().size());
+    EXPECT_EQ(expected.gradient().node(), actual.gradient().node());
+    Vector<double> gradient = context.Backward(actual);
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(expected_gradient[i], gradient[i]);
+    }
+  }
+  EXPECT_GT(context.tape().num_spilled(), 0);
+  for (int i = 0; i < context.tape().size(); ++i) {
+    Tape<double>::Node node;
+    ASSERT_TRUE(context.tape().ReadNode(i, &node));
+    EXPECT_EQ(memory_context.tape().node(i).parents[0], node.parents[0]);
+    EXPECT_EQ(memory_context.tape().node(i).weights[1], node.weights[1]);
+  }
+
+  // A tape spills to one file only.
+  EXPECT_FALSE(context.mutable_tape()->SpillTo(path + ".second"));
+}
+
+TEST(TapeTest, SavedTapeReplays) {
+  std::string path = ::testing::TempDir() + "saved.tape";
+  DifferentiationContext<double, TapeGradient<double> > context(4);
+  // Spilling after recording writes what is already on the tape.
+  DifferentiationVariable<double, TapeGradient<double> > output =
+      EvaluateObjective(&context);
+  ASSERT_TRUE(context.mutable_tape()->SpillTo(path, 3));
+  output = output * output;
+  ASSERT_TRUE(context.mutable_tape()->Flush());
+  std::vector<double> expected;
+  ASSERT_TRUE(context.tape().Backward(output.gradient().node(), &expected));
+
+  Tape<double> replay;
+  ASSERT_TRUE(replay.Open(path));
+  ASSERT_EQ(context.tape().size(), replay.size());
+  std::vector<double> adjoints;
+  ASSERT_TRUE(replay.Backward(replay.size() - 1, &adjoints));
+  ASSERT_EQ(expected.size(), adjoints.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i], adjoints[i]);
+  }
+
+  // Clearing a replayed tape leaves the saved file alone.
+  replay.Clear();
+  EXPECT_EQ(0, replay.size());
+  int input = replay.AddInput();
+  replay.Backward(replay.AddNode(input, 2.0), &adjoints);
+  EXPECT_EQ(2.0, adjoints[input]);
+  ASSERT_TRUE(replay.Open(path));
+  EXPECT_EQ(context.tape().size(), replay.size());
+
+  EXPECT_FALSE(replay.Open(path + ".missing"));
+  EXPECT_EQ(0, replay.size());
+  EXPECT_FALSE(replay.SpillTo(::testing::TempDir() + "missing/dir.tape"));
+}
+
+// Writing 2^31 nodes would take too long, so start from a saved tape that
+// is already full, as a sparse file.
+TEST(TapeTest, FullTapeFailsBackward) {
+  typedef Tape<double>::Node Node;
+  std::string path = ::testing::TempDir() + "full.tape";
+  off_t full_size = static_cast<off_t>(Tape<double>::kMaxNodes) *
+                    static_cast<off_t>(sizeof(Node));
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  int result = ftruncate(fd, full_size + static_cast<off_t>(sizeof(Node)));
+  close(fd);
+  if (result != 0) {
+    unlink(path.c_str());
+    GTEST_SKIP() << "No room for a sparse file of a full tape.";
+  }
+
+  Tape<double> tape;
+  EXPECT_FALSE(tape.Open(path));
+  ASSERT_EQ(0, truncate(path.c_str(), full_size));
+  ASSERT_TRUE(tape.Open(path));
+  EXPECT_EQ(Tape<double>::kMaxNodes, tape.size());
+  EXPECT_FALSE(tape.full());
+  EXPECT_EQ(-1, tape.AddInput());
+  EXPECT_TRUE(tape.full());
+  std::vector<double> adjoints(1);
+  EXPECT_FALSE(tape.Backward(0, &adjoints));
+  EXPECT_TRUE(adjoints.empty());
+
+  tape.Clear();
+  EXPECT_FALSE(tape.full());
+  int input = tape.AddInput();
+  EXPECT_TRUE(tape.Backward(tape.AddNode(input, 3.0), &adjoints));
+  EXPECT_EQ(3.0, adjoints[input]);
+  unlink(path.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,183 @@
+// thread_pool.h
+//
+// A fixed set of worker threads for running independent tasks in parallel:
+//
+//   ThreadPool pool(4);
+//   pool.ParallelFor(num_tasks, [&](int i) { ... });
+//
+// Each thread has its own queue of task indices. A thread works from the
+// back of its own queue and, once that is empty, steals from the front of
+// the others, so uneven tasks still keep every thread busy.
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace simple_differentiation {
+
+class ThreadPool {
+ public:
+  // num_threads counts the thread that calls ParallelFor, which takes part
+  // in the work, so ThreadPool(1) starts no threads at all.
+  explicit ThreadPool(int num_threads = DefaultNumThreads())
+      : task_(NULL), generation_(0), active_(0), remaining_(0),
+        stop_(false) {
+    if (num_threads < 1) {
+      num_threads = 1;
+    }
+    for (int i = 0; i < num_threads; ++i) {
+      queues_.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+    for (int i = 1; i < num_threads; ++i) {
+      workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i].join();
+    }
+  }
+
+  int num_threads() const { return static_cast<int>(queues_.size()); }
+
+  // Runs task(i) for every i in [0, num_tasks) and returns when all of them
+  // have finished. Tasks must not throw or call ParallelFor themselves.
+  template <class F>
+  void ParallelFor(int num_tasks, const F& task) {
+    if (num_tasks <= 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    std::function<void(int)> function(task);
+
+    int num_queues = num_threads();
+    for (int i = 0; i < num_tasks; ++i) {
+      Queue& queue = *queues_[i % num_queues];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(i);
+    }
+    remaining_ = num_tasks;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &function;
+      ++generation_;
+    }
+    wake_.notify_all();
+
+    RunTasks(0, function);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return remaining_ == 0 && active_ == 0; });
+    task_ = NULL;
+  }
+
+  static int DefaultNumThreads() {
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+  };
+
+  void WorkerLoop(int self) {
+    unsigned long seen = 0;
+    for (;;) {
+      const std::function<void(int)>* task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this, seen] {
+          return stop_ || (task_ != NULL && generation_ != seen);
+        });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+        task = task_;
+        ++active_;
+      }
+      RunTasks(self, *task);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_;
+      }
+      done_.notify_all();
+    }
+  }
+
+  void RunTasks(int self, const std::function<void(int)>& task) {
+    int index;
+    while (PopTask(self, &index)) {
+      task(index);
+      if (--remaining_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_.notify_all();
+      }
+    }
+  }
+
+  // Takes the newest task from queue |self|, or failing that the oldest
+  // task from any other queue.
+  bool PopTask(int self, int* index) {
+    {
+      Queue& queue = *queues_[self];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        *index = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+      }
+    }
+    int num_queues = num_threads();
+    for (int k = 1; k < num_queues; ++k) {
+      Queue& queue = *queues_[(self + k) % num_queues];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        *index = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Queue> > queues_;
+  std::vector<std::thread> workers_;
+
+  // Serializes calls to ParallelFor.
+  std::mutex run_mutex_;
+
+  // Guards task_, generation_, active_ and stop_.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(int)>* task_;
+  unsigned long generation_;
+  int active_;
+  std::atomic<int> remaining_;
+  bool stop_;
+
+  ThreadPool(const ThreadPool& other);
+  ThreadPool& operator=(const ThreadPool& other);
+};
+
+}  // namespace simple_differentiation
+
+#endif  // THREAD_POOL_H_
@@ -0,0 +1,50 @@
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::ThreadPool;
+
+TEST(ThreadPoolTest, RunsEveryTaskOnce) {
+  ThreadPool pool(4);
+  EXPECT_EQ(4, pool.num_threads());
+
+  for (int round = 0; round < 20; ++round) {
+    std::vector<std::atomic<int> > counts(100 + round);
+    pool.ParallelFor(static_cast<int>(counts.size()),
+                     [&counts](int i) { ++counts[i]; });
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+      EXPECT_EQ(1, counts[i]);
+    }
+  }
+}
+
+TEST(ThreadPoolTest, UnevenTasks) {
+  ThreadPool pool(3);
+  std::atomic<long> total(0);
+  pool.ParallelFor(30, [&total](int i) {
+    long sum = 0;
+    for (long k = 0; k < (i % 3 == 0 ? 200000 : 10); ++k) {
+      sum += k % 7;
+    }
+    total += sum > 0 ? 1 : 0;
+  });
+  EXPECT_EQ(30, total);
+
+  ThreadPool serial(1);
+  int calls = 0;
+  serial.ParallelFor(5, [&calls](int) { ++calls; });
+  EXPECT_EQ(5, calls);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
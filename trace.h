@@ -0,0 +1,310 @@
+// trace.h
+//
+// Record once, replay many times. When an objective has the same structure
+// on every call and only the input values change, it can be traced once
+// into a Program and the Program replayed for each new point:
+//
+//   CompiledGradient<double> compiled = CompileGradient(f, x0);
+//   for (...) {
+//     double value = compiled.Evaluate(x, &gradient);
+//   }
+//
+// f is written as a template over the variable type, as in hessian.h.
+// Tracing runs it through a reverse-mode DifferentiationContext whose values
+// are TracedValues, so both the function and its adjoint sweep are recorded
+// as flat instructions. Replaying is then a single loop over one
+// preallocated buffer, with none of the operator overloading, temporaries or
+// tape bookkeeping of a fresh evaluation. The trace is optimized (see
+// optimize.h) before it is replayed.
+//
+// Control flow is fixed at trace time: a branch on a comparison takes the
+// same direction in every replay. fabs is the exception, since its
+// derivative is recorded with a sign instruction rather than a branch.
+// Multiplication by an exact constant zero is recorded as zero, as it is in
+// most tracing tools, even though that drops NaNs from the other operand.
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "differentiation.h"
+#include "optimize.h"
+#include "program.h"
+#include "tape.h"
+#include "vector.h"
+
+namespace simple_differentiation {
+
+// A scalar that records every operation applied to it in a Program, while
+// also computing its value so that comparisons still work. Values not
+// derived from a program input are constants and are not recorded.
+template <class T>
+class TracedValue {
+ public:
+  TracedValue() : value_(), program_(NULL), node_(-1) { }
+
+  TracedValue(const T& value) : value_(value), program_(NULL), node_(-1) { }
+
+  TracedValue(const T& value, Program<T>* program, int node)
+      : value_(value), program_(program), node_(node) { }
+
+  const T& value() const { return value_; }
+  Program<T>* program() const { return program_; }
+  int node() const { return node_; }
+  bool is_constant() const { return program_ == NULL; }
+
+  // Returns the node holding this value in program, adding a constant if
+  // there is none yet.
+  int NodeIn(Program<T>* program) const {
+    return is_constant() ? program->AddConstant(value_) : node_;
+  }
+
+  TracedValue operator-() const { return Unary(kNegate, *this, -value_); }
+
+  TracedValue& operator+=(const TracedValue& rhs) {
+    return *this = *this + rhs;
+  }
+  TracedValue& operator-=(const TracedValue& rhs) {
+    return *this = *this - rhs;
+  }
+  TracedValue& operator*=(const TracedValue& rhs) {
+    return *this = *this * rhs;
+  }
+  TracedValue& operator/=(const TracedValue& rhs) {
+    return *this = *this / rhs;
+  }
+
+  friend TracedValue operator+(const TracedValue& lhs,
+                               const TracedValue& rhs) {
+    return Binary(kAdd, lhs, rhs, lhs.value_ + rhs.value_);
+  }
+
+  friend TracedValue operator-(const TracedValue& lhs,
+                               const TracedValue& rhs) {
+    return Binary(kSubtract, lhs, rhs, lhs.value_ - rhs.value_);
+  }
+
+  friend TracedValue operator*(const TracedValue& lhs,
+                               const TracedValue& rhs) {
+    return Binary(kMultiply, lhs, rhs, lhs.value_ * rhs.value_);
+  }
+
+  friend TracedValue operator/(const TracedValue& lhs,
+                               const TracedValue& rhs) {
+    return Binary(kDivide, lhs, rhs, lhs.value_ / rhs.value_);
+  }
+
+  friend bool operator==(const TracedValue& lhs, const TracedValue& rhs) {
+    return lhs.value_ == rhs.value_;
+  }
+  friend bool operator!=(const TracedValue& lhs, const TracedValue& rhs) {
+    return lhs.value_ != rhs.value_;
+  }
+  friend bool operator<(const TracedValue& lhs, const TracedValue& rhs) {
+    return lhs.value_ < rhs.value_;
+  }
+  friend bool operator>(const TracedValue& lhs, const TracedValue& rhs) {
+    return lhs.value_ > rhs.value_;
+  }
+  friend bool operator<=(const TracedValue& lhs, const TracedValue& rhs) {
+    return lhs.value_ <= rhs.value_;
+  }
+  friend bool operator>=(const TracedValue& lhs, const TracedValue& rhs) {
+    return lhs.value_ >= rhs.value_;
+  }
+
+  friend TracedValue Sign(const TracedValue& x) {
+    return Unary(kSign, x, x.value_ < T() ? T(-1) : T(1));
+  }
+
+  friend TracedValue sin(const TracedValue& x) {
+    using std::sin;
+    return Unary(kSin, x, sin(x.value_));
+  }
+
+  friend TracedValue cos(const TracedValue& x) {
+    using std::cos;
+    return Unary(kCos, x, cos(x.value_));
+  }
+
+  friend TracedValue tan(const TracedValue& x) {
+    using std::tan;
+    return Unary(kTan, x, tan(x.value_));
+  }
+
+  friend TracedValue asin(const TracedValue& x) {
+    using std::asin;
+    return Unary(kAsin, x, asin(x.value_));
+  }
+
+  friend TracedValue acos(const TracedValue& x) {
+    using std::acos;
+    return Unary(kAcos, x, acos(x.value_));
+  }
+
+  friend TracedValue atan(const TracedValue& x) {
+    using std::atan;
+    return Unary(kAtan, x, atan(x.value_));
+  }
+
+  friend TracedValue fabs(const TracedValue& x) {
+    using std::fabs;
+    return Unary(kFabs, x, fabs(x.value_));
+  }
+
+  friend TracedValue sqrt(const TracedValue& x) {
+    using std::sqrt;
+    return Unary(kSqrt, x, sqrt(x.value_));
+  }
+
+  friend TracedValue exp(const TracedValue& x) {
+    using std::exp;
+    return Unary(kExp, x, exp(x.value_));
+  }
+
+  friend TracedValue log(const TracedValue& x) {
+    using std::log;
+    return Unary(kLog, x, log(x.value_));
+  }
+
+  friend TracedValue pow(const TracedValue& x, const TracedValue& exponent) {
+    using std::pow;
+    return Binary(kPow, x, exponent, pow(x.value_, exponent.value_));
+  }
+
+ private:
+  static TracedValue Unary(Opcode opcode,
+                           const TracedValue& x,
+                           const T& value) {
+    if (x.is_constant()) {
+      return TracedValue(value);
+    }
+    return TracedValue(value, x.program_,
+                       x.program_->AddInstruction(opcode, x.node_));
+  }
+
+  static TracedValue Binary(Opcode opcode,
+                            const TracedValue& lhs,
+                            const TracedValue& rhs,
+                            const T& value) {
+    if (lhs.is_constant() && rhs.is_constant()) {
+      return TracedValue(value);
+    }
+    // The tape seeds adjoints with exact zeros and ones, so skip the
+    // identities they produce.
+    switch (opcode) {
+      case kAdd:
+        if (lhs.IsConstant(T(0))) return rhs;
+        if (rhs.IsConstant(T(0))) return lhs;
+        break;
+      case kSubtract:
+        if (rhs.IsConstant(T(0))) return lhs;
+        break;
+      case kMultiply:
+        if (lhs.IsConstant(T(0)) || rhs.IsConstant(T(0))) {
+          return TracedValue(T(0));
+        }
+        if (lhs.IsConstant(T(1))) return rhs;
+        if (rhs.IsConstant(T(1))) return lhs;
+        break;
+      case kDivide:
+        if (rhs.IsConstant(T(1))) return lhs;
+        break;
+      default:
+        break;
+    }
+    Program<T>* program = lhs.is_constant() ? rhs.program_ : lhs.program_;
+    int lhs_node = lhs.NodeIn(program);
+    int rhs_node = rhs.NodeIn(program);
+    return TracedValue(value, program,
+                       program->AddInstruction(opcode, lhs_node, rhs_node));
+  }
+
+  bool IsConstant(const T& value) const {
+    return is_constant() && value_ == value;
+  }
+
+  T value_;
+  Program<T>* program_;
+  int node_;
+};
+
+// The generic fabs branches on the sign of its argument, which would fix the
+// sign of the derivative at trace time. Recording the sign keeps replays
+// correct on either side of zero.
+template <class T, class V>
+DifferentiationVariable<TracedValue<T>, V> fabs(
+    DifferentiationVariable<TracedValue<T>, V> x) {
+  TracedValue<T> sign = Sign(x.value());
+  return std::move(x) * sign;
+}
+
+// A traced function together with its gradient. Output 0 of the program is
+// the function value and output 1 + j is the derivative with respect to
+// input j.
+template <class T>
+class CompiledGradient {
+ public:
+  explicit CompiledGradient(const Program<T>& program)
+      : program_(program), outputs_(program.num_outputs()) { }
+
+  // Returns f(x) and stores its gradient in *gradient, if gradient is not
+  // NULL. x must have as many entries as the point f was traced at. The
+  // scratch buffers are reused, so a CompiledGradient must not be evaluated
+  // from two threads at once.
+  T Evaluate(const std::vector<T>& x, Vector<T>* gradient) {
+    program_.Run(x.data(), outputs_.data(), &values_);
+    if (gradient != NULL) {
+      gradient->assign(outputs_.begin() + 1, outputs_.end());
+    }
+    return outputs_[0];
+  }
+
+  int num_inputs() const { return program_.num_outputs() - 1; }
+  const Program<T>& program() const { return program_; }
+
+ private:
+  Program<T> program_;
+  std::vector<T> values_;
+  std::vector<T> outputs_;
+};
+
+// Traces f and its gradient at x into a program whose output 0 is f and
+// whose output 1 + j is the derivative with respect to x[j].
+template <class T, class F>
+Program<T> TraceGradient(const F& f, const std::vector<T>& x) {
+  typedef TracedValue<T> Traced;
+  typedef DifferentiationVariable<Traced, TapeGradient<Traced> > Variable;
+  int n = static_cast<int>(x.size());
+
+  Program<T> program;
+  DifferentiationContext<Traced, TapeGradient<Traced> > context(n);
+  std::vector<Variable> inputs;
+  inputs.reserve(n);
+  for (int j = 0; j < n; ++j) {
+    Traced input(x[j], &program, program.AddInput(j));
+    inputs.push_back(context.MakeVariable(j, input));
+  }
+  Variable y = f(inputs);
+  Vector<Traced> gradient = context.Backward(y);
+
+  program.AddOutput(y.value().NodeIn(&program));
+  for (int j = 0; j < n; ++j) {
+    program.AddOutput(gradient[j].NodeIn(&program));
+  }
+  return program;
+}
+
+// Traces f and its gradient at x and optimizes the result for replay.
+template <class T, class F>
+CompiledGradient<T> CompileGradient(const F& f, const std::vector<T>& x) {
+  return CompiledGradient<T>(Optimize(TraceGradient(f, x)));
+}
+
+}  // namespace simple_differentiation
+
+#endif  // TRACE_H_
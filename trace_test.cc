@@ -0,0 +1,89 @@
+
+#include "trace.h"
+#include "differentiation.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::CompileGradient;
+using simple_differentiation::CompiledGradient;
+using simple_differentiation::DifferentiationContext;
+using simple_differentiation::DifferentiationVariable;
+using simple_differentiation::Program;
+using simple_differentiation::Vector;
+using simple_differentiation::kAdd;
+using simple_differentiation::kMultiply;
+using simple_differentiation::kSin;
+
+struct Objective {
+  template <class Variable>
+  Variable operator()(const std::vector<Variable>& x) const {
+    Variable sum = x[0] * x[1] / (1.0 + x[2] * x[2]);
+    for (std::size_t i = 1; i < x.size(); ++i) {
+      sum += sin(x[i - 1]) * exp(x[i] / 2.0) - fabs(x[i] - x[i - 1]);
+      sum += 2.0 * atan(x[i]) + sqrt(x[i] * x[i] + 1.0) - log(2.0 + cos(x[i]));
+      sum -= pow(x[i] * x[i] + 1.0, 1.5) / tan(x[i] / 4.0 + 1.0);
+      sum += asin(x[i] / 3.0) * acos(x[i - 1] / 3.0);
+    }
+    return sum;
+  }
+};
+
+TEST(TraceTest, Program) {
+  Program<double> program;
+  int x = program.AddInput(0);
+  int y = program.AddInput(1);
+  int sum = program.AddInstruction(kAdd, x, program.AddConstant(2.0));
+  program.AddOutput(program.AddInstruction(kMultiply, sum, y));
+  program.AddOutput(program.AddInstruction(kSin, x));
+  EXPECT_EQ(2, program.num_inputs());
+  EXPECT_EQ(2, program.num_outputs());
+
+  double inputs[2] = {0.5, 3.0};
+  double outputs[2];
+  std::vector<double> values;
+  program.Run(inputs, outputs, &values);
+  EXPECT_EQ(7.5, outputs[0]);
+  EXPECT_EQ(sin(0.5), outputs[1]);
+}
+
+TEST(TraceTest, ReplayMatchesFreshEvaluation) {
+  std::vector<double> x0 = {0.3, -0.5, 1.1, 0.2, -0.9};
+  CompiledGradient<double> compiled = CompileGradient(Objective(), x0);
+  EXPECT_EQ(5, compiled.num_inputs());
+  int program_size = compiled.program().size();
+
+  // Every difference changes sign between the traced point and the last
+  // replayed one.
+  std::vector<std::vector<double> > points = {
+    x0, {1.0, 0.2, -0.4, 0.9, -0.1}, {-0.3, 0.5, -1.1, -0.2, 0.9}};
+  for (std::size_t p = 0; p < points.size(); ++p) {
+    const std::vector<double>& x = points[p];
+    DifferentiationContext<double> context(5);
+    std::vector<DifferentiationVariable<double> > inputs;
+    for (int j = 0; j < 5; ++j) {
+      inputs.push_back(context.MakeVariable(j, x[j]));
+    }
+    DifferentiationVariable<double> expected = Objective()(inputs);
+
+    Vector<double> gradient;
+    double value = compiled.Evaluate(x, &gradient);
+    EXPECT_NEAR(expected.value(), value, 1e-12);
+    ASSERT_EQ(5, gradient.size());
+    for (int j = 0; j < 5; ++j) {
+      EXPECT_NEAR(expected.gradient()[j], gradient[j], 1e-12);
+    }
+  }
+  EXPECT_EQ(program_size, compiled.program().size());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
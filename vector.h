@@ -1,16 +1,196 @@
 // vector.h
 //
 // An STL vector with basic arithmetic operators.
+//
+// Arithmetic on Vectors builds lightweight expression objects instead of
+// temporaries. An expression is only evaluated when it is assigned to (or
+// used to construct) a Vector, and then in a single loop, so something like
+// a*x + b*y makes one pass over memory and at most one allocation.
+//
+// Scalars may be of a different floating point type than the elements. In
+// particular Vector<float> serves as the gradient type for double values,
+//
+//   DifferentiationContext<double, Vector<float> > context(n);
+//
+// which halves the memory traffic of gradient propagation on problems large
+// enough for it to dominate. Values keep full precision; each operation
+// rounds its local derivatives to float once and updates the gradient with
+// the float kernels, so every operation adds an error of about a float ulp
+// to the gradient. For the objectives in differentiation_bench.cc this
+// leaves whole gradients within about 1e-7 of the double ones, relative to
+// their norm, at around half the time for 512 variables.
 
 #ifndef VECTOR_H_
 #define VECTOR_H_
 
+#include <type_traits>
 #include <vector>
 
+#include "stats.h"
+#include "vector_kernels.h"
+
 namespace simple_differentiation {
 
+template <class T, class Allocator>
+class Vector;
+
+namespace internal {
+
+// Whether U is an arithmetic scalar of another type than the elements T.
+// Such scalars are rounded to T once, so that T's kernels apply.
+template <class T, class U>
+struct IsMixedScalar
+    : std::integral_constant<bool, std::is_arithmetic<T>::value &&
+                                       std::is_arithmetic<U>::value &&
+                                       !std::is_same<T, U>::value> { };
+
+// Whether gradients of type V have a length chosen at run time, so that V()
+// is not a zero gradient of the right length.
+template <class V>
+struct HasRunTimeSize : std::false_type { };
+
+template <class T, class Allocator>
+struct HasRunTimeSize<Vector<T, Allocator> > : std::true_type { };
+
+}  // namespace internal
+
+// Base class of everything that can appear in a vector expression. E is the
+// derived expression type.
+template <class E>
+class VectorExpression {
+ public:
+  const E& derived() const { return static_cast<const E&>(*this); }
+};
+
+// Expressions hold their operands by value, since they are usually
+// temporaries, except for Vectors, which are held by reference. As a
+// consequence an expression must not outlive the Vectors it refers to, so
+// store results in a Vector rather than in an auto variable.
+template <class E>
+struct ExpressionOperand {
+  typedef const E type;
+};
+
+template <class T, class Allocator>
+struct ExpressionOperand<Vector<T, Allocator> > {
+  typedef const Vector<T, Allocator>& type;
+};
+
+template <class E>
+class VectorNegation : public VectorExpression<VectorNegation<E> > {
+ public:
+  typedef typename E::value_type value_type;
+  typedef typename E::size_type size_type;
+
+  typedef typename E::allocator_type allocator_type;
+
+  explicit VectorNegation(const E& operand) : operand_(operand) { }
+
+  size_type size() const { return operand_.size(); }
+  allocator_type get_allocator() const { return operand_.get_allocator(); }
+  value_type operator[](size_type i) const { return -operand_[i]; }
+
+  const E& operand() const { return operand_; }
+
+ private:
+  typename ExpressionOperand<E>::type operand_;
+};
+
+template <class L, class R>
+class VectorSum : public VectorExpression<VectorSum<L, R> > {
+ public:
+  typedef typename L::value_type value_type;
+  typedef typename L::size_type size_type;
+
+  typedef typename L::allocator_type allocator_type;
+
+  VectorSum(const L& lhs, const R& rhs) : lhs_(lhs), rhs_(rhs) { }
+
+  size_type size() const { return lhs_.size(); }
+  allocator_type get_allocator() const { return lhs_.get_allocator(); }
+  value_type operator[](size_type i) const { return lhs_[i] + rhs_[i]; }
+
+  const L& lhs() const { return lhs_; }
+  const R& rhs() const { return rhs_; }
+
+ private:
+  typename ExpressionOperand<L>::type lhs_;
+  typename ExpressionOperand<R>::type rhs_;
+};
+
+template <class L, class R>
+class VectorDifference : public VectorExpression<VectorDifference<L, R> > {
+ public:
+  typedef typename L::value_type value_type;
+  typedef typename L::size_type size_type;
+
+  typedef typename L::allocator_type allocator_type;
+
+  VectorDifference(const L& lhs, const R& rhs) : lhs_(lhs), rhs_(rhs) { }
+
+  size_type size() const { return lhs_.size(); }
+  allocator_type get_allocator() const { return lhs_.get_allocator(); }
+  value_type operator[](size_type i) const { return lhs_[i] - rhs_[i]; }
+
+  const L& lhs() const { return lhs_; }
+  const R& rhs() const { return rhs_; }
+
+ private:
+  typename ExpressionOperand<L>::type lhs_;
+  typename ExpressionOperand<R>::type rhs_;
+};
+
+// An expression multiplied by a scalar.
+template <class E, class U>
+class VectorScale : public VectorExpression<VectorScale<E, U> > {
+ public:
+  typedef typename E::value_type value_type;
+  typedef typename E::size_type size_type;
+
+  typedef typename E::allocator_type allocator_type;
+
+  VectorScale(const E& operand, const U& scalar)
+      : operand_(operand), scalar_(scalar) { }
+
+  size_type size() const { return operand_.size(); }
+  allocator_type get_allocator() const { return operand_.get_allocator(); }
+  value_type operator[](size_type i) const { return operand_[i] * scalar_; }
+
+  const E& operand() const { return operand_; }
+  const U& scalar() const { return scalar_; }
+
+ private:
+  typename ExpressionOperand<E>::type operand_;
+  U scalar_;
+};
+
+// An expression divided by a scalar.
+template <class E, class U>
+class VectorQuotient : public VectorExpression<VectorQuotient<E, U> > {
+ public:
+  typedef typename E::value_type value_type;
+  typedef typename E::size_type size_type;
+
+  typedef typename E::allocator_type allocator_type;
+
+  VectorQuotient(const E& operand, const U& scalar)
+      : operand_(operand), scalar_(scalar) { }
+
+  size_type size() const { return operand_.size(); }
+  allocator_type get_allocator() const { return operand_.get_allocator(); }
+  value_type operator[](size_type i) const { return operand_[i] / scalar_; }
+
+  const E& operand() const { return operand_; }
+  const U& scalar() const { return scalar_; }
+
+ private:
+  typename ExpressionOperand<E>::type operand_;
+  U scalar_;
+};
+
 template <class T, class Allocator = std::allocator<T> >
-class Vector : public std::vector<T, Allocator> {
+class Vector : public std::vector<T, Allocator>,
+               public VectorExpression<Vector<T, Allocator> > {
  public:
   typedef typename std::vector<T, Allocator> base_type;
   typedef typename base_type::size_type size_type;
@@ -18,83 +198,278 @@ class Vector : public std::vector<T, Allocator> {
   explicit Vector(const Allocator& allocator = Allocator())
       : base_type(allocator) { }
   explicit Vector(size_type n, const T& value = T())
-      : base_type(n, value) { } 
+      : base_type(n, value) {
+    CountAllocation();
+  }
+  Vector(size_type n, const T& value, const Allocator& allocator)
+      : base_type(n, value, allocator) {
+    CountAllocation();
+  }
 
   template <class InputIterator>
   Vector(InputIterator first,
          InputIterator last,
          const Allocator& allocator = Allocator())
-      : base_type(first, last, allocator) { }
+      : base_type(first, last, allocator) {
+    CountAllocation();
+  }
 
-  Vector(const Vector<T, Allocator>& x) : base_type(x) { }
+  // The copy operations are only spelled out to count them; see stats.h.
+  Vector(const Vector& other) : base_type(other) {
+    CountAllocation();
+    CountWrite();
+  }
+  Vector(Vector&& other) = default;
 
-  virtual ~Vector() { };
+  Vector& operator=(const Vector& rhs) {
+    size_type capacity = this->capacity();
+    base_type::operator=(rhs);
+    CountGrowth(capacity);
+    CountWrite();
+    return *this;
+  }
+  Vector& operator=(Vector&& rhs) = default;
 
-  Vector operator-() const {
-    Vector result(this->size());
-    for (size_type i = 0; i < this->size(); ++i) {
-      result[i] = -(*this)[i];
-    }
-    return result;
+  // The result uses the allocator of the expression's leftmost Vector.
+  template <class E>
+  Vector(const VectorExpression<E>& x)
+      : base_type(x.derived().size(), T(), x.derived().get_allocator()) {
+    CountAllocation();
+    Assign(x.derived());
+    CountWrite();
   }
 
-  Vector& operator+=(const Vector& rhs) {
-    for (size_type i = 0; i < this->size(); ++i) {
-      (*this)[i] += rhs[i];
-    }
+  template <class E>
+  Vector& operator=(const VectorExpression<E>& rhs) {
+    size_type capacity = this->capacity();
+    this->resize(rhs.derived().size());
+    CountGrowth(capacity);
+    Assign(rhs.derived());
+    CountWrite();
     return *this;
   }
 
-  Vector& operator-=(const Vector& rhs) {
-    for (size_type i = 0; i < this->size(); ++i) {
-      (*this)[i] -= rhs[i];
-    }
+  template <class E>
+  Vector& operator+=(const VectorExpression<E>& rhs) {
+    AddAssign(rhs.derived());
+    CountWrite();
+    return *this;
+  }
+
+  template <class E>
+  Vector& operator-=(const VectorExpression<E>& rhs) {
+    SubtractAssign(rhs.derived());
+    CountWrite();
+    return *this;
+  }
+
+  Vector& operator*=(const T& rhs) {
+    kernels::Scale(this->data(), rhs, this->data(), this->size());
+    CountWrite();
     return *this;
   }
 
   template <class U>
   Vector& operator*=(const U& rhs) {
-    for (size_type i = 0; i < this->size(); ++i) {
-      (*this)[i] *= rhs;
-    }
+    MultiplyAssign(rhs, internal::IsMixedScalar<T, U>());
+    CountWrite();
+    return *this;
+  }
+
+  Vector& operator/=(const T& rhs) {
+    kernels::Divide(this->data(), rhs, this->data(), this->size());
+    CountWrite();
     return *this;
   }
 
   template <class U>
   Vector& operator/=(const U& rhs) {
+    DivideAssign(rhs, internal::IsMixedScalar<T, U>());
+    CountWrite();
+    return *this;
+  }
+
+ private:
+  void CountAllocation() const {
+    SIMPLE_DIFFERENTIATION_COUNT(allocations, this->capacity() > 0 ? 1 : 0);
+  }
+
+  void CountGrowth(size_type previous_capacity) const {
+    (void)previous_capacity;
+    SIMPLE_DIFFERENTIATION_COUNT(
+        allocations, this->capacity() != previous_capacity ? 1 : 0);
+  }
+
+  void CountWrite() const {
+    SIMPLE_DIFFERENTIATION_COUNT(bytes_written,
+                                 static_cast<long>(this->size() * sizeof(T)));
+  }
+
+  // Element i of the expression may read element i of *this, but no other
+  // element, so evaluating in place is safe.
+  template <class E>
+  void Assign(const E& expression) {
     for (size_type i = 0; i < this->size(); ++i) {
-      (*this)[i] /= rhs;
+      (*this)[i] = expression[i];
+    }
+  }
+
+  // The common expression shapes map directly onto vectorized kernels.
+
+  template <class A>
+  void Assign(const VectorNegation<Vector<T, A> >& expression) {
+    kernels::Negate(expression.operand().data(), this->data(), this->size());
+  }
+
+  template <class A0, class A1>
+  void Assign(const VectorSum<Vector<T, A0>, Vector<T, A1> >& expression) {
+    kernels::Add(expression.lhs().data(), expression.rhs().data(),
+                 this->data(), this->size());
+  }
+
+  template <class A0, class A1>
+  void Assign(
+      const VectorDifference<Vector<T, A0>, Vector<T, A1> >& expression) {
+    kernels::Subtract(expression.lhs().data(), expression.rhs().data(),
+                      this->data(), this->size());
+  }
+
+  template <class A>
+  void Assign(const VectorScale<Vector<T, A>, T>& expression) {
+    kernels::Scale(expression.operand().data(), expression.scalar(),
+                   this->data(), this->size());
+  }
+
+  template <class A>
+  void Assign(const VectorQuotient<Vector<T, A>, T>& expression) {
+    kernels::Divide(expression.operand().data(), expression.scalar(),
+                    this->data(), this->size());
+  }
+
+  template <class A0, class A1>
+  void Assign(const VectorSum<VectorScale<Vector<T, A0>, T>,
+                              VectorScale<Vector<T, A1>, T> >& expression) {
+    kernels::Axpby(expression.lhs().operand().data(),
+                   expression.lhs().scalar(),
+                   expression.rhs().operand().data(),
+                   expression.rhs().scalar(),
+                   this->data(), this->size());
+  }
+
+  // Mixed precision versions of the scaled shapes above.
+
+  template <class A, class U>
+  typename std::enable_if<internal::IsMixedScalar<T, U>::value>::type Assign(
+      const VectorScale<Vector<T, A>, U>& expression) {
+    kernels::Scale(expression.operand().data(),
+                   static_cast<T>(expression.scalar()), this->data(),
+                   this->size());
+  }
+
+  template <class A, class U>
+  typename std::enable_if<internal::IsMixedScalar<T, U>::value>::type Assign(
+      const VectorQuotient<Vector<T, A>, U>& expression) {
+    kernels::Divide(expression.operand().data(),
+                    static_cast<T>(expression.scalar()), this->data(),
+                    this->size());
+  }
+
+  template <class A0, class A1, class U0, class U1>
+  typename std::enable_if<internal::IsMixedScalar<T, U0>::value &&
+                          internal::IsMixedScalar<T, U1>::value>::type
+  Assign(const VectorSum<VectorScale<Vector<T, A0>, U0>,
+                         VectorScale<Vector<T, A1>, U1> >& expression) {
+    kernels::Axpby(expression.lhs().operand().data(),
+                   static_cast<T>(expression.lhs().scalar()),
+                   expression.rhs().operand().data(),
+                   static_cast<T>(expression.rhs().scalar()),
+                   this->data(), this->size());
+  }
+
+  template <class E>
+  void AddAssign(const E& expression) {
+    for (size_type i = 0; i < this->size(); ++i) {
+      (*this)[i] += expression[i];
     }
-    return *this;
   }
 
-  Vector operator+(const Vector& rhs) const {
-    return Vector(*this) += rhs;
+  template <class A>
+  void AddAssign(const Vector<T, A>& x) {
+    kernels::Add(this->data(), x.data(), this->data(), this->size());
+  }
+
+  template <class E>
+  void SubtractAssign(const E& expression) {
+    for (size_type i = 0; i < this->size(); ++i) {
+      (*this)[i] -= expression[i];
+    }
+  }
+
+  template <class A>
+  void SubtractAssign(const Vector<T, A>& x) {
+    kernels::Subtract(this->data(), x.data(), this->data(), this->size());
+  }
+
+  template <class U>
+  void MultiplyAssign(const U& rhs, std::false_type) {
+    for (size_type i = 0; i < this->size(); ++i) {
+      (*this)[i] *= rhs;
+    }
   }
 
-  Vector operator-(const Vector& rhs) const {
-    return Vector(*this) -= rhs;
+  template <class U>
+  void MultiplyAssign(const U& rhs, std::true_type) {
+    kernels::Scale(this->data(), static_cast<T>(rhs), this->data(),
+                   this->size());
   }
 
   template <class U>
-  Vector operator*(const U& rhs) const {
-    return Vector(*this) *= rhs;
+  void DivideAssign(const U& rhs, std::false_type) {
+    for (size_type i = 0; i < this->size(); ++i) {
+      (*this)[i] /= rhs;
+    }
   }
 
   template <class U>
-  Vector operator/(const U& rhs) const {
-    return Vector(*this) /= rhs;
+  void DivideAssign(const U& rhs, std::true_type) {
+    kernels::Divide(this->data(), static_cast<T>(rhs), this->data(),
+                    this->size());
   }
 };
 
+template <class E>
+VectorNegation<E> operator-(const VectorExpression<E>& x) {
+  return VectorNegation<E>(x.derived());
+}
+
+template <class L, class R>
+VectorSum<L, R> operator+(const VectorExpression<L>& lhs,
+                          const VectorExpression<R>& rhs) {
+  return VectorSum<L, R>(lhs.derived(), rhs.derived());
+}
+
+template <class L, class R>
+VectorDifference<L, R> operator-(const VectorExpression<L>& lhs,
+                                 const VectorExpression<R>& rhs) {
+  return VectorDifference<L, R>(lhs.derived(), rhs.derived());
+}
+
+template <class E, class U>
+VectorScale<E, U> operator*(const VectorExpression<E>& lhs, const U& rhs) {
+  return VectorScale<E, U>(lhs.derived(), rhs);
+}
+
 // Handle cases where the scalar is on the left.
-template <class T, class Allocator, class U>
-Vector<T, Allocator> operator*(const U& lhs,
-                               const Vector<T, Allocator>& rhs) {
-  return rhs * lhs;
+template <class E, class U>
+VectorScale<E, U> operator*(const U& lhs, const VectorExpression<E>& rhs) {
+  return VectorScale<E, U>(rhs.derived(), lhs);
+}
+
+template <class E, class U>
+VectorQuotient<E, U> operator/(const VectorExpression<E>& lhs, const U& rhs) {
+  return VectorQuotient<E, U>(lhs.derived(), rhs);
 }
 
 }  // namespace simple_differentiation
 
 #endif  // VECTOR_H_
-
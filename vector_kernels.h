@@ -0,0 +1,411 @@
+// vector_kernels.h
+//
+// Explicitly vectorized loops for the elementwise operations that dominate
+// gradient propagation. Vector calls these for double and float elements;
+// other element types use the generic templates, which are plain loops.
+//
+// The x86 implementations (SSE2, AVX2 and AVX-512) are compiled with
+// per-function target attributes, so no special compiler flags are needed,
+// and the best one the running CPU supports is picked on first use. Every
+// implementation performs the same operations in the same order as the
+// scalar loop, so results do not depend on which one runs. For that the
+// kernels that multiply and add, scalar ones included, are compiled without
+// floating-point contraction on GCC and clang, since a fused multiply-add
+// rounds once where the separate operations round twice. Other compilers
+// may still contract the scalar loops if their flags allow it.
+//
+// All kernels allow out to alias x or y.
+
+#ifndef VECTOR_KERNELS_H_
+#define VECTOR_KERNELS_H_
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMPLE_DIFFERENTIATION_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// SIMPLE_DIFFERENTIATION_NO_CONTRACT goes before a function and
+// SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY at the start of its body; between
+// them they keep the compiler from fusing the function's multiplies and
+// adds, whatever -ffp-contract or -march says.
+#if defined(__clang__)
+#define SIMPLE_DIFFERENTIATION_NO_CONTRACT
+#define SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY \
+  _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define SIMPLE_DIFFERENTIATION_NO_CONTRACT \
+  __attribute__((optimize("fp-contract=off")))
+#define SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY
+#else
+#define SIMPLE_DIFFERENTIATION_NO_CONTRACT
+#define SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY
+#endif
+
+namespace simple_differentiation {
+namespace kernels {
+
+// out = x + y
+template <class T>
+void Add(const T* x, const T* y, T* out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = x[i] + y[i];
+  }
+}
+
+// out = x - y
+template <class T>
+void Subtract(const T* x, const T* y, T* out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = x[i] - y[i];
+  }
+}
+
+// out = -x
+template <class T>
+void Negate(const T* x, T* out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = -x[i];
+  }
+}
+
+// out = x * a
+template <class T>
+void Scale(const T* x, const T& a, T* out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = x[i] * a;
+  }
+}
+
+// out = x / a
+template <class T>
+void Divide(const T* x, const T& a, T* out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = x[i] / a;
+  }
+}
+
+// out = x*a + y*b
+template <class T>
+SIMPLE_DIFFERENTIATION_NO_CONTRACT void Axpby(const T* x, const T& a,
+                                              const T* y, const T& b, T* out,
+                                              std::size_t n) {
+  SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = x[i] * a + y[i] * b;
+  }
+}
+
+// One implementation of each double and float kernel.
+struct KernelTable {
+  const char* name;
+  void (*add)(const double* x, const double* y, double* out, std::size_t n);
+  void (*subtract)(const double* x, const double* y, double* out,
+                   std::size_t n);
+  void (*negate)(const double* x, double* out, std::size_t n);
+  void (*scale)(const double* x, double a, double* out, std::size_t n);
+  void (*divide)(const double* x, double a, double* out, std::size_t n);
+  void (*axpby)(const double* x, double a, const double* y, double b,
+                double* out, std::size_t n);
+
+  void (*float_add)(const float* x, const float* y, float* out,
+                    std::size_t n);
+  void (*float_subtract)(const float* x, const float* y, float* out,
+                         std::size_t n);
+  void (*float_negate)(const float* x, float* out, std::size_t n);
+  void (*float_scale)(const float* x, float a, float* out, std::size_t n);
+  void (*float_divide)(const float* x, float a, float* out, std::size_t n);
+  void (*float_axpby)(const float* x, float a, const float* y, float b,
+                      float* out, std::size_t n);
+};
+
+namespace scalar {
+
+#define SIMPLE_DIFFERENTIATION_DEFINE_SCALAR_KERNELS(SCALAR)                  \
+  inline void Add(const SCALAR* x, const SCALAR* y, SCALAR* out,              \
+                  std::size_t n) {                                            \
+    kernels::Add<SCALAR>(x, y, out, n);                                       \
+  }                                                                           \
+  inline void Subtract(const SCALAR* x, const SCALAR* y, SCALAR* out,         \
+                       std::size_t n) {                                       \
+    kernels::Subtract<SCALAR>(x, y, out, n);                                  \
+  }                                                                           \
+  inline void Negate(const SCALAR* x, SCALAR* out, std::size_t n) {           \
+    kernels::Negate<SCALAR>(x, out, n);                                       \
+  }                                                                           \
+  inline void Scale(const SCALAR* x, SCALAR a, SCALAR* out, std::size_t n) {  \
+    kernels::Scale<SCALAR>(x, a, out, n);                                     \
+  }                                                                           \
+  inline void Divide(const SCALAR* x, SCALAR a, SCALAR* out, std::size_t n) { \
+    kernels::Divide<SCALAR>(x, a, out, n);                                    \
+  }                                                                           \
+  inline void Axpby(const SCALAR* x, SCALAR a, const SCALAR* y, SCALAR b,     \
+                    SCALAR* out, std::size_t n) {                             \
+    kernels::Axpby<SCALAR>(x, a, y, b, out, n);                               \
+  }
+
+SIMPLE_DIFFERENTIATION_DEFINE_SCALAR_KERNELS(double)
+SIMPLE_DIFFERENTIATION_DEFINE_SCALAR_KERNELS(float)
+
+#undef SIMPLE_DIFFERENTIATION_DEFINE_SCALAR_KERNELS
+
+// Each entry picks the overload for its element type.
+inline const KernelTable& Table() {
+  static const KernelTable table = {
+    "scalar", Add, Subtract, Negate, Scale, Divide, Axpby,
+    Add, Subtract, Negate, Scale, Divide, Axpby
+  };
+  return table;
+}
+
+}  // namespace scalar
+
+#ifdef SIMPLE_DIFFERENTIATION_X86_KERNELS
+
+// AVX-512 implies FMA, and the compiler would otherwise contract the
+// multiplies and adds below into fused operations that round differently
+// from the scalar loop.
+#if defined(__clang__)
+#define SIMPLE_DIFFERENTIATION_KERNEL(TARGET) __attribute__((target(TARGET)))
+#else
+#define SIMPLE_DIFFERENTIATION_KERNEL(TARGET) \
+  __attribute__((target(TARGET), optimize("fp-contract=off")))
+#endif
+
+// Defines the kernels for one instruction set and element type in namespace
+// isa. Each loop handles WIDTH lanes at a time and finishes with the scalar
+// loop. Negate flips the sign bit with XOR, as the scalar loop does, rather
+// than multiplying by -1, which costs more and need not keep the payload and
+// sign of a NaN.
+#define SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(isa, TARGET, SCALAR, REG,        \
+                                              WIDTH, LOAD, STORE, SET1, ADD,  \
+                                              SUB, MUL, DIV, XOR)             \
+  namespace isa {                                                             \
+  SIMPLE_DIFFERENTIATION_KERNEL(TARGET) inline void Add(                      \
+      const SCALAR* x, const SCALAR* y, SCALAR* out, std::size_t n) {         \
+    std::size_t i = 0;                                                        \
+    for (; i + WIDTH <= n; i += WIDTH) {                                      \
+      STORE(out + i, ADD(LOAD(x + i), LOAD(y + i)));                          \
+    }                                                                         \
+    kernels::Add<SCALAR>(x + i, y + i, out + i, n - i);                       \
+  }                                                                           \
+  SIMPLE_DIFFERENTIATION_KERNEL(TARGET) inline void Subtract(                 \
+      const SCALAR* x, const SCALAR* y, SCALAR* out, std::size_t n) {         \
+    std::size_t i = 0;                                                        \
+    for (; i + WIDTH <= n; i += WIDTH) {                                      \
+      STORE(out + i, SUB(LOAD(x + i), LOAD(y + i)));                          \
+    }                                                                         \
+    kernels::Subtract<SCALAR>(x + i, y + i, out + i, n - i);                  \
+  }                                                                           \
+  SIMPLE_DIFFERENTIATION_KERNEL(TARGET) inline void Negate(                   \
+      const SCALAR* x, SCALAR* out, std::size_t n) {                          \
+    REG sign_bit = SET1(SCALAR(-0.0));                                        \
+    std::size_t i = 0;                                                        \
+    for (; i + WIDTH <= n; i += WIDTH) {                                      \
+      STORE(out + i, XOR(LOAD(x + i), sign_bit));                             \
+    }                                                                         \
+    kernels::Negate<SCALAR>(x + i, out + i, n - i);                           \
+  }                                                                           \
+  SIMPLE_DIFFERENTIATION_KERNEL(TARGET) inline void Scale(                    \
+      const SCALAR* x, SCALAR a, SCALAR* out, std::size_t n) {                \
+    REG a_lanes = SET1(a);                                                    \
+    std::size_t i = 0;                                                        \
+    for (; i + WIDTH <= n; i += WIDTH) {                                      \
+      STORE(out + i, MUL(LOAD(x + i), a_lanes));                              \
+    }                                                                         \
+    kernels::Scale<SCALAR>(x + i, a, out + i, n - i);                         \
+  }                                                                           \
+  SIMPLE_DIFFERENTIATION_KERNEL(TARGET) inline void Divide(                   \
+      const SCALAR* x, SCALAR a, SCALAR* out, std::size_t n) {                \
+    REG a_lanes = SET1(a);                                                    \
+    std::size_t i = 0;                                                        \
+    for (; i + WIDTH <= n; i += WIDTH) {                                      \
+      STORE(out + i, DIV(LOAD(x + i), a_lanes));                              \
+    }                                                                         \
+    kernels::Divide<SCALAR>(x + i, a, out + i, n - i);                        \
+  }                                                                           \
+  SIMPLE_DIFFERENTIATION_KERNEL(TARGET) inline void Axpby(                    \
+      const SCALAR* x, SCALAR a, const SCALAR* y, SCALAR b, SCALAR* out,      \
+      std::size_t n) {                                                        \
+    SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY                                   \
+    REG a_lanes = SET1(a);                                                    \
+    REG b_lanes = SET1(b);                                                    \
+    std::size_t i = 0;                                                        \
+    for (; i + WIDTH <= n; i += WIDTH) {                                      \
+      STORE(out + i, ADD(MUL(LOAD(x + i), a_lanes),                           \
+                         MUL(LOAD(y + i), b_lanes)));                         \
+    }                                                                         \
+    kernels::Axpby<SCALAR>(x + i, a, y + i, b, out + i, n - i);               \
+  }                                                                           \
+  }  // namespace isa
+
+SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(
+    sse2, "sse2", double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+    _mm_set1_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd, _mm_xor_pd)
+SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(
+    sse2, "sse2", float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+    _mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps, _mm_xor_ps)
+SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(
+    avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+    _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd,
+    _mm256_div_pd, _mm256_xor_pd)
+SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(
+    avx2, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+    _mm256_set1_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+    _mm256_div_ps, _mm256_xor_ps)
+
+// Floating-point XOR needs AVX512DQ, so use the integer one of AVX-512F.
+namespace avx512 {
+
+SIMPLE_DIFFERENTIATION_KERNEL("avx512f") inline __m512d XorPd(__m512d a,
+                                                              __m512d b) {
+  return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a),
+                                              _mm512_castpd_si512(b)));
+}
+
+SIMPLE_DIFFERENTIATION_KERNEL("avx512f") inline __m512 XorPs(__m512 a,
+                                                             __m512 b) {
+  return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a),
+                                              _mm512_castps_si512(b)));
+}
+
+}  // namespace avx512
+
+SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(
+    avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd,
+    _mm512_set1_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd,
+    _mm512_div_pd, XorPd)
+SIMPLE_DIFFERENTIATION_DEFINE_KERNELS(
+    avx512, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps,
+    _mm512_set1_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps,
+    _mm512_div_ps, XorPs)
+
+// The table for one instruction set, once both element types are defined.
+#define SIMPLE_DIFFERENTIATION_DEFINE_KERNEL_TABLE(isa)                       \
+  namespace isa {                                                             \
+  inline const KernelTable& Table() {                                         \
+    static const KernelTable table = {                                        \
+      #isa, Add, Subtract, Negate, Scale, Divide, Axpby,                      \
+      Add, Subtract, Negate, Scale, Divide, Axpby                             \
+    };                                                                        \
+    return table;                                                             \
+  }                                                                           \
+  }  // namespace isa
+
+SIMPLE_DIFFERENTIATION_DEFINE_KERNEL_TABLE(sse2)
+SIMPLE_DIFFERENTIATION_DEFINE_KERNEL_TABLE(avx2)
+SIMPLE_DIFFERENTIATION_DEFINE_KERNEL_TABLE(avx512)
+
+#undef SIMPLE_DIFFERENTIATION_DEFINE_KERNEL_TABLE
+
+#undef SIMPLE_DIFFERENTIATION_DEFINE_KERNELS
+#undef SIMPLE_DIFFERENTIATION_KERNEL
+
+#endif  // SIMPLE_DIFFERENTIATION_X86_KERNELS
+
+// Returns the kernels for the named instruction set ("scalar", "sse2",
+// "avx2" or "avx512"), or NULL if it is unknown or the CPU lacks it.
+inline const KernelTable* FindKernels(const char* name) {
+  if (std::strcmp(name, "scalar") == 0) {
+    return &scalar::Table();
+  }
+#ifdef SIMPLE_DIFFERENTIATION_X86_KERNELS
+  __builtin_cpu_init();
+  if (std::strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2") ? &sse2::Table() : NULL;
+  }
+  if (std::strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2") ? &avx2::Table() : NULL;
+  }
+  if (std::strcmp(name, "avx512") == 0) {
+    return __builtin_cpu_supports("avx512f") ? &avx512::Table() : NULL;
+  }
+#endif
+  return NULL;
+}
+
+inline const KernelTable* SelectKernels() {
+  const char* const preference[] = { "avx512", "avx2", "sse2" };
+  for (int i = 0; i < 3; ++i) {
+    const KernelTable* table = FindKernels(preference[i]);
+    if (table != NULL) {
+      return table;
+    }
+  }
+  return &scalar::Table();
+}
+
+// The fastest kernels the running CPU supports.
+inline const KernelTable& Kernels() {
+  static const KernelTable* const table = SelectKernels();
+  return *table;
+}
+
+// Below this length the dispatch costs more than vectorization saves.
+const std::size_t kMinKernelLength = 16;
+
+// Double and float overloads, which dispatch to the vectorized
+// implementations. They are preferred over the templates above for double
+// and float arguments. MEMBER prefixes the table entries for the type.
+#define SIMPLE_DIFFERENTIATION_DEFINE_DISPATCH(SCALAR, MEMBER)                \
+  inline void Add(const SCALAR* x, const SCALAR* y, SCALAR* out,              \
+                  std::size_t n) {                                            \
+    if (n < kMinKernelLength) {                                               \
+      scalar::Add(x, y, out, n);                                              \
+    } else {                                                                  \
+      Kernels().MEMBER##add(x, y, out, n);                                    \
+    }                                                                         \
+  }                                                                           \
+  inline void Subtract(const SCALAR* x, const SCALAR* y, SCALAR* out,         \
+                       std::size_t n) {                                       \
+    if (n < kMinKernelLength) {                                               \
+      scalar::Subtract(x, y, out, n);                                         \
+    } else {                                                                  \
+      Kernels().MEMBER##subtract(x, y, out, n);                               \
+    }                                                                         \
+  }                                                                           \
+  inline void Negate(const SCALAR* x, SCALAR* out, std::size_t n) {           \
+    if (n < kMinKernelLength) {                                               \
+      scalar::Negate(x, out, n);                                              \
+    } else {                                                                  \
+      Kernels().MEMBER##negate(x, out, n);                                    \
+    }                                                                         \
+  }                                                                           \
+  inline void Scale(const SCALAR* x, const SCALAR& a, SCALAR* out,            \
+                    std::size_t n) {                                          \
+    if (n < kMinKernelLength) {                                               \
+      scalar::Scale(x, a, out, n);                                            \
+    } else {                                                                  \
+      Kernels().MEMBER##scale(x, a, out, n);                                  \
+    }                                                                         \
+  }                                                                           \
+  inline void Divide(const SCALAR* x, const SCALAR& a, SCALAR* out,           \
+                     std::size_t n) {                                         \
+    if (n < kMinKernelLength) {                                               \
+      scalar::Divide(x, a, out, n);                                           \
+    } else {                                                                  \
+      Kernels().MEMBER##divide(x, a, out, n);                                 \
+    }                                                                         \
+  }                                                                           \
+  inline void Axpby(const SCALAR* x, const SCALAR& a, const SCALAR* y,        \
+                    const SCALAR& b, SCALAR* out, std::size_t n) {            \
+    if (n < kMinKernelLength) {                                               \
+      scalar::Axpby(x, a, y, b, out, n);                                      \
+    } else {                                                                  \
+      Kernels().MEMBER##axpby(x, a, y, b, out, n);                            \
+    }                                                                         \
+  }
+
+SIMPLE_DIFFERENTIATION_DEFINE_DISPATCH(double, )
+SIMPLE_DIFFERENTIATION_DEFINE_DISPATCH(float, float_)
+
+#undef SIMPLE_DIFFERENTIATION_DEFINE_DISPATCH
+#undef SIMPLE_DIFFERENTIATION_NO_CONTRACT_BODY
+#undef SIMPLE_DIFFERENTIATION_NO_CONTRACT
+
+}  // namespace kernels
+}  // namespace simple_differentiation
+
+#endif  // VECTOR_KERNELS_H_
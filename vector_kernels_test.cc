@@ -0,0 +1,211 @@
+
+#include "vector_kernels.h"
+#include "vector.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using simple_differentiation::kernels::FindKernels;
+using simple_differentiation::kernels::KernelTable;
+
+std::vector<double> MakeData(std::size_t n, double offset) {
+  std::vector<double> data(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    data[i] = offset + 0.37 * i - 0.01 * i * i;
+  }
+  return data;
+}
+
+// Every available implementation must agree exactly with the scalar one,
+// including for lengths that leave a tail, and when writing in place.
+TEST(VectorKernelsTest, MatchScalar) {
+  const KernelTable* scalar = FindKernels("scalar");
+  ASSERT_TRUE(scalar != NULL);
+  const char* const names[] = { "sse2", "avx2", "avx512" };
+
+  for (int t = 0; t < 3; ++t) {
+    const KernelTable* table = FindKernels(names[t]);
+    if (table == NULL) {
+      continue;
+    }
+    SCOPED_TRACE(names[t]);
+    for (std::size_t n = 0; n < 40; ++n) {
+      std::vector<double> x = MakeData(n, 1.5);
+      std::vector<double> y = MakeData(n, -2.25);
+      std::vector<double> expected(n);
+      std::vector<double> actual(n);
+
+      scalar->add(x.data(), y.data(), expected.data(), n);
+      table->add(x.data(), y.data(), actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->subtract(x.data(), y.data(), expected.data(), n);
+      table->subtract(x.data(), y.data(), actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->negate(x.data(), expected.data(), n);
+      table->negate(x.data(), actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->scale(x.data(), 0.3, expected.data(), n);
+      table->scale(x.data(), 0.3, actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->divide(x.data(), 0.7, expected.data(), n);
+      table->divide(x.data(), 0.7, actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->axpby(x.data(), 0.3, y.data(), -1.1, expected.data(), n);
+      actual = x;
+      table->axpby(actual.data(), 0.3, y.data(), -1.1, actual.data(), n);
+      EXPECT_EQ(expected, actual);
+    }
+  }
+}
+
+TEST(VectorKernelsTest, FloatMatchScalar) {
+  const KernelTable* scalar = FindKernels("scalar");
+  ASSERT_TRUE(scalar != NULL);
+  const char* const names[] = { "sse2", "avx2", "avx512" };
+
+  for (int t = 0; t < 3; ++t) {
+    const KernelTable* table = FindKernels(names[t]);
+    if (table == NULL) {
+      continue;
+    }
+    SCOPED_TRACE(names[t]);
+    for (std::size_t n = 0; n < 40; ++n) {
+      std::vector<double> x_data = MakeData(n, 1.5);
+      std::vector<double> y_data = MakeData(n, -2.25);
+      std::vector<float> x(x_data.begin(), x_data.end());
+      std::vector<float> y(y_data.begin(), y_data.end());
+      std::vector<float> expected(n);
+      std::vector<float> actual(n);
+
+      scalar->float_add(x.data(), y.data(), expected.data(), n);
+      table->float_add(x.data(), y.data(), actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->float_subtract(x.data(), y.data(), expected.data(), n);
+      table->float_subtract(x.data(), y.data(), actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->float_negate(x.data(), expected.data(), n);
+      table->float_negate(x.data(), actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->float_scale(x.data(), 0.3f, expected.data(), n);
+      table->float_scale(x.data(), 0.3f, actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->float_divide(x.data(), 0.7f, expected.data(), n);
+      table->float_divide(x.data(), 0.7f, actual.data(), n);
+      EXPECT_EQ(expected, actual);
+
+      scalar->float_axpby(x.data(), 0.3f, y.data(), -1.1f, expected.data(), n);
+      actual = x;
+      table->float_axpby(actual.data(), 0.3f, y.data(), -1.1f, actual.data(),
+                         n);
+      EXPECT_EQ(expected, actual);
+    }
+  }
+}
+
+// Negation flips only the sign bit, so it also applies to zeros, infinities
+// and NaNs bit for bit.
+TEST(VectorKernelsTest, NegateFlipsSignBit) {
+  const char* const names[] = { "scalar", "sse2", "avx2", "avx512" };
+  const double special[] = { 0.0, -0.0, HUGE_VAL, -HUGE_VAL, std::nan(""),
+                             -std::nan("0x5"), 1e-310, -2.5 };
+  const std::size_t n = 32;
+  std::vector<double> x(n);
+  std::vector<float> float_x(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    x[i] = special[i % 8];
+    float_x[i] = static_cast<float>(special[i % 8]);
+  }
+
+  for (int t = 0; t < 4; ++t) {
+    const KernelTable* table = FindKernels(names[t]);
+    if (table == NULL) {
+      continue;
+    }
+    SCOPED_TRACE(names[t]);
+    std::vector<double> out(n);
+    std::vector<float> float_out(n);
+    table->negate(x.data(), out.data(), n);
+    table->float_negate(float_x.data(), float_out.data(), n);
+    for (std::size_t i = 0; i < n; ++i) {
+      std::uint64_t in_bits, out_bits;
+      std::memcpy(&in_bits, &x[i], sizeof(in_bits));
+      std::memcpy(&out_bits, &out[i], sizeof(out_bits));
+      EXPECT_EQ(in_bits ^ (std::uint64_t(1) << 63), out_bits);
+
+      std::uint32_t float_in_bits, float_out_bits;
+      std::memcpy(&float_in_bits, &float_x[i], sizeof(float_in_bits));
+      std::memcpy(&float_out_bits, &float_out[i], sizeof(float_out_bits));
+      EXPECT_EQ(float_in_bits ^ (std::uint32_t(1) << 31), float_out_bits);
+    }
+  }
+}
+
+TEST(VectorKernelsTest, LongVectorExpressions) {
+  const std::size_t n = 1003;
+  std::vector<double> x_data = MakeData(n, 0.5);
+  std::vector<double> y_data = MakeData(n, 4.0);
+  simple_differentiation::Vector<double> x(x_data.begin(), x_data.end());
+  simple_differentiation::Vector<double> y(y_data.begin(), y_data.end());
+
+  simple_differentiation::Vector<double> z = x*2.0 + 3.0*y;
+  simple_differentiation::Vector<double> w = -x;
+  w += y;
+  w -= x - y;
+  w *= 0.5;
+  w /= 4.0;
+  for (std::size_t i = 0; i < n; ++i) {
+    EXPECT_EQ(x_data[i]*2.0 + y_data[i]*3.0, z[i]);
+    EXPECT_EQ(((-x_data[i] + y_data[i]) - (x_data[i] - y_data[i])) *
+              0.5 / 4.0, w[i]);
+  }
+}
+
+// Double scalars are rounded to float once, so float Vectors still take
+// the float kernels.
+TEST(VectorKernelsTest, MixedPrecisionScalars) {
+  const std::size_t n = 1003;
+  std::vector<double> x_data = MakeData(n, 0.5);
+  std::vector<double> y_data = MakeData(n, 4.0);
+  simple_differentiation::Vector<float> x(x_data.begin(), x_data.end());
+  simple_differentiation::Vector<float> y(y_data.begin(), y_data.end());
+
+  simple_differentiation::Vector<float> z = x*0.1 + 0.3*y;
+  simple_differentiation::Vector<float> scaled = x*0.1;
+  simple_differentiation::Vector<float> divided = x/0.7;
+  simple_differentiation::Vector<float> w = y;
+  w *= 0.1;
+  w /= 0.7;
+  for (std::size_t i = 0; i < n; ++i) {
+    // Stored separately, so that the expected sum is not contracted into a
+    // fused multiply-add either.
+    volatile float x_term = x[i]*0.1f;
+    volatile float y_term = y[i]*0.3f;
+    EXPECT_EQ(x_term + y_term, z[i]);
+    EXPECT_EQ(x[i]*0.1f, scaled[i]);
+    EXPECT_EQ(x[i]/0.7f, divided[i]);
+    EXPECT_EQ(y[i]*0.1f/0.7f, w[i]);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}